@@ -4,7 +4,9 @@ def make_libtar
   Dir.chdir('libtar')
 
   begin
-    system('sh configure') and system('make')
+    # libtar.a is linked into tarruby.so, so its objects must be position independent
+    cflags = "#{ENV['CFLAGS'] || '-O'} #{RbConfig::CONFIG['CCDLFLAGS']}"
+    system('sh', 'configure', "CFLAGS=#{cflags}") and system('make')
   ensure
     Dir.chdir('..')
   end
@@ -13,6 +15,14 @@ end
 if make_libtar and have_header('zlib.h') and have_library('z')
   have_header('bzlib.h')
   have_library('bz2')
+  have_func('rb_time_nano_new')
+  have_header('ruby/thread.h') and have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+  have_header('ruby/io.h')
+  have_header('unistd.h')
+  have_func('rb_io_wait', 'ruby.h')
+  have_func('rb_io_descriptor', 'ruby.h')
+  have_func('rb_io_read_pending', ['ruby.h', 'ruby/io.h'])
+  have_func('rb_ext_ractor_safe', 'ruby.h')
   $CPPFLAGS << ' -Ilibtar/lib -Ilibtar/listhash'
   $objs = %w(tarruby.o libtar/lib/libtar.a)
   create_makefile('tarruby')
@@ -32,6 +32,10 @@
 # include <unistd.h>
 #endif
 
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
 
 struct tar_dev
 {
@@ -57,9 +61,14 @@ tar_dev_free(tar_dev_t *tdp)
 }
 
 
-/* appends a file to the tar archive */
-int
-tar_append_file(TAR *t, char *realname, char *savename)
+/*
+** append a file to the tar archive.  sp, if not NULL, is its lstat().
+** if data isn't NULL, it holds the len bytes of a regular file, already
+** read; they are used if the file has that size.
+*/
+static int
+append_file(TAR *t, char *realname, char *savename, struct stat *sp,
+	    const char *data, size_t len)
 {
 	struct stat s;
 	int i;
@@ -74,12 +83,14 @@ tar_append_file(TAR *t, char *realname, char *savename)
 	       (savename ? savename : "[NULL]"));
 #endif
 
-	if (lstat(realname, &s) != 0)
+	if (sp != NULL)
+		s = *sp;
+	else if (lstat(realname, &s) != 0)
 	{
 #ifdef DEBUG
 		perror("lstat()");
 #endif
-		return -1;
+		return tar_fail(t);
 	}
 
 	/* set header block */
@@ -113,9 +124,9 @@ tar_append_file(TAR *t, char *realname, char *savename)
 		td->td_dev = s.st_dev;
 		td->td_h = libtar_hash_new(256, (libtar_hashfunc_t)ino_hash);
 		if (td->td_h == NULL)
-			return -1;
+			return tar_fail(t);
 		if (libtar_hash_add(t->h, td) == -1)
-			return -1;
+			return tar_fail(t);
 	}
 #ifndef _WIN32
 	libtar_hashptr_reset(&hp);
@@ -139,7 +150,7 @@ tar_append_file(TAR *t, char *realname, char *savename)
 #endif
 		ti = (tar_ino_t *)calloc(1, sizeof(tar_ino_t));
 		if (ti == NULL)
-			return -1;
+			return tar_fail(t);
 		ti->ti_ino = s.st_ino;
 		snprintf(ti->ti_name, sizeof(ti->ti_name), "%s",
 			 savename ? savename : realname);
@@ -153,7 +164,7 @@ tar_append_file(TAR *t, char *realname, char *savename)
 	{
 		i = readlink(realname, path, sizeof(path));
 		if (i == -1)
-			return -1;
+			return tar_fail(t);
 		if (i >= MAXPATHLEN)
 			i = MAXPATHLEN - 1;
 		path[i] = '\0';
@@ -165,6 +176,10 @@ tar_append_file(TAR *t, char *realname, char *savename)
 	}
 #endif /* #ifndef _WIN32 */
 
+	/* with TAR_SPARSE, regular files with holes go in as sparse members */
+	if (TH_ISREG(t) && (i = tar_append_sparse(t, realname, &s)) != 1)
+		return (i == 0 ? 0 : tar_fail(t));
+
 	/* print file info */
 	if (t->options & TAR_VERBOSE)
 		th_print_long_ls(t);
@@ -178,20 +193,44 @@ tar_append_file(TAR *t, char *realname, char *savename)
 #ifdef DEBUG
 		printf("t->fd = %d\n", t->fd);
 #endif
-		return -1;
+		return tar_fail(t);
 	}
 #ifdef DEBUG
 	puts("    tar_append_file(): back from th_write()");
 #endif
 
 	/* if it's a regular file, write the contents as well */
-	if (TH_ISREG(t) && tar_append_regfile(t, realname) != 0)
-		return -1;
+	if (TH_ISREG(t) && data != NULL && th_get_size(t) == (tar_off_t)len)
+	{
+		t->data_left = (tar_off_t)len;
+		t->data_bufoff = t->data_buflen = 0;
+		if (tar_write_data(t, data, len) != 0)
+			return -1;
+	}
+	else if (TH_ISREG(t) && tar_append_regfile(t, realname) != 0)
+		return tar_fail(t);
 
 	return 0;
 }
 
 
+/* appends a file to the tar archive */
+int
+tar_append_file(TAR *t, char *realname, char *savename)
+{
+	return append_file(t, realname, savename, NULL, NULL, 0);
+}
+
+
+/* tar_append_file() for a file whose lstat(), and contents, are known */
+int
+tar_append_file_data(TAR *t, char *realname, char *savename,
+		     struct stat *s, const char *data, size_t len)
+{
+	return append_file(t, realname, savename, s, data, len);
+}
+
+
 /* write EOF indicator */
 int
 tar_append_eof(TAR *t)
@@ -207,7 +246,7 @@ tar_append_eof(TAR *t)
 		{
 			if (i != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 	}
 
@@ -221,8 +260,8 @@ tar_append_regfile(TAR *t, char *realname)
 {
 	char block[T_BLOCKSIZE];
 	int filefd;
-	int i, j;
-	size_t size;
+	int j;
+	tar_off_t size, i;
 
 	filefd = open(realname, O_RDONLY
 #ifdef O_BINARY
@@ -235,7 +274,7 @@ tar_append_regfile(TAR *t, char *realname)
 #ifdef DEBUG
 		perror("open()");
 #endif
-		return -1;
+		return tar_fail(t);
 	}
 
 	size = th_get_size(t);
@@ -246,20 +285,20 @@ tar_append_regfile(TAR *t, char *realname)
 		{
 			if (j != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 		if (tar_block_write(t, &block) == -1)
-			return -1;
+			return tar_fail(t);
 	}
 
 	if (i > 0)
 	{
-		j = read(filefd, &block, i);
+		j = read(filefd, &block, (size_t)i);
 		if (j == -1)
-			return -1;
+			return tar_fail(t);
 		memset(&(block[i]), 0, T_BLOCKSIZE - i);
 		if (tar_block_write(t, &block) == -1)
-			return -1;
+			return tar_fail(t);
 	}
 
 	close(filefd);
@@ -271,9 +310,8 @@ static int
 tar_append_function0(TAR *t, void *data, int (*f)(char *b, int l, void *d))
 {
 	char block[T_BLOCKSIZE];
-	int filefd;
-	int i, j;
-	size_t size;
+	int j;
+	tar_off_t size, i;
 
 	size = th_get_size(t);
 	for (i = size; i > T_BLOCKSIZE; i -= T_BLOCKSIZE)
@@ -283,35 +321,55 @@ tar_append_function0(TAR *t, void *data, int (*f)(char *b, int l, void *d))
 		{
 			if (j != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 		if (tar_block_write(t, &block) == -1)
-			return -1;
+			return tar_fail(t);
 	}
 
 	if (i > 0)
 	{
-		j = f(block, i, data);
+		j = f(block, (int)i, data);
 		if (j == -1)
-			return -1;
+			return tar_fail(t);
 		memset(&(block[i]), 0, T_BLOCKSIZE - i);
 		if (tar_block_write(t, &block) == -1)
-			return -1;
+			return tar_fail(t);
 	}
 
 	return 0;
 }
 
 int
-tar_append_function(TAR *t, char *savename, int size, void *data, int (*f)(char *b, int l, void *d))
+tar_append_function(TAR *t, char *savename, tar_off_t size, void *data, int (*f)(char *b, int l, void *d))
+{
+	if (tar_append_header(t, savename, size, 0644, time(NULL)) != 0)
+		return -1;
+
+	/* if it's a regular file, write the contents as well */
+	if (tar_append_function0(t, data, f) != 0)
+		return tar_fail(t);
+
+	return 0;
+}
+
+
+/*
+** write the header of a regular file whose size bytes of contents
+** are then supplied by tar_write_data().
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_append_header(TAR *t, char *savename, tar_off_t size, mode_t mode,
+		  time_t mtime)
 {
 	/* set header block */
 	memset(&(t->th_buf), 0, sizeof(struct tar_header));
 	t->th_buf.typeflag = REGTYPE;
 	th_set_user(t, 0);
 	th_set_group(t, 0);
-	th_set_mode(t, 0644);
-	th_set_mtime(t, (int) time(NULL));
+	th_set_mode(t, mode);
+	th_set_mtime(t, mtime);
 	th_set_size(t, size);
 
 	/* set the header path */
@@ -324,12 +382,271 @@ tar_append_function(TAR *t, char *savename, int size, void *data, int (*f)(char
 	/* write header */
 	if (th_write(t) != 0)
 	{
-		return -1;
+		return tar_fail(t);
 	}
 
-	/* if it's a regular file, write the contents as well */
-	if (tar_append_function0(t, data, f) != 0)
-		return -1;
+	/* position the tar_write_data() cursor at the start of the contents */
+	t->data_left = size;
+	t->data_bufoff = t->data_buflen = 0;
+
+	return 0;
+}
+
+
+/* write len bytes to the archive, continuing after short writes */
+ssize_t
+tar_write_full(TAR *t, const char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len)
+	{
+		n = (*(t->type->writefunc))(t->fd, (char *)buf + done,
+					    len - done);
+		if (n == -1)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
+
+/*
+** append count regular files whose contents are in memory, all with the
+** given mode, mtime and owner.  the header fields they share are
+** encoded, and the owner names looked up, once; each member then only
+** has its path and size set before the header is written.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_append_buffers(TAR *t, tar_buffer_t *bufs, size_t count, mode_t mode,
+		   time_t mtime, uid_t uid, gid_t gid)
+{
+	struct tar_header proto;
+	size_t i;
+
+	memset(&(t->th_buf), 0, sizeof(struct tar_header));
+	t->th_buf.typeflag = REGTYPE;
+	th_set_user(t, uid);
+	th_set_group(t, gid);
+	th_set_mode(t, mode);
+	th_set_mtime(t, mtime);
+	proto = t->th_buf;
+
+	for (i = 0; i < count; i++)
+	{
+		/* th_set_path() keeps a long name of its own */
+		if (t->th_buf.gnu_longname != NULL)
+			free(t->th_buf.gnu_longname);
+		t->th_buf = proto;
+		th_set_size(t, (tar_off_t)bufs[i].len);
+		th_set_path(t, bufs[i].savename);
+
+		if (t->options & TAR_VERBOSE)
+			th_print_long_ls(t);
+
+		if (th_write(t) != 0)
+			return tar_fail(t);
+
+		t->data_left = (tar_off_t)bufs[i].len;
+		t->data_bufoff = t->data_buflen = 0;
+		if (tar_write_data(t, bufs[i].data, bufs[i].len) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/* the largest copy_file_range() asked for at once */
+#define COPY_RANGE_MAX		(1 << 30)
+
+/* copy size bytes of whole blocks from the archive of src to that of t */
+static int
+copy_blocks(TAR *t, TAR *src, tar_off_t size)
+{
+	char buf[T_BLOCKSIZE * 64];
+	size_t len;
+	ssize_t n;
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+	/* between plain files the kernel moves the blocks, or shares them */
+	while (size > 0 && tar_plain(t) && tar_plain(src))
+	{
+		len = (size > COPY_RANGE_MAX ? COPY_RANGE_MAX : (size_t)size);
+		n = syscall(__NR_copy_file_range, (int)src->fd, NULL,
+			    (int)t->fd, NULL, len, 0);
+		if (n == -1 && (errno == EXDEV || errno == ENOSYS
+				|| errno == EINVAL || errno == EOPNOTSUPP))
+			break;
+		if (n == -1)
+			return -1;
+		if (n == 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		size -= n;
+	}
+#endif
+
+	while (size > 0)
+	{
+		len = (size > (tar_off_t)sizeof(buf) ? sizeof(buf) : (size_t)size);
+		n = tar_read_full(src, buf, len);
+		if (n == (ssize_t)len)
+			n = tar_write_full(t, buf, len);
+		if (n != (ssize_t)len)
+		{
+			if (n != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		size -= len;
+	}
+
+	return 0;
+}
+
+
+/*
+** write the header set up by th_copy(), and then the contents of the
+** member src is on.  they are copied as the raw blocks they are stored
+** in, without being decoded: with copy_file_range() between two plain
+** archive files, where the kernel has it, and through a buffer
+** otherwise.  a sparse member is expanded, and a dumpdir's names are
+** taken from the header.  the contents of src must not have been read.
+** with a NULL src, they are supplied by tar_write_data() instead.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_append_member(TAR *t, TAR *src)
+{
+	char buf[T_BLOCKSIZE * 16];
+	ssize_t n;
+
+	if (t->options & TAR_VERBOSE)
+		th_print_long_ls(t);
+
+	if (th_write(t) != 0)
+		return tar_fail(t);
+
+	/* position the tar_write_data() cursor at the start of the contents */
+	t->data_left = th_get_size(t);
+	t->data_bufoff = t->data_buflen = 0;
+
+	if (src == NULL || t->data_left == 0)
+		return 0;
+
+	if (TH_ISDUMPDIR(t))
+	{
+		if (t->th_buf.gnu_dumpdir == NULL)
+		{
+			errno = ENOMEM;
+			return tar_fail(t);
+		}
+		return tar_write_data(t, t->th_buf.gnu_dumpdir,
+				      (size_t)t->data_left);
+	}
+
+	if (TH_ISSPARSE(src))
+	{
+		while ((n = tar_read_data(src, buf, sizeof(buf))) > 0)
+			if (tar_write_data(t, buf, n) != 0)
+				return -1;
+		if (n == -1)
+		{
+			errno = src->errnum;
+			return tar_fail(t);
+		}
+		if (t->data_left != 0)
+		{
+			errno = EINVAL;
+			return tar_fail(t);
+		}
+		return 0;
+	}
+
+	if (src->data_left != t->data_left
+	    || src->data_buflen != src->data_bufoff)
+	{
+		errno = EINVAL;
+		return tar_fail(t);
+	}
+
+	if (copy_blocks(t, src, (src->data_left + T_BLOCKSIZE - 1)
+			/ T_BLOCKSIZE * T_BLOCKSIZE) != 0)
+		return tar_fail(t);
+	src->data_left = 0;
+	t->data_left = 0;
+
+	return 0;
+}
+
+
+/*
+** append len bytes to the contents of the regular file started by
+** tar_append_header().  whole blocks are written straight from buf;
+** the rest is kept in t->data_buf until the next call fills the block.
+** the last block is padded and written once all the contents are in.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_write_data(TAR *t, const void *buf, size_t len)
+{
+	const char *ptr = (const char *)buf;
+	size_t done = 0, n;
+	ssize_t k;
+
+	if ((tar_off_t)len > t->data_left)
+	{
+		errno = EFBIG;
+		return tar_fail(t);
+	}
+
+	while (done < len)
+	{
+		if (t->data_buflen == 0 && len - done >= T_BLOCKSIZE)
+		{
+			n = (len - done) / T_BLOCKSIZE * T_BLOCKSIZE;
+			k = tar_write_full(t, ptr + done, n);
+			if (k != (ssize_t)n)
+			{
+				if (k != -1)
+					errno = EINVAL;
+				return tar_fail(t);
+			}
+		}
+		else
+		{
+			n = T_BLOCKSIZE - t->data_buflen;
+			if (n > len - done)
+				n = len - done;
+			memcpy(t->data_buf + t->data_buflen, ptr + done, n);
+			t->data_buflen += n;
+		}
+		t->data_left -= n;
+		done += n;
+
+		if (t->data_buflen == T_BLOCKSIZE
+		    || (t->data_buflen > 0 && t->data_left == 0))
+		{
+			memset(t->data_buf + t->data_buflen, 0,
+			       T_BLOCKSIZE - t->data_buflen);
+			t->data_buflen = 0;
+			k = tar_block_write(t, t->data_buf);
+			if (k != T_BLOCKSIZE)
+			{
+				if (k != -1)
+					errno = EINVAL;
+				return tar_fail(t);
+			}
+		}
+	}
 
 	return 0;
 }
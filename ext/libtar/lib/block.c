@@ -37,7 +37,7 @@ th_read_internal(TAR *t)
 	while ((i = tar_block_read(t, &(t->th_buf))) == T_BLOCKSIZE)
 	{
 		/* two all-zero blocks mark EOF */
-		if (t->th_buf.name[0] == '\0')
+		if (th_block_is_zero(&(t->th_buf)))
 		{
 			num_zero_blocks++;
 			if (!BIT_ISSET(t->options, TAR_IGNORE_EOT)
@@ -86,14 +86,56 @@ th_read_internal(TAR *t)
 }
 
 
-/* wrapper function for th_read_internal() to handle GNU extensions */
-int
-th_read(TAR *t)
+/* read the data blocks of a GNU long name/link or dumpdir header */
+static int
+th_read_gnu_long(TAR *t, char **longp)
 {
 	int i, j;
-	size_t sz;
+	tar_off_t sz;
 	char *ptr;
 
+	sz = oct_to_size(t->th_buf.size, sizeof(t->th_buf.size));
+	j = (sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
+#ifdef DEBUG
+	printf("    th_read(): GNU long %s detected "
+	       "(%ld bytes, %d blocks)\n",
+	       (TH_ISLONGLINK(t) ? "linkname" : "filename"), (long)sz, j);
+#endif
+	if (*longp != NULL)
+		free(*longp);
+	*longp = (char *)malloc(j * T_BLOCKSIZE + 1);
+	if (*longp == NULL)
+		return tar_fail(t);
+	(*longp)[j * T_BLOCKSIZE] = '\0';
+
+	for (ptr = *longp; j > 0; j--, ptr += T_BLOCKSIZE)
+	{
+#ifdef DEBUG
+		printf("    th_read(): reading long name "
+		       "(%d blocks left, ptr == %ld)\n", j, ptr);
+#endif
+		i = tar_block_read(t, ptr);
+		if (i != T_BLOCKSIZE)
+		{
+			if (i != -1)
+				errno = EINVAL;
+			return tar_fail(t);
+		}
+	}
+#ifdef DEBUG
+	printf("    th_read(): long name == \"%s\"\n", *longp);
+#endif
+
+	return 0;
+}
+
+
+/* wrapper function for th_read_internal() to handle GNU and pax extensions */
+int
+th_read(TAR *t)
+{
+	int i;
+
 #ifdef DEBUG
 	printf("==> th_read(t=0x%lx)\n", t);
 #endif
@@ -102,8 +144,14 @@ th_read(TAR *t)
 		free(t->th_buf.gnu_longname);
 	if (t->th_buf.gnu_longlink != NULL)
 		free(t->th_buf.gnu_longlink);
+	if (t->th_buf.gnu_dumpdir != NULL)
+		free(t->th_buf.gnu_dumpdir);
 	memset(&(t->th_buf), 0, sizeof(struct tar_header));
 
+	/* values from the last global header apply to every member */
+	t->th_buf.pax = t->pax_global;
+	t->sparse_count = 0;
+
 	i = th_read_internal(t);
 	if (i == 0)
 		return 1;
@@ -111,98 +159,35 @@ th_read(TAR *t)
 	{
 		if (i != -1)
 			errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
-	/* check for GNU long link extention */
-	if (TH_ISLONGLINK(t))
+	/* consume GNU long link/name and pax headers preceding the member */
+	while (TH_ISLONGLINK(t) || TH_ISLONGNAME(t)
+	       || TH_ISPAXHEADER(t) || TH_ISPAXGLOBAL(t))
 	{
-		sz = th_get_size(t);
-		j = (sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
-#ifdef DEBUG
-		printf("    th_read(): GNU long linkname detected "
-		       "(%ld bytes, %d blocks)\n", sz, j);
-#endif
-		t->th_buf.gnu_longlink = (char *)malloc(j * T_BLOCKSIZE);
-		if (t->th_buf.gnu_longlink == NULL)
-			return -1;
-
-		for (ptr = t->th_buf.gnu_longlink; j > 0;
-		     j--, ptr += T_BLOCKSIZE)
-		{
-#ifdef DEBUG
-			printf("    th_read(): reading long linkname "
-			       "(%d blocks left, ptr == %ld)\n", j, ptr);
-#endif
-			i = tar_block_read(t, ptr);
-			if (i != T_BLOCKSIZE)
-			{
-				if (i != -1)
-					errno = EINVAL;
-				return -1;
-			}
-#ifdef DEBUG
-			printf("    th_read(): read block == \"%s\"\n", ptr);
-#endif
-		}
-#ifdef DEBUG
-		printf("    th_read(): t->th_buf.gnu_longlink == \"%s\"\n",
-		       t->th_buf.gnu_longlink);
-#endif
+		if (TH_ISPAXHEADER(t) || TH_ISPAXGLOBAL(t))
+			i = th_pax_read(t);
+		else if (TH_ISLONGLINK(t))
+			i = th_read_gnu_long(t, &(t->th_buf.gnu_longlink));
+		else
+			i = th_read_gnu_long(t, &(t->th_buf.gnu_longname));
+		if (i != 0)
+			return tar_fail(t);
 
 		i = th_read_internal(t);
 		if (i != T_BLOCKSIZE)
 		{
 			if (i != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 	}
 
-	/* check for GNU long name extention */
-	if (TH_ISLONGNAME(t))
-	{
-		sz = th_get_size(t);
-		j = (sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
-#ifdef DEBUG
-		printf("    th_read(): GNU long filename detected "
-		       "(%ld bytes, %d blocks)\n", sz, j);
-#endif
-		t->th_buf.gnu_longname = (char *)malloc(j * T_BLOCKSIZE);
-		if (t->th_buf.gnu_longname == NULL)
-			return -1;
-
-		for (ptr = t->th_buf.gnu_longname; j > 0;
-		     j--, ptr += T_BLOCKSIZE)
-		{
-#ifdef DEBUG
-			printf("    th_read(): reading long filename "
-			       "(%d blocks left, ptr == %ld)\n", j, ptr);
-#endif
-			i = tar_block_read(t, ptr);
-			if (i != T_BLOCKSIZE)
-			{
-				if (i != -1)
-					errno = EINVAL;
-				return -1;
-			}
-#ifdef DEBUG
-			printf("    th_read(): read block == \"%s\"\n", ptr);
-#endif
-		}
-#ifdef DEBUG
-		printf("    th_read(): t->th_buf.gnu_longname == \"%s\"\n",
-		       t->th_buf.gnu_longname);
-#endif
-
-		i = th_read_internal(t);
-		if (i != T_BLOCKSIZE)
-		{
-			if (i != -1)
-				errno = EINVAL;
-			return -1;
-		}
-	}
+	/* a dumpdir's contents are the names in it, not file data */
+	if (TH_ISDUMPDIR(t)
+	    && th_read_gnu_long(t, &(t->th_buf.gnu_dumpdir)) != 0)
+		return tar_fail(t);
 
 #if 0
 	/*
@@ -222,7 +207,8 @@ th_read(TAR *t)
 	*/
 	if (t->th_buf.typeflag == AREGTYPE)
 	{
-		mode = (mode_t)oct_to_int(t->th_buf.mode);
+		mode = (mode_t)oct_to_size(t->th_buf.mode,
+					    sizeof(t->th_buf.mode));
 
 		if (S_ISREG(mode))
 			t->th_buf.typeflag = REGTYPE;
@@ -239,6 +225,17 @@ th_read(TAR *t)
 	}
 #endif
 
+	/* decode the fields once, up front */
+	th_decode(t);
+
+	/* position the tar_read_data() cursor at the start of the contents */
+	t->data_left = (TH_ISREG(t) ? th_get_size(t) : 0);
+	t->data_bufoff = t->data_buflen = 0;
+
+	/* a sparse member's map is in its header or at the start of its data */
+	if (TH_ISREG(t) && th_sparse_read(t) != 0)
+		return tar_fail(t);
+
 	return 0;
 }
 
@@ -249,7 +246,7 @@ th_write(TAR *t)
 {
 	int i, j;
 	char type2;
-	size_t sz, sz2;
+	tar_off_t sz, sz2;
 	char *ptr;
 	char buf[T_BLOCKSIZE];
 
@@ -258,7 +255,12 @@ th_write(TAR *t)
 	th_print(t);
 #endif
 
-	if ((t->options & TAR_GNU) && t->th_buf.gnu_longlink != NULL)
+	/* pax records replace the GNU long name/link blocks */
+	if ((t->options & TAR_PAX) && th_pax_write(t) != 0)
+		return tar_fail(t);
+
+	if ((t->options & TAR_GNU) && !(t->options & TAR_PAX)
+	    && t->th_buf.gnu_longlink != NULL)
 	{
 #ifdef DEBUG
 		printf("th_write(): using gnu_longlink (\"%s\")\n",
@@ -278,7 +280,7 @@ th_write(TAR *t)
 		{
 			if (i != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 
 		/* write out extra blocks containing long name */
@@ -291,7 +293,7 @@ th_write(TAR *t)
 			{
 				if (i != -1)
 					errno = EINVAL;
-				return -1;
+				return tar_fail(t);
 			}
 		}
 		memset(buf, 0, T_BLOCKSIZE);
@@ -301,7 +303,7 @@ th_write(TAR *t)
 		{
 			if (i != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 
 		/* reset type and size to original values */
@@ -309,7 +311,8 @@ th_write(TAR *t)
 		th_set_size(t, sz2);
 	}
 
-	if ((t->options & TAR_GNU) && t->th_buf.gnu_longname != NULL)
+	if ((t->options & TAR_GNU) && !(t->options & TAR_PAX)
+	    && t->th_buf.gnu_longname != NULL)
 	{
 #ifdef DEBUG
 		printf("th_write(): using gnu_longname (\"%s\")\n",
@@ -329,7 +332,7 @@ th_write(TAR *t)
 		{
 			if (i != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 
 		/* write out extra blocks containing long name */
@@ -342,7 +345,7 @@ th_write(TAR *t)
 			{
 				if (i != -1)
 					errno = EINVAL;
-				return -1;
+				return tar_fail(t);
 			}
 		}
 		memset(buf, 0, T_BLOCKSIZE);
@@ -352,7 +355,7 @@ th_write(TAR *t)
 		{
 			if (i != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 
 		/* reset type and size to original values */
@@ -372,7 +375,7 @@ th_write(TAR *t)
 	{
 		if (i != -1)
 			errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 #ifdef DEBUG
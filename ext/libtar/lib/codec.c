@@ -0,0 +1,188 @@
+/*
+**  codec.c - libtar code to checksum header blocks and convert the
+**            numeric header fields
+**
+**  The block routines use SSE2, which every x86-64 compiler targets,
+**  and fall back to word-at-a-time C elsewhere.  The octal conversions
+**  are table driven, so decoding and encoding a header never goes
+**  through sscanf() or snprintf().
+*/
+
+#include <internal.h>
+
+#ifdef STDC_HEADERS
+# include <string.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) \
+      || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define CODEC_SSE2
+# include <emmintrin.h>
+#endif
+
+
+/* value of each octal digit, -1 for anything else */
+static const signed char oct_digit[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/* every pair of octal digits, indexed by a 6-bit value */
+static const char oct_pairs[] =
+	"0001020304050607101112131415161720212223242526273031323334353637"
+	"4041424344454647505152535455565760616263646566677071727374757677";
+
+
+/* sum of the 512 bytes of a block, each taken as unsigned */
+static unsigned int
+block_sum(const unsigned char *p)
+{
+#if defined(CODEC_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i < T_BLOCKSIZE; i += 16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(
+			_mm_loadu_si128((const __m128i *)(p + i)), zero));
+	return _mm_cvtsi128_si32(acc)
+	       + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#else
+	/* add the bytes pairwise into four 16-bit lanes of a word */
+	unsigned long long w, lanes = 0;
+	const unsigned long long m = 0x00ff00ff00ff00ffULL;
+	int i;
+
+	for (i = 0; i < T_BLOCKSIZE; i += 8)
+	{
+		memcpy(&w, p + i, 8);
+		lanes += (w & m) + ((w >> 8) & m);
+	}
+	lanes = (lanes & 0x0000ffff0000ffffULL)
+		+ ((lanes >> 16) & 0x0000ffff0000ffffULL);
+	return (unsigned int)((lanes & 0xffffffffULL) + (lanes >> 32));
+#endif
+}
+
+
+/* true if all 512 bytes of the block are zero */
+int
+th_block_is_zero(const void *buf)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	int i;
+#if defined(CODEC_SSE2)
+	__m128i acc = _mm_setzero_si128();
+
+	for (i = 0; i < T_BLOCKSIZE; i += 16)
+		acc = _mm_or_si128(acc,
+			_mm_loadu_si128((const __m128i *)(p + i)));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc,
+					_mm_setzero_si128())) == 0xffff;
+#else
+	unsigned long long w, acc = 0;
+
+	for (i = 0; i < T_BLOCKSIZE; i += 8)
+	{
+		memcpy(&w, p + i, 8);
+		acc |= w;
+	}
+	return acc == 0;
+#endif
+}
+
+
+/* calculate header checksum */
+int
+th_crc_calc(TAR *t)
+{
+	unsigned int sum;
+	int i;
+
+	/* the chksum field is summed as if it were filled with spaces */
+	sum = block_sum((const unsigned char *)&(t->th_buf));
+	for (i = 0; i < 8; i++)
+		sum += (' ' - (unsigned char)t->th_buf.chksum[i]);
+
+	return (int)sum;
+}
+
+
+/* string-octal to integer conversion, within a field of octlen bytes */
+int
+oct_to_int(char *oct, size_t octlen)
+{
+	return (int)oct_to_size(oct, octlen);
+}
+
+
+/* numeric field to 64-bit integer conversion (octal or GNU base-256) */
+tar_off_t
+oct_to_size(char *oct, size_t octlen)
+{
+	const unsigned char *p = (const unsigned char *)oct;
+	const unsigned char *end = p + octlen;
+	tar_off_t n;
+	int d;
+
+	/* GNU base-256: high bit set, two's complement big-endian */
+	if (*p & 0x80)
+	{
+		n = ((*p & 0x40) ? (tar_off_t)(signed char)*p : (*p & 0x3f));
+		for (p++; p < end; p++)
+			n = n * 256 + *p;
+		return n;
+	}
+
+	while (p < end && *p == ' ')
+		p++;
+	for (n = 0; p < end && (d = oct_digit[*p]) >= 0; p++)
+		n = (n << 3) | d;
+
+	return n;
+}
+
+
+/* 64-bit integer to numeric field conversion (GNU base-256 if too big) */
+void
+size_to_oct(tar_off_t num, char *oct, size_t octlen)
+{
+	size_t i;
+
+	if (num >= 0 && (num >> ((octlen - 1) * 3)) == 0)
+	{
+		/* zero-padded octal digits, two at a time, then a NUL */
+		oct[octlen - 1] = '\0';
+		for (i = octlen - 1; i >= 2; i -= 2, num >>= 6)
+			memcpy(oct + i - 2, oct_pairs + (num & 077) * 2, 2);
+		if (i == 1)
+			oct[0] = '0' + (char)(num & 07);
+		return;
+	}
+
+	for (i = octlen; i > 0; i--, num >>= 8)
+		oct[i - 1] = (char)(num & 0xff);
+	oct[0] |= 0x80;
+}
+
+
+/* integer to string-octal conversion, no NULL */
+void
+int_to_oct_nonull(int num, char *oct, size_t octlen)
+{
+	size_to_oct((tar_off_t)num, oct, octlen);
+}
@@ -14,8 +14,6 @@
 
 #include <stdio.h>
 #include <sys/param.h>
-#include <pwd.h>
-#include <grp.h>
 
 #ifdef STDC_HEADERS
 # include <string.h>
@@ -23,71 +21,111 @@
 
 
 /* determine full path name */
-char *
-th_get_pathname(TAR *t)
+static char *
+th_decode_pathname(TAR *t)
 {
-	char filename[MAXPATHLEN];
+	struct tar_info *info = &(t->th_buf.info);
+	size_t len;
 
-	if (t->th_buf.gnu_longname)
-		return strdup(t->th_buf.gnu_longname);
+	/* the header of a pax sparse file names a GNUSparseFile.* dir */
+	if ((t->th_buf.pax.flags & TAR_PAX_SPARSE)
+	    && t->th_buf.pax.sparse_name != NULL)
+		return t->th_buf.pax.sparse_name;
+
+	if (t->th_buf.pax.flags & TAR_PAX_PATH)
+		return t->th_buf.pax.path;
 
-	if (t->th_buf.prefix[0] != '\0')
+	if (t->th_buf.gnu_longname)
+		return t->th_buf.gnu_longname;
+
+	/* the ustar fields need not be NUL-terminated; an old GNU header
+	   keeps its times, or a sparse map, where the prefix would be */
+	len = 0;
+	if (t->th_buf.prefix[0] != '\0'
+	    && t->th_buf.typeflag != GNU_SPARSE_TYPE
+	    && memcmp(t->th_buf.magic, "ustar ", 6) != 0)
 	{
-		snprintf(filename, sizeof(filename), "%.155s/%.100s",
-			 t->th_buf.prefix, t->th_buf.name);
-		return strdup(filename);
+		len = strnlen(t->th_buf.prefix, T_PREFIXLEN);
+		memcpy(info->pathbuf, t->th_buf.prefix, len);
+		info->pathbuf[len++] = '/';
 	}
+	memcpy(info->pathbuf + len, t->th_buf.name,
+	       strnlen(t->th_buf.name, T_NAMELEN));
+	info->pathbuf[len + strnlen(t->th_buf.name, T_NAMELEN)] = '\0';
 
-	snprintf(filename, sizeof(filename), "%.100s", t->th_buf.name);
-	return strdup(filename);
+	return info->pathbuf;
 }
 
 
-uid_t
-th_get_uid(TAR *t)
+/* determine link target */
+static char *
+th_decode_linkname(TAR *t)
 {
-	int uid;
-#ifndef _WIN32
-	struct passwd *pw;
+	struct tar_info *info = &(t->th_buf.info);
+	size_t len;
 
-	pw = getpwnam(t->th_buf.uname);
-	if (pw != NULL)
-		return pw->pw_uid;
-#endif
+	if (t->th_buf.pax.flags & TAR_PAX_LINKPATH)
+		return t->th_buf.pax.linkpath;
 
-	/* if the password entry doesn't exist */
-	sscanf(t->th_buf.uid, "%o", &uid);
-	return uid;
-}
+	if (t->th_buf.gnu_longlink)
+		return t->th_buf.gnu_longlink;
 
+	len = strnlen(t->th_buf.linkname, T_NAMELEN);
+	memcpy(info->linkbuf, t->th_buf.linkname, len);
+	info->linkbuf[len] = '\0';
 
-gid_t
-th_get_gid(TAR *t)
-{
-	int gid;
-#ifndef _WIN32
-	struct group *gr;
-
-	gr = getgrnam(t->th_buf.gname);
-	if (gr != NULL)
-		return gr->gr_gid;
-#endif
-
-	/* if the group entry doesn't exist */
-	sscanf(t->th_buf.gid, "%o", &gid);
-	return gid;
+	return info->linkbuf;
 }
 
 
-mode_t
-th_get_mode(TAR *t)
+/* decode the current header into t->th_buf.info */
+struct tar_info *
+th_decode(TAR *t)
 {
+	struct tar_info *info = &(t->th_buf.info);
+	struct tar_pax *pax = &(t->th_buf.pax);
+	char typeflag = t->th_buf.typeflag;
 	mode_t mode;
+	int types = 0;
+	size_t len;
+
+	info->pathname = th_decode_pathname(t);
+	info->linkname = th_decode_linkname(t);
+	len = strlen(info->pathname);
+
+	mode = (mode_t)oct_to_size(t->th_buf.mode, sizeof(t->th_buf.mode));
+
+	/* the same tests the TH_IS*() macros used to make on every call */
+	if (typeflag == REGTYPE || typeflag == AREGTYPE || typeflag == CONTTYPE
+	    || typeflag == GNU_SPARSE_TYPE
+	    || (S_ISREG(mode) && typeflag != LNKTYPE))
+		types |= 1 << TH_TYPE_REG;
+	if (typeflag == LNKTYPE)
+		types |= 1 << TH_TYPE_LNK;
+	if (typeflag == SYMTYPE || S_ISLNK(mode))
+		types |= 1 << TH_TYPE_SYM;
+	if (typeflag == CHRTYPE || S_ISCHR(mode))
+		types |= 1 << TH_TYPE_CHR;
+	if (typeflag == BLKTYPE || S_ISBLK(mode))
+		types |= 1 << TH_TYPE_BLK;
+	if (typeflag == DIRTYPE || typeflag == GNU_DUMPDIR_TYPE
+	    || S_ISDIR(mode)
+	    || (typeflag == AREGTYPE && len > 0
+		&& info->pathname[len - 1] == '/'))
+		types |= 1 << TH_TYPE_DIR;
+	if (typeflag == FIFOTYPE || S_ISFIFO(mode))
+		types |= 1 << TH_TYPE_FIFO;
+	info->types = types;
+
+	/* the first match wins, anything else is a regular file */
+	for (info->type = TH_TYPE_DIR; info->type < TH_TYPE_REG; info->type++)
+		if (types & (1 << info->type))
+			break;
 
-	mode = (mode_t)oct_to_int(t->th_buf.mode);
+	/* add the file type bits the header doesn't carry */
 	if (! (mode & S_IFMT))
 	{
-		switch (t->th_buf.typeflag)
+		switch (typeflag)
 		{
 #ifndef _WIN32
 		case SYMTYPE:
@@ -103,6 +141,7 @@ th_get_mode(TAR *t)
 			break;
 #endif
 		case DIRTYPE:
+		case GNU_DUMPDIR_TYPE:
 			mode |= S_IFDIR;
 			break;
 #ifndef _WIN32
@@ -111,7 +150,7 @@ th_get_mode(TAR *t)
 			break;
 #endif
 		case AREGTYPE:
-			if (t->th_buf.name[strlen(t->th_buf.name) - 1] == '/')
+			if (len > 0 && info->pathname[len - 1] == '/')
 			{
 				mode |= S_IFDIR;
 				break;
@@ -123,8 +162,72 @@ th_get_mode(TAR *t)
 			mode |= S_IFREG;
 		}
 	}
+	info->mode = mode;
+
+	/* pax records take precedence over the ustar fields */
+	if (TH_ISSPARSE(t))
+		info->size = t->sparse_size;
+	else if (pax->flags & TAR_PAX_SIZE)
+		info->size = pax->size;
+	else
+		info->size = oct_to_size(t->th_buf.size, sizeof(t->th_buf.size));
+	if (pax->flags & TAR_PAX_MTIME)
+	{
+		info->mtime = (time_t)pax->mtime;
+		info->mtime_nsec = pax->mtime_nsec;
+	}
+	else
+	{
+		info->mtime = (time_t)oct_to_size(t->th_buf.mtime,
+						  sizeof(t->th_buf.mtime));
+		info->mtime_nsec = 0;
+	}
+	if (pax->flags & TAR_PAX_UID)
+		info->uid = pax->uid;
+	else
+		info->uid = (unsigned long)oct_to_size(t->th_buf.uid,
+						       sizeof(t->th_buf.uid));
+	if (pax->flags & TAR_PAX_GID)
+		info->gid = pax->gid;
+	else
+		info->gid = (unsigned long)oct_to_size(t->th_buf.gid,
+						       sizeof(t->th_buf.gid));
+	info->devmajor = (unsigned long)oct_to_size(t->th_buf.devmajor,
+						    sizeof(t->th_buf.devmajor));
+	info->devminor = (unsigned long)oct_to_size(t->th_buf.devminor,
+						    sizeof(t->th_buf.devminor));
+	info->crc = (int)oct_to_size(t->th_buf.chksum, sizeof(t->th_buf.chksum));
+
+	info->valid = 1;
+	return info;
+}
+
+
+uid_t
+th_get_uid(TAR *t)
+{
+	unsigned long uid;
 
-	return mode;
+	if (tar_owner_id(t, TAR_OWNER_USER,
+			 ((t->th_buf.pax.flags & TAR_PAX_UNAME)
+			  ? t->th_buf.pax.uname : t->th_buf.uname), &uid) == 0)
+		return (uid_t)uid;
+
+	/* if the password entry doesn't exist */
+	return (uid_t)th_info(t)->uid;
 }
 
 
+gid_t
+th_get_gid(TAR *t)
+{
+	unsigned long gid;
+
+	if (tar_owner_id(t, TAR_OWNER_GROUP,
+			 ((t->th_buf.pax.flags & TAR_PAX_GNAME)
+			  ? t->th_buf.pax.gname : t->th_buf.gname), &gid) == 0)
+		return (gid_t)gid;
+
+	/* if the group entry doesn't exist */
+	return (gid_t)th_info(t)->gid;
+}
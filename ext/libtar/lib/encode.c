@@ -17,8 +17,6 @@
 #include <internal.h>
 
 #include <stdio.h>
-#include <pwd.h>
-#include <grp.h>
 #include <sys/types.h>
 
 #ifdef STDC_HEADERS
@@ -27,11 +25,16 @@
 #endif
 
 
+/* largest values the ustar numeric fields can hold in octal */
+#define OCT_MAX_12	077777777777LL
+#define OCT_MAX_8	07777777UL
+
+
 /* magic, version, and checksum */
 void
 th_finish(TAR *t)
 {
-	int i, sum = 0;
+	t->th_buf.info.valid = 0;
 
 	if (t->options & TAR_GNU)
 		strncpy(t->th_buf.magic, "ustar  ", 8);
@@ -41,13 +44,7 @@ th_finish(TAR *t)
 		strncpy(t->th_buf.magic, TMAGIC, TMAGLEN);
 	}
 
-	for (i = 0; i < T_BLOCKSIZE; i++) {
-		sum += ((unsigned char *)(&(t->th_buf)))[i];
-	}
-	for (i = 0; i < 8; i++)
-		sum += (' ' - t->th_buf.chksum[i]);
-	snprintf(t->th_buf.chksum, 8, "%06lo", (unsigned long)(sum));
-	t->th_buf.chksum[6] = 0;
+	size_to_oct(th_crc_calc(t), t->th_buf.chksum, 7);
 	t->th_buf.chksum[7] = ' ';
 }
 
@@ -56,6 +53,8 @@ th_finish(TAR *t)
 void
 th_set_type(TAR *t, mode_t mode)
 {
+	t->th_buf.info.valid = 0;
+
 	if (S_ISLNK(mode))
 		t->th_buf.typeflag = SYMTYPE;
 	if (S_ISREG(mode))
@@ -84,16 +83,19 @@ th_set_path(TAR *t, char *pathname)
 	printf("in th_set_path(th, pathname=\"%s\")\n", pathname);
 #endif
 
+	/* TH_ISDIR() decodes the header, so the path is changed after it */
+	if (pathname[strlen(pathname) - 1] != '/' && TH_ISDIR(t))
+		strcpy(suffix, "/");
+	t->th_buf.info.valid = 0;
+
 	if (t->th_buf.gnu_longname != NULL)
 		free(t->th_buf.gnu_longname);
 	t->th_buf.gnu_longname = NULL;
 
-	if (pathname[strlen(pathname) - 1] != '/' && TH_ISDIR(t))
-		strcpy(suffix, "/");
-
-	if (strlen(pathname) >= T_NAMELEN && (t->options & TAR_GNU))
+	if (strlen(pathname) >= T_NAMELEN
+	    && (t->options & (TAR_GNU | TAR_PAX)))
 	{
-		/* GNU-style long name */
+		/* GNU-style long name or pax path record */
 		t->th_buf.gnu_longname = strdup(pathname);
 		strncpy(t->th_buf.name, t->th_buf.gnu_longname, T_NAMELEN);
 	}
@@ -125,14 +127,17 @@ th_set_path(TAR *t, char *pathname)
 void
 th_set_link(TAR *t, char *linkname)
 {
+	t->th_buf.info.valid = 0;
+
 #ifndef _WIN32
 #ifdef DEBUG
 	printf("==> th_set_link(th, linkname=\"%s\")\n", linkname);
 #endif
 
-	if (strlen(linkname) > T_NAMELEN && (t->options & TAR_GNU))
+	if (strlen(linkname) >= T_NAMELEN
+	    && (t->options & (TAR_GNU | TAR_PAX)))
 	{
-		/* GNU longlink format */
+		/* GNU longlink format or pax linkpath record */
 		t->th_buf.gnu_longlink = strdup(linkname);
 		strcpy(t->th_buf.linkname, "././@LongLink");
 	}
@@ -153,6 +158,8 @@ th_set_link(TAR *t, char *linkname)
 void
 th_set_device(TAR *t, dev_t device)
 {
+	t->th_buf.info.valid = 0;
+
 #ifndef _WIN32
 #ifdef DEBUG
 	printf("th_set_device(): major = %d, minor = %d\n",
@@ -168,15 +175,20 @@ th_set_device(TAR *t, dev_t device)
 void
 th_set_user(TAR *t, uid_t uid)
 {
-#ifndef _WIN32
-	struct passwd *pw;
+	const char *name;
 
-	pw = getpwuid(uid);
-	if (pw != NULL)
-		strlcpy(t->th_buf.uname, pw->pw_name, sizeof(t->th_buf.uname));
-#endif
+	name = tar_owner_name(t, TAR_OWNER_USER, uid);
+	if (name != NULL)
+		strlcpy(t->th_buf.uname, name, sizeof(t->th_buf.uname));
 
-	int_to_oct(uid, t->th_buf.uid, 8);
+	t->th_buf.info.valid = 0;
+	t->th_buf.pax.flags &= ~TAR_PAX_UID;
+	if ((t->options & TAR_PAX) && (unsigned long)uid > OCT_MAX_8)
+	{
+		t->th_buf.pax.flags |= TAR_PAX_UID;
+		t->th_buf.pax.uid = uid;
+	}
+	size_to_oct(uid, t->th_buf.uid, 8);
 }
 
 
@@ -184,15 +196,20 @@ th_set_user(TAR *t, uid_t uid)
 void
 th_set_group(TAR *t, gid_t gid)
 {
-#ifndef _WIN32
-	struct group *gr;
+	const char *name;
 
-	gr = getgrgid(gid);
-	if (gr != NULL)
-		strlcpy(t->th_buf.gname, gr->gr_name, sizeof(t->th_buf.gname));
-#endif
+	name = tar_owner_name(t, TAR_OWNER_GROUP, gid);
+	if (name != NULL)
+		strlcpy(t->th_buf.gname, name, sizeof(t->th_buf.gname));
 
-	int_to_oct(gid, t->th_buf.gid, 8);
+	t->th_buf.info.valid = 0;
+	t->th_buf.pax.flags &= ~TAR_PAX_GID;
+	if ((t->options & TAR_PAX) && (unsigned long)gid > OCT_MAX_8)
+	{
+		t->th_buf.pax.flags |= TAR_PAX_GID;
+		t->th_buf.pax.gid = gid;
+	}
+	size_to_oct(gid, t->th_buf.gid, 8);
 }
 
 
@@ -200,6 +217,8 @@ th_set_group(TAR *t, gid_t gid)
 void
 th_set_mode(TAR *t, mode_t fmode)
 {
+	t->th_buf.info.valid = 0;
+
 #ifndef _WIN32
 	if (S_ISSOCK(fmode))
 	{
@@ -211,6 +230,37 @@ th_set_mode(TAR *t, mode_t fmode)
 }
 
 
+/* encode modification time */
+void
+th_set_mtime(TAR *t, time_t fmtime)
+{
+	t->th_buf.info.valid = 0;
+	t->th_buf.pax.flags &= ~TAR_PAX_MTIME;
+	if ((t->options & TAR_PAX) && (fmtime < 0 || fmtime > OCT_MAX_12))
+	{
+		t->th_buf.pax.flags |= TAR_PAX_MTIME;
+		t->th_buf.pax.mtime = fmtime;
+		t->th_buf.pax.mtime_nsec = 0;
+	}
+	size_to_oct(fmtime, t->th_buf.mtime, sizeof(t->th_buf.mtime));
+}
+
+
+/* encode file size */
+void
+th_set_size(TAR *t, tar_off_t fsize)
+{
+	t->th_buf.info.valid = 0;
+	t->th_buf.pax.flags &= ~TAR_PAX_SIZE;
+	if ((t->options & TAR_PAX) && fsize > OCT_MAX_12)
+	{
+		t->th_buf.pax.flags |= TAR_PAX_SIZE;
+		t->th_buf.pax.size = fsize;
+	}
+	size_to_oct(fsize, t->th_buf.size, sizeof(t->th_buf.size));
+}
+
+
 void
 th_set_from_stat(TAR *t, struct stat *s)
 {
@@ -221,6 +271,13 @@ th_set_from_stat(TAR *t, struct stat *s)
 	th_set_group(t, s->st_gid);
 	th_set_mode(t, s->st_mode);
 	th_set_mtime(t, s->st_mtime);
+	if ((t->options & TAR_PAX) && STAT_MTIME_NSEC(s) != 0)
+	{
+		/* keep sub-second timestamps in a pax mtime record */
+		t->th_buf.pax.flags |= TAR_PAX_MTIME;
+		t->th_buf.pax.mtime = s->st_mtime;
+		t->th_buf.pax.mtime_nsec = STAT_MTIME_NSEC(s);
+	}
 	if (S_ISREG(s->st_mode))
 		th_set_size(t, s->st_size);
 	else
@@ -228,3 +285,83 @@ th_set_from_stat(TAR *t, struct stat *s)
 }
 
 
+
+/*
+** encode the current header of src in t, for tar_append_member().  the
+** fields are encoded again with the options of t, so a member can go
+** from one archive format to another; the owner names are kept as they
+** are rather than looked up.  a sparse member becomes a regular file of
+** its expanded size.
+*/
+void
+th_copy(TAR *t, TAR *src)
+{
+	struct tar_info *info;
+	int options;
+	size_t n;
+
+	info = th_info(src);
+
+	if (t->th_buf.gnu_longname != NULL)
+		free(t->th_buf.gnu_longname);
+	if (t->th_buf.gnu_longlink != NULL)
+		free(t->th_buf.gnu_longlink);
+	if (t->th_buf.gnu_dumpdir != NULL)
+		free(t->th_buf.gnu_dumpdir);
+	memset(&(t->th_buf), 0, sizeof(struct tar_header));
+
+	t->th_buf.typeflag = (src->th_buf.typeflag == GNU_SPARSE_TYPE
+			      ? REGTYPE : src->th_buf.typeflag);
+	th_set_mode(t, info->mode);
+	memcpy(t->th_buf.devmajor, src->th_buf.devmajor,
+	       sizeof(t->th_buf.devmajor));
+	memcpy(t->th_buf.devminor, src->th_buf.devminor,
+	       sizeof(t->th_buf.devminor));
+
+	if (src->th_buf.pax.flags & TAR_PAX_UNAME)
+		strlcpy(t->th_buf.uname, src->th_buf.pax.uname,
+			sizeof(t->th_buf.uname));
+	else
+		memcpy(t->th_buf.uname, src->th_buf.uname,
+		       sizeof(t->th_buf.uname));
+	if (src->th_buf.pax.flags & TAR_PAX_GNAME)
+		strlcpy(t->th_buf.gname, src->th_buf.pax.gname,
+			sizeof(t->th_buf.gname));
+	else
+		memcpy(t->th_buf.gname, src->th_buf.gname,
+		       sizeof(t->th_buf.gname));
+
+	/* the ids alone, without a lookup replacing the names */
+	options = t->options;
+	t->options |= TAR_NUMERIC_OWNER;
+	th_set_user(t, (uid_t)info->uid);
+	th_set_group(t, (gid_t)info->gid);
+	t->options = options;
+
+	th_set_mtime(t, info->mtime);
+	if ((t->options & TAR_PAX) && info->mtime_nsec != 0)
+	{
+		t->th_buf.pax.flags |= TAR_PAX_MTIME;
+		t->th_buf.pax.mtime = info->mtime;
+		t->th_buf.pax.mtime_nsec = info->mtime_nsec;
+	}
+
+	/* only regular files and dumpdirs have contents */
+	if (TH_ISREG(src) || TH_ISDUMPDIR(src))
+		th_set_size(t, info->size);
+	else
+		th_set_size(t, 0);
+
+	th_set_path(t, info->pathname);
+	if (info->linkname[0] != '\0')
+		th_set_link(t, info->linkname);
+
+	if (TH_ISDUMPDIR(src) && src->th_buf.gnu_dumpdir != NULL)
+	{
+		n = (info->size + T_BLOCKSIZE - 1) / T_BLOCKSIZE * T_BLOCKSIZE;
+		t->th_buf.gnu_dumpdir = (char *)malloc(n + 1);
+		if (t->th_buf.gnu_dumpdir != NULL)
+			memcpy(t->th_buf.gnu_dumpdir, src->th_buf.gnu_dumpdir,
+			       n + 1);
+	}
+}
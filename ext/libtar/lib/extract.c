@@ -10,6 +10,11 @@
 **  University of Illinois at Urbana-Champaign
 */
 
+/* for fallocate(), sync_file_range() and syncfs() */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include <internal.h>
 
 #include <stdio.h>
@@ -29,6 +34,16 @@
 #endif
 
 
+/* the smallest run of zeros worth leaving as a hole */
+#define HOLE_SIZE		4096
+
+/* contents are extracted in chunks of this size, at offsets aligned to it */
+#define EXTRACT_BUFSIZE		(1024 * 1024)
+
+/* with TAR_NOCACHE, how much is written back at a time */
+#define WRITEBACK_SIZE		(8 * 1024 * 1024)
+
+
 struct linkname
 {
 	char ln_save[MAXPATHLEN];
@@ -36,21 +51,77 @@ struct linkname
 };
 typedef struct linkname linkname_t;
 
-
-static int
-tar_set_file_perms(TAR *t, char *realname)
+/* the attributes tar_set_file_perms() gives a file */
+struct file_perms
 {
 	mode_t mode;
 	uid_t uid;
 	gid_t gid;
+	time_t mtime;
+	long mtime_nsec;
+	int symlink;
+};
+
+/* a small regular file waiting in t->extract_queue */
+struct queued_file
+{
+	char *realname;
+	char *savename;
+	struct file_perms perms;
+	size_t off;			/* of its contents in the buffer */
+	size_t size;
+};
+
+struct extract_queue
+{
+	struct queued_file files[URING_BATCH];
+	size_t count;
+	char *buf;			/* URING_BATCH_BYTES of contents */
+	size_t used;
+};
+
+/* how much of an extracted file has been written, and written back */
+struct writeback
+{
+	off_t pos;		/* bytes written */
+	off_t started;		/* bytes whose writeback has been started */
+	off_t dropped;		/* bytes dropped from the page cache */
+};
+
+static ssize_t tar_read_raw(TAR *t, char *ptr, size_t len);
+
+
+/* the attributes of the current header, for set_perms() */
+static void
+perms_from_header(TAR *t, struct file_perms *p)
+{
+	p->mode = th_get_mode(t);
+	p->uid = th_get_uid(t);
+	p->gid = th_get_gid(t);
+	p->mtime = th_get_mtime(t);
+	p->mtime_nsec = th_get_mtime_nsec(t);
+	p->symlink = TH_ISSYM(t);
+}
+
+
+/* give filename the attributes in p */
+static int
+set_perms(TAR *t, char *filename, struct file_perms *p)
+{
+	mode_t mode = p->mode;
+	uid_t uid = p->uid;
+	gid_t gid = p->gid;
+#ifdef UTIME_OMIT
+	struct timespec ts[2];
+
+	/* keep the sub-second part of pax mtimes */
+	ts[0].tv_sec = ts[1].tv_sec = p->mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = p->mtime_nsec;
+#else
 	struct utimbuf ut;
-	char *filename;
 
-	filename = (realname ? realname : th_get_pathname(t));
-	mode = th_get_mode(t);
-	uid = th_get_uid(t);
-	gid = th_get_gid(t);
-	ut.modtime = ut.actime = th_get_mtime(t);
+	ut.modtime = ut.actime = p->mtime;
+#endif
 
 #ifndef _WIN32
 	/* change owner/group */
@@ -63,39 +134,258 @@ tar_set_file_perms(TAR *t, char *realname)
 				filename, uid, gid, strerror(errno));
 # endif
 #else /* ! HAVE_LCHOWN */
-		if (!TH_ISSYM(t) && chown(filename, uid, gid) == -1)
+		if (!p->symlink && chown(filename, uid, gid) == -1)
 		{
 # ifdef DEBUG
 			fprintf(stderr, "chown(\"%s\", %d, %d): %s\n",
 				filename, uid, gid, strerror(errno));
 # endif
 #endif /* HAVE_LCHOWN */
-			if (!realname) free (filename);
-			return -1;
+			return tar_fail(t);
 		}
 
 	/* change access/modification time */
-	if (!TH_ISSYM(t) && utime(filename, &ut) == -1)
+#ifdef UTIME_OMIT
+	if (!p->symlink && utimensat(AT_FDCWD, filename, ts, 0) == -1)
+#else
+	if (!p->symlink && utime(filename, &ut) == -1)
+#endif
 	{
 #ifdef DEBUG
 		perror("utime()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
 	/* change permissions */
-	if (!TH_ISSYM(t) && chmod(filename, mode) == -1)
+	if (!p->symlink && chmod(filename, mode) == -1)
 	{
 #ifdef DEBUG
 		perror("chmod()");
 #endif
-		if (!realname) free(filename);
+		return tar_fail(t);
+	}
+#endif
+
+	return 0;
+}
+
+
+static int
+tar_set_file_perms(TAR *t, char *realname)
+{
+	struct file_perms p;
+
+	perms_from_header(t, &p);
+	return set_perms(t, (realname ? realname : th_get_pathname(t)), &p);
+}
+
+
+/*
+** choose what tar_extract_file() does to make the files it extracts
+** durable:
+**	TAR_DURABLE_NONE	nothing (the default)
+**	TAR_DURABLE_BATCH	start the writeback of each regular file once
+**				it has been written; tar_extract_sync() then
+**				waits for it with syncfs()
+**	TAR_DURABLE_PER_FILE	fsync() each regular file once its attributes
+**				are set, then the directory of each member
+**	TAR_DURABLE_ATOMIC	extract each regular file under a temporary
+**				name, fsync() it and rename it into place;
+**				tar_extract_sync() syncs the renames
+*/
+int
+tar_set_durability(TAR *t, int durability)
+{
+	if (durability < TAR_DURABLE_NONE || durability > TAR_DURABLE_ATOMIC)
+	{
+		errno = EINVAL;
+		return tar_fail(t);
+	}
+#ifdef _WIN32
+	if (durability != TAR_DURABLE_NONE)
+	{
+		errno = ENOSYS;
+		return tar_fail(t);
+	}
+#endif
+
+	t->durability = durability;
+	return 0;
+}
+
+
+#ifndef _WIN32
+
+/* commit the file system fd is on */
+static int
+sync_fs(int fd)
+{
+#ifdef __linux__
+	return syncfs(fd);
+#else
+	sync();
+	return 0;
+#endif
+}
+
+
+/* fsync() the file at filename */
+static int
+fsync_path(char *filename)
+{
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (fsync(fd) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+
+/*
+** make t->sync_fd the directory filename is in, keeping it open for as
+** long as members are extracted there.  when it moves to another file
+** system, the one left behind is synced first if tar_extract_sync() is
+** to be relied on.
+*/
+static int
+sync_dir_open(TAR *t, char *filename)
+{
+	struct stat olds, news;
+	char *dir, *p;
+	int fd;
+
+	if ((dir = strdup(filename)) == NULL)
+		return -1;
+	for (p = dir + strlen(dir); p > dir + 1 && p[-1] == '/'; p--)
+		p[-1] = '\0';
+	if ((p = strrchr(dir, '/')) == NULL)
+	{
+		free(dir);
+		if ((dir = strdup(".")) == NULL)
+			return -1;
+	}
+	else
+		p[p == dir ? 1 : 0] = '\0';
+
+	if (t->sync_dir != NULL && strcmp(t->sync_dir, dir) == 0)
+	{
+		free(dir);
+		return 0;
+	}
+
+	fd = open(dir, O_RDONLY);
+	if (fd == -1)
+	{
+		free(dir);
+		return -1;
+	}
+	if (t->sync_fd != -1)
+	{
+		if (t->durability != TAR_DURABLE_PER_FILE
+		    && fstat(t->sync_fd, &olds) == 0
+		    && fstat(fd, &news) == 0
+		    && olds.st_dev != news.st_dev
+		    && sync_fs(t->sync_fd) != 0)
+		{
+			close(fd);
+			free(dir);
+			return -1;
+		}
+		close(t->sync_fd);
+		free(t->sync_dir);
+	}
+	t->sync_fd = fd;
+	t->sync_dir = dir;
+
+	return 0;
+}
+
+
+/*
+** extract a regular file under a temporary name next to realname, set
+** its attributes and fsync() it, then rename it over realname.  so
+** realname is never seen partly written, even after a crash.
+*/
+static int
+tar_extract_atomic(TAR *t, char *realname)
+{
+	char tmp[MAXPATHLEN];
+	char *base;
+	int fd;
+
+	if (mkdirhier_parent(realname) == -1)
+		return tar_fail(t);
+
+	base = strrchr(realname, '/');
+	if (base != NULL)
+		snprintf(tmp, sizeof(tmp), "%.*s/.%s.XXXXXX",
+			 (int)(base - realname), realname, base + 1);
+	else
+		snprintf(tmp, sizeof(tmp), ".%s.XXXXXX", realname);
+	if ((fd = mkstemp(tmp)) == -1)
+		return tar_fail(t);
+	close(fd);
+
+	if (tar_extract_regfile(t, tmp) != 0
+	    || tar_set_file_perms(t, tmp) != 0
+	    || fsync_path(tmp) != 0
+	    || rename(tmp, realname) != 0)
+	{
+		tar_fail(t);
+		unlink(tmp);
+		errno = t->errnum;
 		return -1;
 	}
+
+	return 0;
+}
+
+
+/* what t->durability asks for once a member has been extracted */
+static int
+tar_extract_durable(TAR *t, char *realname, int regfile)
+{
+	if (sync_dir_open(t, realname) != 0)
+		return tar_fail(t);
+
+	if (t->durability == TAR_DURABLE_PER_FILE
+	    && ((regfile && fsync_path(realname) != 0)
+		|| fsync(t->sync_fd) != 0))
+		return tar_fail(t);
+
+	return 0;
+}
+
+#endif /* ! _WIN32 */
+
+
+/*
+** with TAR_DURABLE_BATCH or TAR_DURABLE_ATOMIC, wait until what has
+** been extracted is on disk.  the wrappers in wrapper.c call this once
+** they are done; callers of tar_extract_file() call it themselves.  it
+** first writes out the files tar_extract_queued() has held back.
+*/
+int
+tar_extract_sync(TAR *t)
+{
+	if (tar_extract_flush(t) != 0)
+		return -1;
+
+#ifndef _WIN32
+	if ((t->durability == TAR_DURABLE_BATCH
+	     || t->durability == TAR_DURABLE_ATOMIC)
+	    && t->sync_fd != -1 && sync_fs(t->sync_fd) != 0)
+		return tar_fail(t);
 #endif
 
-	if (!realname) free(filename);
 	return 0;
 }
 
@@ -104,9 +394,8 @@ tar_set_file_perms(TAR *t, char *realname)
 int
 tar_extract_file(TAR *t, char *realname)
 {
-	int i;
+	int i, regfile = 0;
 	linkname_t *lnp;
-	char *filename;
 
 	if (t->options & TAR_NOOVERWRITE)
 	{
@@ -115,7 +404,7 @@ tar_extract_file(TAR *t, char *realname)
 		if (lstat(realname, &s) == 0 || errno != ENOENT)
 		{
 			errno = EEXIST;
-			return -1;
+			return tar_fail(t);
 		}
 	}
 
@@ -141,48 +430,454 @@ tar_extract_file(TAR *t, char *realname)
 #endif
 	else if (TH_ISFIFO(t))
 		i = tar_extract_fifo(t, realname);
+#ifndef _WIN32
+	else if (t->durability == TAR_DURABLE_ATOMIC)
+	{
+		/* this sets the attributes of the file itself */
+		i = tar_extract_atomic(t, realname);
+		regfile = 2;
+	}
+#endif
 	else /* if (TH_ISREG(t)) */
+	{
 		i = tar_extract_regfile(t, realname);
+		regfile = 1;
+	}
 
 	if (i != 0)
 		return i;
 
-	i = tar_set_file_perms(t, realname);
-	if (i != 0)
-		return i;
+	if (regfile != 2)
+	{
+		i = tar_set_file_perms(t, realname);
+		if (i != 0)
+			return i;
+	}
+
+#ifndef _WIN32
+	if (t->durability != TAR_DURABLE_NONE
+	    && tar_extract_durable(t, realname, regfile == 1) != 0)
+		return -1;
+#endif
 
 	lnp = (linkname_t *)calloc(1, sizeof(linkname_t));
 	if (lnp == NULL)
-		return -1;
-	filename = th_get_pathname(t);
-	strlcpy(lnp->ln_save, filename, sizeof(lnp->ln_save));
-	free(filename);
+		return tar_fail(t);
+	strlcpy(lnp->ln_save, th_get_pathname(t), sizeof(lnp->ln_save));
 	strlcpy(lnp->ln_real, realname, sizeof(lnp->ln_real));
 #ifdef DEBUG
-	filename = th_get_pathname(t);
 	printf("tar_extract_file(): calling libtar_hash_add(): key=\"%s\", "
-	       "value=\"%s\"\n", filename, realname);
-	free(filename);
+	       "value=\"%s\"\n", th_get_pathname(t), realname);
 #endif
 	if (libtar_hash_add(t->h, lnp) != 0)
+		return tar_fail(t);
+
+	return 0;
+}
+
+
+/* can the current member wait in t->extract_queue? */
+static int
+queueable(TAR *t, tar_off_t size)
+{
+	return ((t->options & TAR_IO_URING)
+		&& !(t->options & (TAR_NOOVERWRITE | TAR_SPARSE | TAR_NOCACHE))
+		&& t->durability == TAR_DURABLE_NONE
+		&& th_info(t)->type == TH_TYPE_REG
+		&& !TH_ISSPARSE(t)
+		&& size <= URING_MAX_FILE
+		&& tar_uring(t) != NULL);
+}
+
+
+/* empty the queue, freeing the names it holds */
+static void
+queue_clear(struct extract_queue *q)
+{
+	size_t i;
+
+	for (i = 0; i < q->count; i++)
+	{
+		free(q->files[i].realname);
+		free(q->files[i].savename);
+	}
+	q->count = 0;
+	q->used = 0;
+}
+
+
+void
+tar_extract_queue_free(TAR *t)
+{
+	if (t->extract_queue == NULL)
+		return;
+
+	queue_clear(t->extract_queue);
+	free(t->extract_queue->buf);
+	free(t->extract_queue);
+	t->extract_queue = NULL;
+}
+
+
+/*
+** extract the current member like tar_extract_file(), except that with
+** TAR_IO_URING a small regular file is only read into memory, to be
+** written along with others by tar_extract_flush().  any other member
+** flushes the queue first, so members still land in archive order.
+*/
+int
+tar_extract_queued(TAR *t, char *realname)
+{
+	struct extract_queue *q;
+	struct queued_file *f;
+	tar_off_t size = th_get_size(t);
+	size_t i, done;
+	ssize_t k;
+
+	if (!queueable(t, size))
+	{
+		if (tar_extract_flush(t) != 0)
+			return -1;
+		return tar_extract_file(t, realname);
+	}
+
+	if ((q = t->extract_queue) == NULL)
+	{
+		q = (struct extract_queue *)calloc(1, sizeof(*q));
+		if (q == NULL)
+			return tar_fail(t);
+		if ((q->buf = (char *)malloc(URING_BATCH_BYTES)) == NULL)
+		{
+			free(q);
+			return tar_fail(t);
+		}
+		t->extract_queue = q;
+	}
+
+	/* a name queued twice must be written in order */
+	for (i = 0; i < q->count; i++)
+		if (strcmp(q->files[i].realname, realname) == 0)
+			break;
+	if ((i < q->count || q->count == URING_BATCH
+	     || q->used + (size_t)size > URING_BATCH_BYTES)
+	    && tar_extract_flush(t) != 0)
 		return -1;
 
+	if (mkdirhier_parent(realname) == -1)
+		return tar_fail(t);
+
+	f = &(q->files[q->count]);
+	for (done = 0; done < (size_t)size; done += (size_t)k)
+	{
+		k = tar_read_data(t, q->buf + q->used + done,
+				  (size_t)size - done);
+		if (k <= 0)
+		{
+			if (k == 0)
+				errno = EINVAL;
+			return tar_fail(t);
+		}
+	}
+
+	f->realname = strdup(realname);
+	f->savename = strdup(th_get_pathname(t));
+	if (f->realname == NULL || f->savename == NULL)
+	{
+		free(f->realname);
+		free(f->savename);
+		return tar_fail(t);
+	}
+	perms_from_header(t, &(f->perms));
+	f->off = q->used;
+	f->size = (size_t)size;
+	q->used += (size_t)size;
+	q->count++;
+
+#ifdef DEBUG
+	printf("tar_extract_queued(): queued \"%s\" (%lu bytes)\n",
+	       realname, (unsigned long)size);
+#endif
 	return 0;
 }
 
 
+/* finish writing a file that io_uring left short */
+static int
+write_rest(char *filename, const char *buf, size_t len, off_t off)
+{
+	ssize_t k;
+	int fd;
+
+	fd = open(filename, O_WRONLY);
+	if (fd == -1)
+		return -1;
+	for (; len > 0; buf += k, len -= (size_t)k, off += k)
+	{
+		k = pwrite(fd, buf, len, off);
+		if (k == -1 && errno == EINTR)
+			k = 0;
+		else if (k == -1)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+
+	return close(fd);
+}
+
+
+/*
+** write out the files in t->extract_queue with one batch of io_uring
+** requests, then set their attributes and remember them for hard links
+** in the order they were queued.
+*/
+int
+tar_extract_flush(TAR *t)
+{
+	struct extract_queue *q = t->extract_queue;
+	struct queued_file *f;
+	linkname_t *lnp;
+	size_t i;
+	int res;
+
+	if (q == NULL || q->count == 0)
+		return 0;
+
+#ifdef DEBUG
+	printf("tar_extract_flush(): writing %lu files\n",
+	       (unsigned long)q->count);
+#endif
+	for (i = 0; i < q->count; i++)
+		if (tar_uring_write_file(t->uring, q->files[i].realname,
+					 q->buf + q->files[i].off,
+					 q->files[i].size) == -1)
+			goto fail;
+	if (tar_uring_run(t->uring) != 0)
+		goto fail;
+
+	for (i = 0; i < q->count; i++)
+	{
+		f = &(q->files[i]);
+		res = tar_uring_result(t->uring, (int)i);
+		if (res < 0)
+		{
+			errno = -res;
+			goto fail;
+		}
+		if ((size_t)res < f->size
+		    && write_rest(f->realname, q->buf + f->off + res,
+				  f->size - (size_t)res, (off_t)res) != 0)
+			goto fail;
+		if (set_perms(t, f->realname, &(f->perms)) != 0)
+			goto fail;
+
+		lnp = (linkname_t *)calloc(1, sizeof(linkname_t));
+		if (lnp == NULL)
+			goto fail;
+		strlcpy(lnp->ln_save, f->savename, sizeof(lnp->ln_save));
+		strlcpy(lnp->ln_real, f->realname, sizeof(lnp->ln_real));
+		if (libtar_hash_add(t->h, lnp) != 0)
+		{
+			free(lnp);
+			goto fail;
+		}
+	}
+
+	queue_clear(q);
+	return 0;
+
+  fail:
+	tar_fail(t);
+	queue_clear(q);
+	errno = t->errnum;
+	return -1;
+}
+
+
+/* does buf hold nothing but zeros? */
+static int
+is_zero(const char *buf, size_t len)
+{
+	return (len == 0 || (buf[0] == '\0'
+			     && memcmp(buf, buf + 1, len - 1) == 0));
+}
+
+
+/*
+** write len bytes to fd.  with holes set, runs of HOLE_SIZE zeros are
+** seeked over instead, and *seeked is set.
+*/
+static int
+write_out(int fd, const char *buf, size_t len, int holes, int *seeked)
+{
+	size_t off, n, start;
+	ssize_t k;
+
+	for (off = 0; off < len; )
+	{
+		/* find the next hole-sized run of zeros, if holes are wanted */
+		for (start = off; holes && off < len; off += n)
+		{
+			n = (len - off < HOLE_SIZE ? len - off : HOLE_SIZE);
+			if (n == HOLE_SIZE && is_zero(buf + off, n))
+				break;
+		}
+		if (!holes)
+			off = len;
+
+		for (; start < off; start += k)
+		{
+			k = write(fd, buf + start, off - start);
+			if (k == -1)
+				return -1;
+		}
+
+		for (; off < len && len - off >= HOLE_SIZE
+		     && is_zero(buf + off, HOLE_SIZE); off += HOLE_SIZE)
+		{
+			if (lseek(fd, HOLE_SIZE, SEEK_CUR) == -1)
+				return -1;
+			*seeked = 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* the contents buffer of t, allocated on first use */
+static char *
+extract_buf(TAR *t)
+{
+	void *p;
+	int i;
+
+	if (t->extract_buf != NULL)
+		return t->extract_buf;
+
+#ifndef _WIN32
+	/* page-aligned, so each write covers whole pages */
+	if ((i = posix_memalign(&p, 4096, EXTRACT_BUFSIZE)) != 0)
+	{
+		errno = i;
+		return NULL;
+	}
+#else
+	if ((p = malloc(EXTRACT_BUFSIZE)) == NULL)
+		return NULL;
+#endif
+	t->extract_buf = (char *)p;
+
+	return t->extract_buf;
+}
+
+
+/*
+** reserve size bytes for fd before writing them, so the file system
+** can lay the file out in one piece.  the file size is left alone, and
+** a file system that can't do this is not an error.
+*/
+static int
+preallocate(int fd, tar_off_t size)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == -1
+	    && errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL)
+		return -1;
+#endif
+
+	return 0;
+}
+
+
+/*
+** with TAR_NOCACHE: once a window has been written (or at the end, with
+** force set), start writing it back, then wait for the window before it
+** and drop that from the page cache.  so no more than two windows of
+** dirty or cached data are left behind by each file.  TAR_DURABLE_BATCH
+** forces it at the end of each file, which (without TAR_NOCACHE) only
+** starts the writeback of the whole file.
+*/
+static int
+write_behind(int fd, struct writeback *wb, int force)
+{
+	if (!force && wb->pos - wb->started < WRITEBACK_SIZE)
+		return 0;
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	if (wb->pos > wb->started
+	    && sync_file_range(fd, wb->started, wb->pos - wb->started,
+			       SYNC_FILE_RANGE_WRITE) == -1)
+		return -1;
+	if (wb->started > wb->dropped
+	    && sync_file_range(fd, wb->dropped, wb->started - wb->dropped,
+			       SYNC_FILE_RANGE_WAIT_BEFORE
+			       | SYNC_FILE_RANGE_WRITE
+			       | SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+		return -1;
+#endif
+#ifdef POSIX_FADV_DONTNEED
+	if (wb->started > wb->dropped)
+		posix_fadvise(fd, wb->dropped, wb->started - wb->dropped,
+			      POSIX_FADV_DONTNEED);
+#endif
+	wb->dropped = wb->started;
+	wb->started = wb->pos;
+
+	return 0;
+}
+
+
+/* write out the regions of a sparse member, seeking over its holes */
+static int
+tar_extract_sparse(TAR *t, int fdout, char *buf, size_t bufsize)
+{
+	struct tar_sparse *sp;
+	tar_off_t left;
+	ssize_t k;
+	int seeked = 0;
+
+	for (; t->sparse_idx < t->sparse_count; t->sparse_idx++)
+	{
+		sp = &(t->sparse_map[t->sparse_idx]);
+		if (sp->numbytes == 0)
+			continue;
+		if (lseek(fdout, (off_t)sp->offset, SEEK_SET) == -1)
+			return -1;
+		for (left = sp->numbytes; left > 0; left -= k)
+		{
+			k = tar_read_raw(t, buf, (left < (tar_off_t)bufsize
+						  ? (size_t)left : bufsize));
+			if (k == -1)
+				return -1;
+			if (k == 0)
+			{
+				errno = EINVAL;
+				return -1;
+			}
+			if (write_out(fdout, buf, (size_t)k, 0, &seeked) != 0)
+				return -1;
+		}
+	}
+	t->sparse_pos = t->sparse_size;
+
+	/* the file ends with a hole if the last region stops short */
+	return ftruncate(fdout, (off_t)t->sparse_size);
+}
+
+
 /* extract regular file */
 int
 tar_extract_regfile(TAR *t, char *realname)
 {
-	mode_t mode;
-	size_t size;
-	uid_t uid;
-	gid_t gid;
+	tar_off_t size;
 	int fdout;
-	int i, k;
-	char buf[T_BLOCKSIZE];
+	ssize_t k;
+	char *buf;
 	char *filename;
+	int holes, seeked = 0;
+	struct writeback wb = { 0, 0, 0 };
 
 #ifdef DEBUG
 	printf("==> tar_extract_regfile(t=0x%lx, realname=\"%s\")\n", t,
@@ -192,26 +887,21 @@ tar_extract_regfile(TAR *t, char *realname)
 	if (!TH_ISREG(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
-	mode = th_get_mode(t);
 	size = th_get_size(t);
-	uid = th_get_uid(t);
-	gid = th_get_gid(t);
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1)
-		return -1;
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
+	if ((buf = extract_buf(t)) == NULL)
+		return tar_fail(t);
 
 #ifdef DEBUG
-	printf("  ==> extracting: %s (mode %04o, uid %d, gid %d, %d bytes)\n",
-	       filename, mode, uid, gid, size);
+	printf("  ==> extracting: %s (mode %04o, uid %d, gid %d, %lld bytes)\n",
+	       filename, th_get_mode(t), th_get_uid(t), th_get_gid(t),
+	       (long long)size);
 #endif
 	fdout = open(filename, O_WRONLY | O_CREAT | O_TRUNC
 #ifdef O_BINARY
@@ -223,116 +913,272 @@ tar_extract_regfile(TAR *t, char *realname)
 #ifdef DEBUG
 		perror("open()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
-#if 0
-	/* change the owner.  (will only work if run as root) */
-	if (fchown(fdout, uid, gid) == -1 && errno != EPERM)
-	{
-#ifdef DEBUG
-		perror("fchown()");
-#endif
-		return -1;
-	}
+	/* the owner and mode are set by tar_set_file_perms() afterwards */
 
-	/* make sure the mode isn't inheritted from a file we're overwriting */
-	if (fchmod(fdout, mode & 07777) == -1)
+	/* extract the file, EXTRACT_BUFSIZE bytes at a time */
+	if (TH_ISSPARSE(t))
+		k = tar_extract_sparse(t, fdout, buf, EXTRACT_BUFSIZE);
+	else
 	{
-#ifdef DEBUG
-		perror("fchmod()");
-#endif
-		return -1;
-	}
-#endif
+		/* with TAR_SPARSE, blocks of zeros become holes */
+		holes = (t->options & TAR_SPARSE);
 
-	/* extract the file */
-	for (i = size; i > 0; i -= T_BLOCKSIZE)
-	{
-		k = tar_block_read(t, buf);
-		if (k != T_BLOCKSIZE)
-		{
-			if (k != -1)
-				errno = EINVAL;
-			if (!realname) free(filename);
-			return -1;
-		}
+		/* a file that takes more than one write is preallocated */
+		k = 0;
+		if (!holes && size > EXTRACT_BUFSIZE)
+			k = preallocate(fdout, size);
 
-		/* write block to output file */
-		if (write(fdout, buf,
-			  ((i > T_BLOCKSIZE) ? T_BLOCKSIZE : i)) == -1){
-			if (!realname) free(filename);
-			return -1;
+		while (k == 0
+		       && (k = tar_read_data(t, buf, EXTRACT_BUFSIZE)) > 0)
+		{
+			if (write_out(fdout, buf, (size_t)k, holes,
+				      &seeked) != 0)
+				break;
+			wb.pos += k;
+			if ((t->options & TAR_NOCACHE)
+			    && write_behind(fdout, &wb, 0) != 0)
+				break;
+			k = 0;
 		}
+		if (k == 0 && seeked)
+			k = ftruncate(fdout, (off_t)size);
 	}
-
-	/* close output file */
-	if (close(fdout) == -1){
-		if (!realname) free(filename);
+	if (k == 0 && ((t->options & TAR_NOCACHE)
+		       || t->durability == TAR_DURABLE_BATCH))
+	{
+		wb.pos = (off_t)size;
+		k = write_behind(fdout, &wb, 1);
+	}
+	if (k != 0)
+	{
+		tar_fail(t);
+		close(fdout);
+		errno = t->errnum;
 		return -1;
 	}
 
+	/* close output file */
+	if (close(fdout) == -1)
+		return tar_fail(t);
+
 #ifdef DEBUG
 	printf("### done extracting %s\n", filename);
 #endif
 
-	if (!realname) free(filename);
 	return 0;
 }
 
 int tar_extract_function(TAR *t, void *data, int (*f)(char *b, int l, void *d)) {
-  size_t size;
-  int i, k;
-  char buf[T_BLOCKSIZE];
+  ssize_t k;
+  char *buf;
 
   if (!TH_ISREG(t)) {
     return 1;
   }
 
-  size = th_get_size(t);
-
-  for (i = size; i > 0; i -= T_BLOCKSIZE) {
-    k = tar_block_read(t, buf);
-
-    if (k != T_BLOCKSIZE) {
-      if (k != -1) { errno = EINVAL; }
-      return -1;
-    }
+  if ((buf = extract_buf(t)) == NULL) {
+    return tar_fail(t);
+  }
 
-    if (f(buf, ((i > T_BLOCKSIZE) ? T_BLOCKSIZE : i), data) == -1) {
-      return -1;
+  while ((k = tar_read_data(t, buf, EXTRACT_BUFSIZE)) > 0) {
+    if (f(buf, (int) k, data) == -1) {
+      return tar_fail(t);
     }
   }
 
-  return 0;
+  return (k == 0) ? 0 : -1;
+}
+
+
+/* read len bytes from the archive, continuing after short reads */
+ssize_t
+tar_read_full(TAR *t, char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len)
+	{
+		n = (*(t->type->readfunc))(t->fd, buf + done, len - done);
+		if (n == -1)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
+
+/*
+** read up to len bytes of the contents stored in the archive for the
+** current regfile.  whole blocks are read straight into ptr; a block
+** that is only partly returned is kept in t->data_buf.
+*/
+static ssize_t
+tar_read_raw(TAR *t, char *ptr, size_t len)
+{
+	size_t done = 0, n;
+	ssize_t k;
+
+	while (done < len)
+	{
+		if (t->data_bufoff < t->data_buflen)
+		{
+			n = t->data_buflen - t->data_bufoff;
+			if (n > len - done)
+				n = len - done;
+			memcpy(ptr + done, t->data_buf + t->data_bufoff, n);
+			t->data_bufoff += n;
+			done += n;
+			continue;
+		}
+
+		if (t->data_left <= 0)
+			break;
+
+		if (len - done >= T_BLOCKSIZE && t->data_left >= T_BLOCKSIZE)
+		{
+			n = (len - done) / T_BLOCKSIZE * T_BLOCKSIZE;
+			if ((tar_off_t)n > t->data_left)
+				n = (size_t)(t->data_left / T_BLOCKSIZE)
+				    * T_BLOCKSIZE;
+			k = tar_read_full(t, ptr + done, n);
+			if (k != (ssize_t)n)
+			{
+				if (k != -1)
+					errno = EINVAL;
+				return tar_fail(t);
+			}
+			t->data_left -= n;
+			done += n;
+			continue;
+		}
+
+		k = tar_read_full(t, t->data_buf, T_BLOCKSIZE);
+		if (k != T_BLOCKSIZE)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return tar_fail(t);
+		}
+		t->data_bufoff = 0;
+		t->data_buflen = (t->data_left < T_BLOCKSIZE
+				  ? (size_t)t->data_left : T_BLOCKSIZE);
+		t->data_left -= t->data_buflen;
+	}
+
+	return done;
+}
+
+
+/* expand the regions of a sparse member, with zeros for the holes */
+static ssize_t
+tar_read_sparse(TAR *t, char *ptr, size_t len)
+{
+	struct tar_sparse *sp;
+	tar_off_t end;
+	size_t done = 0, n;
+	ssize_t k;
+
+	while (done < len && t->sparse_pos < t->sparse_size)
+	{
+		/* move on to the region the position is in or before */
+		while (t->sparse_idx < t->sparse_count
+		       && t->sparse_pos >= t->sparse_map[t->sparse_idx].offset
+		       + t->sparse_map[t->sparse_idx].numbytes)
+			t->sparse_idx++;
+		sp = (t->sparse_idx < t->sparse_count
+		      ? &(t->sparse_map[t->sparse_idx]) : NULL);
+
+		if (sp == NULL || t->sparse_pos < sp->offset)
+		{
+			end = (sp != NULL && sp->offset < t->sparse_size
+			       ? sp->offset : t->sparse_size);
+			n = (end - t->sparse_pos < (tar_off_t)(len - done)
+			     ? (size_t)(end - t->sparse_pos) : len - done);
+			memset(ptr + done, 0, n);
+		}
+		else
+		{
+			end = sp->offset + sp->numbytes;
+			n = (end - t->sparse_pos < (tar_off_t)(len - done)
+			     ? (size_t)(end - t->sparse_pos) : len - done);
+			k = tar_read_raw(t, ptr + done, n);
+			if (k == -1)
+				return -1;
+			if (k == 0)
+			{
+				/* the map describes more than was stored */
+				errno = EINVAL;
+				return tar_fail(t);
+			}
+			n = k;
+		}
+		t->sparse_pos += n;
+		done += n;
+	}
+
+	return done;
+}
+
+
+/*
+** read up to len bytes of the contents of the current regfile, picking up
+** where the last call left off.  the holes of a sparse member read as
+** zeros.
+** returns:
+**	number of bytes read	success (0 at the end of the contents)
+**	-1 (and sets errno)	error
+*/
+ssize_t
+tar_read_data(TAR *t, void *buf, size_t len)
+{
+	if (TH_ISSPARSE(t))
+		return tar_read_sparse(t, (char *)buf, len);
+
+	return tar_read_raw(t, (char *)buf, len);
 }
 
 /* skip regfile */
 int
 tar_skip_regfile(TAR *t)
 {
-	int i, k;
-	size_t size;
+	int k;
 	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISREG(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
-	size = th_get_size(t);
-	for (i = size; i > 0; i -= T_BLOCKSIZE)
+	/* only the blocks tar_read_data() hasn't consumed yet */
+	t->data_bufoff = t->data_buflen = 0;
+	t->sparse_pos = t->sparse_size;
+
+	/* seek over them if the archive allows it (pipes don't) */
+	if (t->data_left > 0 && t->type->seekfunc != NULL
+	    && (*(t->type->seekfunc))(t->fd,
+			(t->data_left + T_BLOCKSIZE - 1) / T_BLOCKSIZE
+			* T_BLOCKSIZE, SEEK_CUR) != -1)
+		t->data_left = 0;
+
+	for (; t->data_left > 0; t->data_left -= T_BLOCKSIZE)
 	{
 		k = tar_block_read(t, buf);
 		if (k != T_BLOCKSIZE)
 		{
 			if (k != -1)
 				errno = EINVAL;
-			return -1;
+			return tar_fail(t);
 		}
 	}
+	t->data_left = 0;
 
 	return 0;
 }
@@ -347,25 +1193,17 @@ tar_extract_hardlink(TAR * t, char *realname)
 	char *linktgt = NULL;
 	linkname_t *lnp;
 	libtar_hashptr_t hp;
-	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISLNK(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
 	libtar_hashptr_reset(&hp);
 	if (libtar_hash_getkey(t->h, &hp, th_get_linkname(t),
 			       (libtar_matchfunc_t)libtar_str_match) != 0)
@@ -384,11 +1222,9 @@ tar_extract_hardlink(TAR * t, char *realname)
 #ifdef DEBUG
 		perror("link()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
-	if (!realname) free(filename);
 #endif
 	return 0;
 }
@@ -400,30 +1236,20 @@ tar_extract_symlink(TAR *t, char *realname)
 {
 #ifndef _WIN32
 	char *filename;
-	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISSYM(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
 
-	if (unlink(filename) == -1 && errno != ENOENT){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (unlink(filename) == -1 && errno != ENOENT)
+		return tar_fail(t);
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (symlink to %s)\n",
@@ -434,11 +1260,9 @@ tar_extract_symlink(TAR *t, char *realname)
 #ifdef DEBUG
 		perror("symlink()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
-	if (!realname) free(filename);
 #endif
 	return 0;
 }
@@ -451,12 +1275,11 @@ tar_extract_chardev(TAR *t, char *realname)
 	mode_t mode;
 	unsigned long devmaj, devmin;
 	char *filename;
-	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISCHR(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
@@ -464,15 +1287,8 @@ tar_extract_chardev(TAR *t, char *realname)
 	devmaj = th_get_devmajor(t);
 	devmin = th_get_devminor(t);
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (character device %ld,%ld)\n",
@@ -484,11 +1300,9 @@ tar_extract_chardev(TAR *t, char *realname)
 #ifdef DEBUG
 		perror("mknod()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
-	if (!realname) free(filename);
 	return 0;
 }
 
@@ -501,12 +1315,11 @@ tar_extract_blockdev(TAR *t, char *realname)
 	mode_t mode;
 	unsigned long devmaj, devmin;
 	char *filename;
-	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISBLK(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
@@ -514,15 +1327,8 @@ tar_extract_blockdev(TAR *t, char *realname)
 	devmaj = th_get_devmajor(t);
 	devmin = th_get_devminor(t);
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (block device %ld,%ld)\n",
@@ -534,11 +1340,9 @@ tar_extract_blockdev(TAR *t, char *realname)
 #ifdef DEBUG
 		perror("mknod()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
-	if (!realname) free(filename);
 #endif
 	return 0;
 }
@@ -550,26 +1354,18 @@ tar_extract_dir(TAR *t, char *realname)
 {
 	mode_t mode;
 	char *filename;
-	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISDIR(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
 	mode = th_get_mode(t);
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (mode %04o, directory)\n", filename,
@@ -584,15 +1380,17 @@ tar_extract_dir(TAR *t, char *realname)
 #ifdef DEBUG
 				perror("chmod()");
 #endif
-				if (!realname) free(filename);
-				return -1;
+				return tar_fail(t);
 			}
 			else
 			{
 #ifdef DEBUG
 				puts("  *** using existing directory");
 #endif
-				if (!realname) free(filename);
+				/* an incremental dump lists what should be left */
+				if ((t->options & TAR_INCREMENTAL)
+				    && tar_extract_dumpdir(t, filename) != 0)
+					return -1;
 				return 1;
 			}
 		}
@@ -601,12 +1399,10 @@ tar_extract_dir(TAR *t, char *realname)
 #ifdef DEBUG
 			perror("mkdir()");
 #endif
-			if (!realname) free(filename);
-			return -1;
+			return tar_fail(t);
 		}
 	}
 
-	if (!realname) free(filename);
 	return 0;
 }
 
@@ -617,26 +1413,18 @@ tar_extract_fifo(TAR *t, char *realname)
 {
 	mode_t mode;
 	char *filename;
-	char buf[T_BLOCKSIZE];
 
 	if (!TH_ISFIFO(t))
 	{
 		errno = EINVAL;
-		return -1;
+		return tar_fail(t);
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
 	mode = th_get_mode(t);
 
-	/* Make a copy of the string because dirname and mkdirhier may modify the
-	 * string */
-	strncpy(buf, filename, sizeof(buf) - 1);
-	buf[sizeof(buf) - 1] = 0;
-
-	if (mkdirhier(dirname(filename)) == -1){
-		if (!realname) free(filename);
-		return -1;
-	}
+	if (mkdirhier_parent(filename) == -1)
+		return tar_fail(t);
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (fifo)\n", filename);
@@ -646,11 +1434,9 @@ tar_extract_fifo(TAR *t, char *realname)
 #ifdef DEBUG
 		perror("mkfifo()");
 #endif
-		if (!realname) free(filename);
-		return -1;
+		return tar_fail(t);
 	}
 
-	if (!realname) free(filename);
 	return 0;
 }
 
@@ -35,27 +35,71 @@ static int libtar_close(long fd) {
 	return close((int) fd);
 }
 
+/* asked whether a read or write of an archive that failed with EINTR is retried */
+static intrfunc_t libtar_intr = NULL;
+
 static ssize_t libtar_read(long fd, void *buf, size_t len) {
-	return read((int) fd, buf, len);
+	ssize_t n;
+
+	do
+		n = read((int) fd, buf, len);
+	while (n == -1 && errno == EINTR && libtar_intr != NULL
+	       && (*libtar_intr)());
+
+	return n;
 }
 
 static ssize_t libtar_write(long fd, const void *buf, size_t len) {
-	return write((int) fd, buf, len);
+	ssize_t n;
+
+	do
+		n = write((int) fd, buf, len);
+	while (n == -1 && errno == EINTR && libtar_intr != NULL
+	       && (*libtar_intr)());
+
+	return n;
+}
+
+static tar_off_t libtar_seek(long fd, tar_off_t offset, int whence) {
+	return lseek((int) fd, (off_t) offset, whence);
 }
 
 static tartype_t default_type = {
 	libtar_open,
 	libtar_close,
 	libtar_read,
-	libtar_write
+	libtar_write,
+	libtar_seek
 };
 
 
+/*
+** set the function asked, after a read or write of an archive opened
+** with the plain file functions fails with EINTR, whether to retry it.
+** without one, EINTR is returned to the caller.
+*/
+void
+tar_set_intrfunc(intrfunc_t func)
+{
+	libtar_intr = func;
+}
+
+
+/* t uses the plain file functions, so t->fd is a file descriptor */
+int
+tar_plain(TAR *t)
+{
+	return t->type == &default_type;
+}
+
+
 static int
 tar_init(TAR **t, char *pathname, tartype_t *type,
-	 int oflags, int mode, int options)
+	 int oflags, int options)
 {
-	if ((oflags & O_ACCMODE) == O_RDWR)
+	/* appending needs to find the end of the archive, and seek back to it */
+	if ((oflags & O_ACCMODE) == O_RDWR
+	    && (type ? type : &default_type)->seekfunc == NULL)
 	{
 		errno = EINVAL;
 		return -1;
@@ -69,6 +113,7 @@ tar_init(TAR **t, char *pathname, tartype_t *type,
 	(*t)->options = options;
 	(*t)->type = (type ? type : &default_type);
 	(*t)->oflags = oflags;
+	(*t)->sync_fd = -1;
 
 	if ((oflags & O_ACCMODE) == O_RDONLY)
 		(*t)->h = libtar_hash_new(256,
@@ -85,12 +130,84 @@ tar_init(TAR **t, char *pathname, tartype_t *type,
 }
 
 
+/* free everything but the file itself */
+static void
+tar_free(TAR *t)
+{
+	if (t->h != NULL)
+		libtar_hash_free(t->h, ((t->oflags & O_ACCMODE) == O_RDONLY
+					? free
+					: (libtar_freefunc_t)tar_dev_free));
+	if (t->pax_buf != NULL)
+		free(t->pax_buf);
+	if (t->pax_gbuf != NULL)
+		free(t->pax_gbuf);
+	th_pax_global_free(t);
+	if (t->th_buf.gnu_longname != NULL)
+		free(t->th_buf.gnu_longname);
+	if (t->th_buf.gnu_longlink != NULL)
+		free(t->th_buf.gnu_longlink);
+	if (t->th_buf.gnu_dumpdir != NULL)
+		free(t->th_buf.gnu_dumpdir);
+	if (t->sparse_map != NULL)
+		free(t->sparse_map);
+	if (t->extract_buf != NULL)
+		free(t->extract_buf);
+	if (t->sync_dir != NULL)
+		free(t->sync_dir);
+	if (t->sync_fd != -1)
+		close(t->sync_fd);
+	tar_extract_queue_free(t);
+	tar_uring_free(t->uring);
+	tar_owner_free(t);
+	free(t);
+}
+
+
+/*
+** position a handle opened with O_RDWR at the end-of-archive marker, so
+** that the members appended next overwrite it.  only the headers are
+** read; the contents in between are skipped with seekfunc.
+*/
+static int
+tar_seek_eot(TAR *t)
+{
+	tar_off_t pos;
+	int i;
+
+	for (;;)
+	{
+		pos = (*(t->type->seekfunc))(t->fd, 0, SEEK_CUR);
+		if (pos == -1)
+			return -1;
+		i = th_read(t);
+		if (i == -1)
+			return -1;
+		if (i == 1)
+			break;
+		if (TH_ISREG(t) && tar_skip_regfile(t) != 0)
+			return -1;
+	}
+
+#ifdef DEBUG
+	printf("    tar_seek_eot(): appending at offset %lld\n", (long long)pos);
+#endif
+
+	if ((*(t->type->seekfunc))(t->fd, pos, SEEK_SET) == -1)
+		return -1;
+
+	return 0;
+}
+
+
 /* open a new tarfile handle */
 int
 tar_open(TAR **t, char *pathname, tartype_t *type,
 	 int oflags, int mode, int options)
 {
-	if (tar_init(t, pathname, type, oflags, mode, options) == -1)
+	int i;
+
+	if (tar_init(t, pathname, type, oflags, options) == -1)
 		return -1;
 
 	if ((options & TAR_NOOVERWRITE) && (oflags & O_CREAT))
@@ -103,7 +220,16 @@ tar_open(TAR **t, char *pathname, tartype_t *type,
 	(*t)->fd = (*((*t)->type->openfunc))(pathname, oflags, mode);
 	if ((*t)->fd == -1)
 	{
-		free(*t);
+		tar_free(*t);
+		return -1;
+	}
+
+	if ((oflags & O_ACCMODE) == O_RDWR && tar_seek_eot(*t) != 0)
+	{
+		i = errno;
+		(*((*t)->type->closefunc))((*t)->fd);
+		tar_free(*t);
+		errno = i;
 		return -1;
 	}
 
@@ -112,13 +238,22 @@ tar_open(TAR **t, char *pathname, tartype_t *type,
 
 
 int
-tar_fdopen(TAR **t, int fd, char *pathname, tartype_t *type,
+tar_fdopen(TAR **t, long fd, char *pathname, tartype_t *type,
 	   int oflags, int mode, int options)
 {
-	if (tar_init(t, pathname, type, oflags, mode, options) == -1)
+	(void)mode;	/* the descriptor is already open */
+
+	if (tar_init(t, pathname, type, oflags, options) == -1)
 		return -1;
 
 	(*t)->fd = fd;
+
+	if ((oflags & O_ACCMODE) == O_RDWR && tar_seek_eot(*t) != 0)
+	{
+		tar_free(*t);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -130,6 +265,14 @@ tar_fd(TAR *t)
 }
 
 
+/* errno of the last failed operation on t */
+int
+tar_errno(TAR *t)
+{
+	return t->errnum;
+}
+
+
 /* close tarfile handle */
 int
 tar_close(TAR *t)
@@ -137,12 +280,7 @@ tar_close(TAR *t)
 	int i;
 
 	i = (*(t->type->closefunc))(t->fd);
-
-	if (t->h != NULL)
-		libtar_hash_free(t->h, ((t->oflags & O_ACCMODE) == O_RDONLY
-					? free
-					: (libtar_freefunc_t)tar_dev_free));
-	free(t);
+	tar_free(t);
 
 	return i;
 }
@@ -0,0 +1,758 @@
+/*
+**  incremental.c - libtar code for GNU listed-incremental dumps
+**
+**  A snapshot file records, for every directory that was dumped, its
+**  device, inode and mtime, in the format GNU tar 1.16 and later read
+**  and write with --listed-incremental ("GNU tar-<version>-2").  The
+**  next dump adds only the files whose mtime or ctime is not older than
+**  the time the snapshot was taken, plus every file of a directory the
+**  snapshot doesn't know (by name, device and inode).  Each directory
+**  goes into the archive as a GNU dumpdir member listing all of its
+**  names, so that extracting with TAR_INCREMENTAL can remove the files
+**  that were deleted in between.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <sys/param.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+
+#define SNAPSHOT_BUCKETS	1024
+
+#define SNAPSHOT_MAGIC		"GNU tar-"
+#define SNAPSHOT_FORMAT		"2"
+
+/* flags of the names in a dumpdir */
+#define DUMPDIR_DUMPED		'Y'
+#define DUMPDIR_UNCHANGED	'N'
+#define DUMPDIR_DIRECTORY	'D'
+
+struct tar_snapdir
+{
+	char *sd_name;
+	int sd_nfs;
+	tar_off_t sd_mtime;
+	long sd_mtime_nsec;
+	unsigned long long sd_dev;
+	unsigned long long sd_ino;
+	char *sd_dumpdir;	/* flagged names, each NUL-terminated, */
+	size_t sd_dumpdirlen;	/* then an empty one */
+};
+typedef struct tar_snapdir tar_snapdir_t;
+
+struct tar_snapshot
+{
+	int ts_full;		/* no snapshot file yet (level 0) */
+	tar_off_t ts_time;	/* when the loaded snapshot was taken */
+	long ts_time_nsec;
+	tar_off_t ts_now;	/* when this one was */
+	long ts_now_nsec;
+	libtar_hash_t *ts_dirs;	/* tar_snapdir_t's from the file, by name */
+	libtar_list_t *ts_seen;	/* tar_snapdir_t's of this dump, in order */
+};
+
+struct tar_dirent
+{
+	char de_flag;
+	char *de_name;
+};
+typedef struct tar_dirent tar_dirent_t;
+
+
+/* hashing function for snapshot directories */
+static unsigned int
+snapdir_hash(tar_snapdir_t *sd, unsigned int numbuckets)
+{
+	unsigned int h = 0;
+	const char *p;
+
+	for (p = sd->sd_name; *p != '\0'; p++)
+		h = h * 33 + (unsigned char)*p;
+
+	return h % numbuckets;
+}
+
+
+/* matching function for snapshot directories */
+static int
+snapdir_match(tar_snapdir_t *key, tar_snapdir_t *sd)
+{
+	return (strcmp(key->sd_name, sd->sd_name) == 0);
+}
+
+
+static void
+snapdir_free(tar_snapdir_t *sd)
+{
+	free(sd->sd_name);
+	free(sd->sd_dumpdir);
+	free(sd);
+}
+
+
+/* the next NUL-terminated field in [*pp, end), or NULL if there is none */
+static char *
+snapshot_field(char **pp, char *end)
+{
+	char *field = *pp, *nul;
+
+	if (field >= end)
+		return NULL;
+	nul = memchr(field, '\0', end - field);
+	if (nul == NULL)
+		return NULL;
+	*pp = nul + 1;
+
+	return field;
+}
+
+
+/* parse the fields after the header line of a format 2 snapshot */
+static int
+snapshot_parse(tar_snapshot_t *ts, char *p, char *end)
+{
+	char *sec, *nsec, *nfs, *dev, *ino, *name, *ent, *dumpdir;
+	tar_snapdir_t *sd;
+
+	sec = snapshot_field(&p, end);
+	nsec = snapshot_field(&p, end);
+	if (sec == NULL || nsec == NULL)
+		return -1;
+	ts->ts_time = strtoll(sec, NULL, 10);
+	ts->ts_time_nsec = strtol(nsec, NULL, 10);
+
+	while (p < end)
+	{
+		nfs = snapshot_field(&p, end);
+		sec = snapshot_field(&p, end);
+		nsec = snapshot_field(&p, end);
+		dev = snapshot_field(&p, end);
+		ino = snapshot_field(&p, end);
+		name = snapshot_field(&p, end);
+		if (name == NULL)
+			return -1;
+
+		/* the dumpdir runs up to an empty field */
+		dumpdir = p;
+		do
+		{
+			ent = snapshot_field(&p, end);
+			if (ent == NULL)
+				return -1;
+		}
+		while (*ent != '\0');
+
+		/* and the record ends with one more */
+		if (p >= end || *p != '\0')
+			return -1;
+
+		sd = (tar_snapdir_t *)calloc(1, sizeof(tar_snapdir_t));
+		if (sd == NULL)
+			return -1;
+		sd->sd_nfs = (*nfs == '1');
+		sd->sd_mtime = strtoll(sec, NULL, 10);
+		sd->sd_mtime_nsec = strtol(nsec, NULL, 10);
+		sd->sd_dev = strtoull(dev, NULL, 10);
+		sd->sd_ino = strtoull(ino, NULL, 10);
+		sd->sd_name = strdup(name);
+		sd->sd_dumpdirlen = p - dumpdir;
+		sd->sd_dumpdir = (char *)malloc(sd->sd_dumpdirlen);
+		if (sd->sd_name == NULL || sd->sd_dumpdir == NULL
+		    || libtar_hash_add(ts->ts_dirs, sd) != 0)
+		{
+			snapdir_free(sd);
+			return -1;
+		}
+		memcpy(sd->sd_dumpdir, dumpdir, sd->sd_dumpdirlen);
+		p++;
+	}
+
+	return 0;
+}
+
+
+/* read the whole of fd into a NUL-terminated buffer */
+static char *
+snapshot_read(int fd, size_t *lenp)
+{
+	char *buf, *tmp;
+	size_t len = 0, size = 8192;
+	ssize_t n;
+
+	buf = (char *)malloc(size + 1);
+	if (buf == NULL)
+		return NULL;
+
+	while ((n = read(fd, buf + len, size - len)) != 0)
+	{
+		if (n == -1)
+		{
+			free(buf);
+			return NULL;
+		}
+		len += n;
+		if (len == size)
+		{
+			size *= 2;
+			tmp = (char *)realloc(buf, size + 1);
+			if (tmp == NULL)
+			{
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+		}
+	}
+	buf[len] = '\0';
+
+	*lenp = len;
+	return buf;
+}
+
+
+/*
+** load the snapshot file pathname into *sp.  if it doesn't exist yet,
+** the snapshot is empty and everything will be dumped.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_snapshot_open(tar_snapshot_t **sp, const char *pathname)
+{
+	tar_snapshot_t *ts;
+	char *buf, *p, *format;
+	size_t len;
+	int fd, i;
+
+#ifdef DEBUG
+	printf("==> tar_snapshot_open(sp, \"%s\")\n", pathname);
+#endif
+
+	ts = (tar_snapshot_t *)calloc(1, sizeof(tar_snapshot_t));
+	if (ts == NULL)
+		return -1;
+#ifdef CLOCK_REALTIME
+	{
+		struct timespec now;
+
+		if (clock_gettime(CLOCK_REALTIME, &now) == 0)
+		{
+			ts->ts_now = now.tv_sec;
+			ts->ts_now_nsec = now.tv_nsec;
+		}
+		else
+			ts->ts_now = time(NULL);
+	}
+#else
+	ts->ts_now = time(NULL);
+#endif
+	ts->ts_dirs = libtar_hash_new(SNAPSHOT_BUCKETS,
+				      (libtar_hashfunc_t)snapdir_hash);
+	ts->ts_seen = libtar_list_new(LIST_QUEUE, NULL);
+	if (ts->ts_dirs == NULL || ts->ts_seen == NULL)
+	{
+		tar_snapshot_free(ts);
+		return -1;
+	}
+
+	fd = open(pathname, O_RDONLY);
+	if (fd == -1)
+	{
+		if (errno != ENOENT)
+		{
+			tar_snapshot_free(ts);
+			return -1;
+		}
+		ts->ts_full = 1;
+		*sp = ts;
+		return 0;
+	}
+
+	buf = snapshot_read(fd, &len);
+	i = errno;
+	close(fd);
+	if (buf == NULL)
+	{
+		tar_snapshot_free(ts);
+		errno = i;
+		return -1;
+	}
+
+	/* "GNU tar-<version>-2\n", then NUL-terminated fields */
+	p = strchr(buf, '\n');
+	if (p == NULL || strncmp(buf, SNAPSHOT_MAGIC,
+				 sizeof(SNAPSHOT_MAGIC) - 1) != 0)
+	{
+		free(buf);
+		tar_snapshot_free(ts);
+		errno = EINVAL;
+		return -1;
+	}
+	*p++ = '\0';
+	format = strrchr(buf, '-');
+	if (format == buf + sizeof(SNAPSHOT_MAGIC) - 2
+	    || strcmp(format + 1, SNAPSHOT_FORMAT) != 0
+	    || snapshot_parse(ts, p, buf + len) != 0)
+	{
+		free(buf);
+		tar_snapshot_free(ts);
+		errno = EINVAL;
+		return -1;
+	}
+
+	free(buf);
+	*sp = ts;
+	return 0;
+}
+
+
+/*
+** write the directories appended since s was opened to pathname,
+** replacing it only once the new file is complete.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_snapshot_save(tar_snapshot_t *s, const char *pathname)
+{
+	char tmppath[MAXPATHLEN];
+	libtar_listptr_t lp;
+	tar_snapdir_t *sd;
+	FILE *fp;
+	int i;
+
+#ifdef DEBUG
+	printf("==> tar_snapshot_save(s, \"%s\")\n", pathname);
+#endif
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", pathname);
+	fp = fopen(tmppath, "wb");
+	if (fp == NULL)
+		return -1;
+
+	fprintf(fp, "%s%s-%s\n", SNAPSHOT_MAGIC, libtar_version,
+		SNAPSHOT_FORMAT);
+	fprintf(fp, "%lld%c%ld%c", (long long)s->ts_now, '\0',
+		s->ts_now_nsec, '\0');
+
+	libtar_listptr_reset(&lp);
+	while (libtar_list_next(s->ts_seen, &lp) != 0)
+	{
+		sd = (tar_snapdir_t *)libtar_listptr_data(&lp);
+		fprintf(fp, "%d%c%lld%c%ld%c%llu%c%llu%c%s%c",
+			sd->sd_nfs, '\0', (long long)sd->sd_mtime, '\0',
+			sd->sd_mtime_nsec, '\0', sd->sd_dev, '\0',
+			sd->sd_ino, '\0', sd->sd_name, '\0');
+		fwrite(sd->sd_dumpdir, 1, sd->sd_dumpdirlen, fp);
+		putc('\0', fp);
+	}
+
+	if (ferror(fp))
+	{
+		i = errno;
+		fclose(fp);
+		unlink(tmppath);
+		errno = i;
+		return -1;
+	}
+	if (fclose(fp) != 0 || rename(tmppath, pathname) != 0)
+	{
+		i = errno;
+		unlink(tmppath);
+		errno = i;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void
+tar_snapshot_free(tar_snapshot_t *s)
+{
+	if (s->ts_dirs != NULL)
+		libtar_hash_free(s->ts_dirs, (libtar_freefunc_t)snapdir_free);
+	if (s->ts_seen != NULL)
+		libtar_list_free(s->ts_seen, (libtar_freefunc_t)snapdir_free);
+	free(s);
+}
+
+
+/* was the file changed at or after the time the snapshot was taken? */
+static int
+snapshot_changed(tar_snapshot_t *ts, struct stat *s)
+{
+	if (ts->ts_full)
+		return 1;
+
+	return (s->st_mtime > ts->ts_time
+		|| (s->st_mtime == ts->ts_time
+		    && STAT_MTIME_NSEC(s) >= ts->ts_time_nsec)
+		|| s->st_ctime > ts->ts_time
+		|| (s->st_ctime == ts->ts_time
+		    && STAT_CTIME_NSEC(s) >= ts->ts_time_nsec));
+}
+
+
+static int
+dirent_compare(const void *a, const void *b)
+{
+	return strcmp(((const tar_dirent_t *)a)->de_name,
+		      ((const tar_dirent_t *)b)->de_name);
+}
+
+
+static void
+dirents_free(tar_dirent_t *ents, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		free(ents[i].de_name);
+	free(ents);
+}
+
+
+/*
+** read the names in realdir, flagged for the dumpdir and sorted the way
+** GNU tar sorts them.  full is set if every file should be dumped.
+*/
+static int
+dirents_read(tar_snapshot_t *ts, char *realdir, int full,
+	     tar_dirent_t **entsp, size_t *np)
+{
+	char realpath[MAXPATHLEN];
+	struct dirent *dent;
+	tar_dirent_t *ents = NULL, *tmp;
+	size_t n = 0, size = 0;
+	struct stat s;
+	DIR *dp;
+	int i;
+
+	dp = opendir(realdir);
+	if (dp == NULL)
+		return -1;
+
+	while ((dent = readdir(dp)) != NULL)
+	{
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		snprintf(realpath, MAXPATHLEN, "%s/%s", realdir,
+			 dent->d_name);
+		if (lstat(realpath, &s) != 0)
+			goto fail;
+
+		if (n == size)
+		{
+			size = (size ? size * 2 : 64);
+			tmp = (tar_dirent_t *)realloc(ents,
+					size * sizeof(tar_dirent_t));
+			if (tmp == NULL)
+				goto fail;
+			ents = tmp;
+		}
+		ents[n].de_name = strdup(dent->d_name);
+		if (ents[n].de_name == NULL)
+			goto fail;
+		if (S_ISDIR(s.st_mode))
+			ents[n].de_flag = DUMPDIR_DIRECTORY;
+		else if (full || snapshot_changed(ts, &s))
+			ents[n].de_flag = DUMPDIR_DUMPED;
+		else
+			ents[n].de_flag = DUMPDIR_UNCHANGED;
+		n++;
+	}
+
+	closedir(dp);
+
+	if (n > 0)
+		qsort(ents, n, sizeof(tar_dirent_t), dirent_compare);
+	*entsp = ents;
+	*np = n;
+	return 0;
+
+  fail:
+	i = errno;
+	closedir(dp);
+	dirents_free(ents, n);
+	errno = i;
+	return -1;
+}
+
+
+/* write the dumpdir member for realdir, and remember it for the snapshot */
+static int
+append_dumpdir(TAR *t, tar_snapshot_t *ts, char *realdir, char *savedir,
+	       struct stat *s, tar_dirent_t *ents, size_t n)
+{
+	tar_snapdir_t *sd;
+	size_t i, len = 1;
+	char *p;
+
+	sd = (tar_snapdir_t *)calloc(1, sizeof(tar_snapdir_t));
+	if (sd == NULL)
+		return tar_fail(t);
+
+	for (i = 0; i < n; i++)
+		len += strlen(ents[i].de_name) + 2;
+	sd->sd_name = strdup(realdir);
+	sd->sd_dumpdir = (char *)malloc(len);
+	if (sd->sd_name == NULL || sd->sd_dumpdir == NULL
+	    || libtar_list_add(ts->ts_seen, sd) != 0)
+	{
+		snapdir_free(sd);
+		return tar_fail(t);
+	}
+	sd->sd_dumpdirlen = len;
+	sd->sd_mtime = s->st_mtime;
+	sd->sd_mtime_nsec = STAT_MTIME_NSEC(s);
+	sd->sd_dev = (unsigned long long)s->st_dev;
+	sd->sd_ino = (unsigned long long)s->st_ino;
+
+	for (p = sd->sd_dumpdir, i = 0; i < n; i++)
+	{
+		*p++ = ents[i].de_flag;
+		strcpy(p, ents[i].de_name);
+		p += strlen(p) + 1;
+	}
+	*p = '\0';
+
+	/* a directory header whose contents are the dumpdir */
+	memset(&(t->th_buf), 0, sizeof(struct tar_header));
+	th_set_from_stat(t, s);
+	th_set_path(t, (savedir ? savedir : realdir));
+	t->th_buf.typeflag = GNU_DUMPDIR_TYPE;
+	th_set_size(t, len);
+
+	if (t->options & TAR_VERBOSE)
+		th_print_long_ls(t);
+
+	if (th_write(t) != 0)
+		return tar_fail(t);
+
+	t->data_left = len;
+	t->data_bufoff = t->data_buflen = 0;
+
+	return tar_write_data(t, sd->sd_dumpdir, len);
+}
+
+
+static int
+append_incremental(TAR *t, tar_snapshot_t *ts, char *realdir, char *savedir,
+		   int full)
+{
+	char realpath[MAXPATHLEN];
+	char savepath[MAXPATHLEN];
+	libtar_hashptr_t hp;
+	tar_snapdir_t key, *sd;
+	tar_dirent_t *ents;
+	struct stat s;
+	size_t i, n;
+
+	if (lstat(realdir, &s) != 0)
+		return tar_fail(t);
+
+	if (!S_ISDIR(s.st_mode))
+	{
+		if (!full && !snapshot_changed(ts, &s))
+			return 0;
+		return tar_append_file(t, realdir, savedir);
+	}
+
+	/* a directory the snapshot doesn't know is dumped in full */
+	key.sd_name = realdir;
+	libtar_hashptr_reset(&hp);
+	if (!libtar_hash_getkey(ts->ts_dirs, &hp, &key,
+				(libtar_matchfunc_t)snapdir_match))
+		full = 1;
+	else
+	{
+		sd = (tar_snapdir_t *)libtar_hashptr_data(&hp);
+		if (sd->sd_dev != (unsigned long long)s.st_dev
+		    || sd->sd_ino != (unsigned long long)s.st_ino)
+			full = 1;
+	}
+
+#ifdef DEBUG
+	printf("    append_incremental(): \"%s\" (%s)\n", realdir,
+	       (full ? "full" : "changes"));
+#endif
+
+	if (dirents_read(ts, realdir, full, &ents, &n) != 0)
+		return tar_fail(t);
+
+	if (append_dumpdir(t, ts, realdir, savedir, &s, ents, n) != 0)
+		goto fail;
+
+	for (i = 0; i < n; i++)
+	{
+		if (ents[i].de_flag == DUMPDIR_UNCHANGED)
+			continue;
+
+		snprintf(realpath, MAXPATHLEN, "%s/%s", realdir,
+			 ents[i].de_name);
+		if (savedir)
+			snprintf(savepath, MAXPATHLEN, "%s/%s", savedir,
+				 ents[i].de_name);
+
+		if (ents[i].de_flag == DUMPDIR_DIRECTORY)
+		{
+			if (append_incremental(t, ts, realpath,
+					       (savedir ? savepath : NULL),
+					       full) != 0)
+				goto fail;
+			continue;
+		}
+
+		if (tar_append_file(t, realpath,
+				    (savedir ? savepath : NULL)) != 0)
+			goto fail;
+	}
+
+	dirents_free(ents, n);
+	return 0;
+
+  fail:
+	tar_fail(t);
+	dirents_free(ents, n);
+	errno = t->errnum;
+	return -1;
+}
+
+
+/*
+** like tar_append_tree(), but only the files that changed since s was
+** taken are added; every directory is written as a dumpdir member.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_append_tree_incremental(TAR *t, tar_snapshot_t *s, char *realdir,
+			    char *savedir)
+{
+#ifdef DEBUG
+	printf("==> tar_append_tree_incremental(0x%lx, s, \"%s\", \"%s\")\n",
+	       t, realdir, (savedir ? savedir : "[NULL]"));
+#endif
+
+	return append_incremental(t, s, realdir, savedir, s->ts_full);
+}
+
+
+/* remove path, and everything in it if it is a directory */
+static int
+remove_tree(char *path)
+{
+	char subpath[MAXPATHLEN];
+	struct dirent *dent;
+	struct stat s;
+	DIR *dp;
+	int i;
+
+	if (lstat(path, &s) != 0)
+		return -1;
+	if (!S_ISDIR(s.st_mode))
+		return unlink(path);
+
+	dp = opendir(path);
+	if (dp == NULL)
+		return -1;
+	while ((dent = readdir(dp)) != NULL)
+	{
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		snprintf(subpath, MAXPATHLEN, "%s/%s", path, dent->d_name);
+		if (remove_tree(subpath) != 0)
+		{
+			i = errno;
+			closedir(dp);
+			errno = i;
+			return -1;
+		}
+	}
+	closedir(dp);
+
+	return rmdir(path);
+}
+
+
+/*
+** remove everything in the directory realname that the dumpdir of the
+** current member doesn't list, i.e. what was deleted before the dump.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_extract_dumpdir(TAR *t, char *realname)
+{
+	char path[MAXPATHLEN];
+	tar_matcher_t *m;
+	struct dirent *dent;
+	DIR *dp;
+	char *p;
+	int i;
+
+	if (t->th_buf.gnu_dumpdir == NULL)
+		return 0;
+
+	m = tar_matcher_new();
+	if (m == NULL)
+		return tar_fail(t);
+	for (p = t->th_buf.gnu_dumpdir; *p != '\0'; p += strlen(p) + 1)
+	{
+		if (tar_matcher_add(m, p + 1, 1) != 0)
+		{
+			tar_fail(t);
+			tar_matcher_free(m);
+			errno = t->errnum;
+			return -1;
+		}
+	}
+
+	dp = opendir(realname);
+	if (dp == NULL)
+	{
+		tar_fail(t);
+		tar_matcher_free(m);
+		errno = t->errnum;
+		return -1;
+	}
+	while ((dent = readdir(dp)) != NULL)
+	{
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0
+		    || tar_matcher_match(m, dent->d_name))
+			continue;
+
+		snprintf(path, MAXPATHLEN, "%s/%s", realname, dent->d_name);
+#ifdef DEBUG
+		printf("    tar_extract_dumpdir(): removing \"%s\"\n", path);
+#endif
+		if (remove_tree(path) != 0)
+		{
+			i = errno;
+			closedir(dp);
+			tar_matcher_free(m);
+			errno = i;
+			return tar_fail(t);
+		}
+	}
+	closedir(dp);
+	tar_matcher_free(m);
+
+	return 0;
+}
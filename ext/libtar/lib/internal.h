@@ -15,6 +15,72 @@
 
 #include <libtar.h>
 
+#include <errno.h>
+
+#if defined(_MSC_VER) && !defined(inline)
+# define inline __inline
+#endif
+
+/* record errno in the handle and return -1; errno is left as it was */
+static inline int
+tar_fail(TAR *t)
+{
+	t->errnum = errno;
+	return -1;
+}
+
+/* sub-second parts of the stat mtime and ctime */
+#if defined(__APPLE__)
+# define STAT_MTIME_NSEC(s)	((s)->st_mtimespec.tv_nsec)
+# define STAT_CTIME_NSEC(s)	((s)->st_ctimespec.tv_nsec)
+#elif defined(st_mtime)
+# define STAT_MTIME_NSEC(s)	((s)->st_mtim.tv_nsec)
+# define STAT_CTIME_NSEC(s)	((s)->st_ctim.tv_nsec)
+#else
+# define STAT_MTIME_NSEC(s)	0
+# define STAT_CTIME_NSEC(s)	0
+#endif
+
+/* with TAR_IO_URING, files up to URING_MAX_FILE bytes are read or
+   written in batches of URING_BATCH, holding up to URING_BATCH_BYTES */
+#define URING_BATCH		256
+#define URING_MAX_FILE		(64 * 1024)
+#define URING_BATCH_BYTES	(4 * 1024 * 1024)
+
+/* uring.c */
+typedef struct tar_uring tar_uring_t;
+tar_uring_t *tar_uring_new(unsigned int chains);
+void tar_uring_free(tar_uring_t *r);
+tar_uring_t *tar_uring(TAR *t);
+int tar_uring_write_file(tar_uring_t *r, const char *path, const void *buf,
+			 size_t len);
+int tar_uring_read_file(tar_uring_t *r, const char *path, void *buf,
+			size_t len);
+int tar_uring_lstat(tar_uring_t *r, const char *path);
+void tar_uring_stat(tar_uring_t *r, int i, struct stat *s);
+int tar_uring_run(tar_uring_t *r);
+int tar_uring_result(tar_uring_t *r, int i);
+
+/* extract.c: tar_extract_file(), but small files may wait for a flush */
+int tar_extract_queued(TAR *t, char *realname);
+int tar_extract_flush(TAR *t);
+void tar_extract_queue_free(TAR *t);
+
+/* append.c: tar_append_file() with the lstat() of the file, and maybe
+   its contents, already at hand */
+int tar_append_file_data(TAR *t, char *realname, char *savename,
+			 struct stat *s, const char *data, size_t len);
+
+/* pax.c: free the strings of t->pax_global */
+void th_pax_global_free(TAR *t);
+
+/* handle.c: t->fd is a file descriptor */
+int tar_plain(TAR *t);
+
+/* read or write len bytes of the archive, continuing after short ones */
+ssize_t tar_read_full(TAR *t, char *buf, size_t len);
+ssize_t tar_write_full(TAR *t, const char *buf, size_t len);
+
 #ifdef _WIN32
 
 #include <direct.h>
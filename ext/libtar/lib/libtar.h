@@ -43,6 +43,87 @@ extern "C"
 /* GNU extensions for typeflag */
 #define GNU_LONGNAME_TYPE	'L'
 #define GNU_LONGLINK_TYPE	'K'
+#define GNU_DUMPDIR_TYPE	'D'	/* directory with a listing of its names */
+#define GNU_SPARSE_TYPE		'S'	/* regular file with a sparse map */
+
+/* POSIX.1-2001 pax extensions for typeflag */
+#define PAX_HEADER_TYPE		'x'
+#define PAX_GLOBAL_TYPE		'g'
+
+/* member sizes and times may exceed 32 bits */
+#ifdef _WIN32
+typedef __int64 tar_off_t;
+#else
+typedef long long tar_off_t;
+#endif
+
+/* pax extended header values which override the ustar fields */
+#define TAR_PAX_PATH		0x01
+#define TAR_PAX_LINKPATH	0x02
+#define TAR_PAX_SIZE		0x04
+#define TAR_PAX_MTIME		0x08
+#define TAR_PAX_UID		0x10
+#define TAR_PAX_GID		0x20
+#define TAR_PAX_UNAME		0x40
+#define TAR_PAX_GNAME		0x80
+#define TAR_PAX_SPARSE		0x100	/* GNU.sparse.* records */
+
+struct tar_pax
+{
+	int flags;		/* which of the fields below are set */
+	int local;		/* which flags an 'x' header set or removed */
+	char *path;		/* these point into the TAR record buffers, */
+				/* or the copies kept in pax_global */
+	char *linkpath;
+	char *uname;
+	char *gname;
+	tar_off_t size;
+	tar_off_t mtime;
+	long mtime_nsec;
+	unsigned long uid;
+	unsigned long gid;
+	int sparse_major;	/* 1 if the map precedes the data */
+	tar_off_t sparse_realsize;
+	char *sparse_name;
+	char *sparse_map;	/* "offset,numbytes,..." of format 0.1 */
+};
+
+/* a data region of a sparse member; the rest of the file is holes */
+struct tar_sparse
+{
+	tar_off_t offset;
+	tar_off_t numbytes;
+};
+
+/* member types, in the order tar_extract_file() tests them */
+#define TH_TYPE_DIR		0
+#define TH_TYPE_LNK		1
+#define TH_TYPE_SYM		2
+#define TH_TYPE_CHR		3
+#define TH_TYPE_BLK		4
+#define TH_TYPE_FIFO		5
+#define TH_TYPE_REG		6
+
+/* header fields decoded once per member */
+struct tar_info
+{
+	int valid;		/* cleared whenever the header is changed */
+	int type;		/* TH_TYPE_* used to extract the member */
+	int types;		/* (1 << TH_TYPE_*) for each TH_IS*() match */
+	mode_t mode;		/* including the S_IFMT bits */
+	tar_off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	unsigned long uid;
+	unsigned long gid;
+	unsigned long devmajor;
+	unsigned long devminor;
+	int crc;
+	char *pathname;		/* point into the buffers below, */
+	char *linkname;		/* the GNU long names or the pax records */
+	char pathbuf[T_MAXPATHLEN + 2];
+	char linkbuf[T_NAMELEN + 1];
+};
 
 /* our version of the tar header structure */
 struct tar_header
@@ -66,6 +147,9 @@ struct tar_header
 	char padding[12];
 	char *gnu_longname;
 	char *gnu_longlink;
+	char *gnu_dumpdir;	/* contents of a GNU_DUMPDIR_TYPE member */
+	struct tar_pax pax;
+	struct tar_info info;
 };
 
 
@@ -75,6 +159,8 @@ typedef long (*openfunc_t)(const char *, int, int);
 typedef int (*closefunc_t)(long);
 typedef ssize_t (*readfunc_t)(long, void *, size_t);
 typedef ssize_t (*writefunc_t)(long, const void *, size_t);
+typedef tar_off_t (*seekfunc_t)(long, tar_off_t, int);
+typedef int (*intrfunc_t)(void);
 
 typedef struct
 {
@@ -82,6 +168,7 @@ typedef struct
 	closefunc_t closefunc;
 	readfunc_t readfunc;
 	writefunc_t writefunc;
+	seekfunc_t seekfunc;	/* optional, used to skip contents */
 }
 tartype_t;
 
@@ -94,6 +181,32 @@ typedef struct
 	int options;
 	struct tar_header th_buf;
 	libtar_hash_t *h;
+	char *pax_buf;		/* records of the current 'x' header */
+	size_t pax_bufsize;
+	char *pax_gbuf;		/* records of the last 'g' header */
+	size_t pax_gbufsize;
+	struct tar_pax pax_global;	/* owns its strings; local is 0 */
+	libtar_hash_t *owner_ids;	/* cached uid/gid -> name lookups */
+	libtar_hash_t *owner_names;	/* cached name -> uid/gid lookups */
+	int errnum;			/* errno of the last failure */
+	tar_off_t data_left;		/* member bytes not yet read/written */
+	char data_buf[T_BLOCKSIZE];	/* partial block of tar_*_data() */
+	size_t data_bufoff;		/* bytes of data_buf returned so far */
+	size_t data_buflen;		/* bytes of member data in data_buf */
+	struct tar_sparse *sparse_map;	/* regions of a sparse member, */
+	size_t sparse_count;		/* or 0 if it isn't sparse */
+	size_t sparse_alloc;
+	size_t sparse_idx;		/* region tar_read_data() is in */
+	tar_off_t sparse_size;		/* size of the expanded file */
+	tar_off_t sparse_pos;		/* bytes of it returned so far */
+	char *extract_buf;		/* contents buffer of extraction */
+	int durability;			/* TAR_DURABLE_* of extraction */
+	char *sync_dir;			/* directory sync_fd is open on */
+	int sync_fd;			/* last extracted-to directory, or -1 */
+	int prefetch;			/* files read ahead when appending */
+	struct tar_uring *uring;	/* ring of TAR_IO_URING, if set up */
+	int uring_failed;		/* io_uring is unavailable */
+	struct extract_queue *extract_queue;	/* files waiting for it */
 }
 TAR;
 
@@ -105,6 +218,19 @@ TAR;
 #define TAR_CHECK_MAGIC		16	/* check magic in file header */
 #define TAR_CHECK_VERSION	32	/* check version in file header */
 #define TAR_IGNORE_CRC		64	/* ignore CRC in file header */
+#define TAR_PAX			128	/* use POSIX pax extended headers */
+#define TAR_NUMERIC_OWNER	256	/* don't map ids to user/group names */
+#define TAR_INCREMENTAL		512	/* remove what dumpdirs don't list */
+#define TAR_SPARSE		1024	/* store and extract holes as holes */
+#define TAR_NOCACHE		2048	/* keep extracted data out of cache */
+#define TAR_PHYSICAL_ORDER	4096	/* append trees in disk order */
+#define TAR_IO_URING		8192	/* batch small files with io_uring */
+
+/* durability of extracted files, set with tar_set_durability() */
+#define TAR_DURABLE_NONE	0	/* leave writeback to the kernel */
+#define TAR_DURABLE_BATCH	1	/* start writeback, syncfs() at the end */
+#define TAR_DURABLE_PER_FILE	2	/* fsync() each file and its directory */
+#define TAR_DURABLE_ATOMIC	3	/* fsync() a temporary file, rename it */
 
 /* this is obsolete - it's here for backwards-compatibility only */
 #define TAR_IGNORE_MAGIC	0
@@ -117,15 +243,21 @@ int tar_open(TAR **t, char *pathname, tartype_t *type,
 	     int oflags, int mode, int options);
 
 /* make a tarfile handle out of a previously-opened descriptor */
-int tar_fdopen(TAR **t, int fd, char *pathname, tartype_t *type,
+int tar_fdopen(TAR **t, long fd, char *pathname, tartype_t *type,
 	       int oflags, int mode, int options);
 
 /* returns the descriptor associated with t */
 int tar_fd(TAR *t);
 
+/* returns the errno of the last failed operation on t */
+int tar_errno(TAR *t);
+
 /* close tarfile handle */
 int tar_close(TAR *t);
 
+/* nonzero from func retries a read or write interrupted by a signal */
+void tar_set_intrfunc(intrfunc_t func);
+
 
 /***** append.c ************************************************************/
 
@@ -149,7 +281,29 @@ int tar_append_eof(TAR *t);
 /* add file contents to a tarchive */
 int tar_append_regfile(TAR *t, char *realname);
 
-int tar_append_function(TAR *t, char *savename, int size, void *data, int (*f)(char *b, int l, void *d));
+int tar_append_function(TAR *t, char *savename, tar_off_t size, void *data, int (*f)(char *b, int l, void *d));
+
+/* add a regfile header; the contents follow with tar_write_data() */
+int tar_append_header(TAR *t, char *savename, tar_off_t size, mode_t mode,
+		      time_t mtime);
+int tar_write_data(TAR *t, const void *buf, size_t len);
+
+/* a regular file for tar_append_buffers() */
+typedef struct
+{
+	char *savename;
+	const void *data;
+	size_t len;
+}
+tar_buffer_t;
+
+/* add regfiles from memory, sharing one mode, mtime and owner */
+int tar_append_buffers(TAR *t, tar_buffer_t *bufs, size_t count,
+		       mode_t mode, time_t mtime, uid_t uid, gid_t gid);
+
+/* copy the member src is on, as set up by th_copy(), without decoding
+   its contents */
+int tar_append_member(TAR *t, TAR *src);
 
 /***** block.c *************************************************************/
 
@@ -166,39 +320,37 @@ int th_write(TAR *t);
 
 /***** decode.c ************************************************************/
 
+/* decode the current header into t->th_buf.info */
+struct tar_info *th_decode(TAR *t);
+#define th_info(t)	((t)->th_buf.info.valid \
+			 ? &((t)->th_buf.info) : th_decode(t))
+
 /* determine file type */
-#define TH_ISREG(t)	((t)->th_buf.typeflag == REGTYPE \
-			 || (t)->th_buf.typeflag == AREGTYPE \
-			 || (t)->th_buf.typeflag == CONTTYPE \
-			 || (S_ISREG((mode_t)oct_to_int((t)->th_buf.mode)) \
-			     && (t)->th_buf.typeflag != LNKTYPE))
-#define TH_ISLNK(t)	((t)->th_buf.typeflag == LNKTYPE)
-#define TH_ISSYM(t)	((t)->th_buf.typeflag == SYMTYPE \
-			 || S_ISLNK((mode_t)oct_to_int((t)->th_buf.mode)))
-#define TH_ISCHR(t)	((t)->th_buf.typeflag == CHRTYPE \
-			 || S_ISCHR((mode_t)oct_to_int((t)->th_buf.mode)))
-#define TH_ISBLK(t)	((t)->th_buf.typeflag == BLKTYPE \
-			 || S_ISBLK((mode_t)oct_to_int((t)->th_buf.mode)))
-#define TH_ISDIR(t)	((t)->th_buf.typeflag == DIRTYPE \
-			 || S_ISDIR((mode_t)oct_to_int((t)->th_buf.mode)) \
-			 || ((t)->th_buf.typeflag == AREGTYPE \
-			     && ((t)->th_buf.name[strlen((t)->th_buf.name) - 1] == '/')))
-#define TH_ISFIFO(t)	((t)->th_buf.typeflag == FIFOTYPE \
-			 || S_ISFIFO((mode_t)oct_to_int((t)->th_buf.mode)))
+#define TH_ISTYPE(t, type)	(th_info(t)->types & (1 << (type)))
+#define TH_ISREG(t)	TH_ISTYPE((t), TH_TYPE_REG)
+#define TH_ISLNK(t)	TH_ISTYPE((t), TH_TYPE_LNK)
+#define TH_ISSYM(t)	TH_ISTYPE((t), TH_TYPE_SYM)
+#define TH_ISCHR(t)	TH_ISTYPE((t), TH_TYPE_CHR)
+#define TH_ISBLK(t)	TH_ISTYPE((t), TH_TYPE_BLK)
+#define TH_ISDIR(t)	TH_ISTYPE((t), TH_TYPE_DIR)
+#define TH_ISFIFO(t)	TH_ISTYPE((t), TH_TYPE_FIFO)
 #define TH_ISLONGNAME(t)	((t)->th_buf.typeflag == GNU_LONGNAME_TYPE)
 #define TH_ISLONGLINK(t)	((t)->th_buf.typeflag == GNU_LONGLINK_TYPE)
-
-/* decode tar header info */
-#define th_get_crc(t) oct_to_int((t)->th_buf.chksum)
-#define th_get_size(t) oct_to_int((t)->th_buf.size)
-#define th_get_mtime(t) oct_to_int((t)->th_buf.mtime)
-#define th_get_devmajor(t) oct_to_int((t)->th_buf.devmajor)
-#define th_get_devminor(t) oct_to_int((t)->th_buf.devminor)
-#define th_get_linkname(t) ((t)->th_buf.gnu_longlink \
-                            ? (t)->th_buf.gnu_longlink \
-                            : (t)->th_buf.linkname)
-char *th_get_pathname(TAR *t);
-mode_t th_get_mode(TAR *t);
+#define TH_ISDUMPDIR(t)	((t)->th_buf.typeflag == GNU_DUMPDIR_TYPE)
+#define TH_ISSPARSE(t)	((t)->sparse_count > 0)
+#define TH_ISPAXHEADER(t)	((t)->th_buf.typeflag == PAX_HEADER_TYPE)
+#define TH_ISPAXGLOBAL(t)	((t)->th_buf.typeflag == PAX_GLOBAL_TYPE)
+
+/* decode tar header info; strings stay valid until the header changes */
+#define th_get_crc(t) (th_info(t)->crc)
+#define th_get_size(t) (th_info(t)->size)
+#define th_get_mtime(t) (th_info(t)->mtime)
+#define th_get_mtime_nsec(t) (th_info(t)->mtime_nsec)
+#define th_get_devmajor(t) (th_info(t)->devmajor)
+#define th_get_devminor(t) (th_info(t)->devminor)
+#define th_get_linkname(t) (th_info(t)->linkname)
+#define th_get_pathname(t) (th_info(t)->pathname)
+#define th_get_mode(t) (th_info(t)->mode)
 uid_t th_get_uid(TAR *t);
 gid_t th_get_gid(TAR *t);
 
@@ -213,14 +365,15 @@ void th_set_device(TAR *t, dev_t device);
 void th_set_user(TAR *t, uid_t uid);
 void th_set_group(TAR *t, gid_t gid);
 void th_set_mode(TAR *t, mode_t fmode);
-#define th_set_mtime(t, fmtime) \
-	int_to_oct_nonull((fmtime), (t)->th_buf.mtime, 12)
-#define th_set_size(t, fsize) \
-	int_to_oct_nonull((fsize), (t)->th_buf.size, 12)
+void th_set_mtime(TAR *t, time_t fmtime);
+void th_set_size(TAR *t, tar_off_t fsize);
 
 /* encode everything at once (except the pathname and linkname) */
 void th_set_from_stat(TAR *t, struct stat *s);
 
+/* encode the current header of another handle */
+void th_copy(TAR *t, TAR *src);
+
 /* encode magic, version, and crc - must be done after everything else is set */
 void th_finish(TAR *t);
 
@@ -229,7 +382,13 @@ void th_finish(TAR *t);
 
 /* sequentially extract next file from t */
 int tar_extract_file(TAR *t, char *realname);
-
+
+/* choose how durable tar_extract_file() makes what it extracts */
+int tar_set_durability(TAR *t, int durability);
+
+/* make everything extracted so far durable */
+int tar_extract_sync(TAR *t);
+
 int tar_extract_function(TAR *t, void *data, int (*f)(char *b, int l, void *d));
 
 /* extract different file types */
@@ -244,6 +403,14 @@ int tar_extract_fifo(TAR *t, char *realname);
 int tar_extract_regfile(TAR *t, char *realname);
 int tar_skip_regfile(TAR *t);
 
+/* read up to len bytes of the current regfile's contents */
+ssize_t tar_read_data(TAR *t, void *buf, size_t len);
+
+/* bytes of the current regfile's contents not yet read */
+#define tar_data_left(t) \
+	(TH_ISSPARSE(t) ? (t)->sparse_size - (t)->sparse_pos \
+	 : (t)->data_left + (tar_off_t)((t)->data_buflen - (t)->data_bufoff))
+
 
 /***** output.c ************************************************************/
 
@@ -274,30 +441,153 @@ int ino_hash(ino_t *inode);
 /* create any necessary dirs */
 int mkdirhier(char *path);
 
+/* create any necessary dirs leading up to path */
+int mkdirhier_parent(char *path);
+
+
+/***** owner.c ************************************************************/
+
+#define TAR_OWNER_USER		0
+#define TAR_OWNER_GROUP		1
+
+/* user or group name for id (cached), or NULL if there is none */
+const char *tar_owner_name(TAR *t, int kind, unsigned long id);
+
+/* uid or gid for name (cached); returns -1 if there is none */
+int tar_owner_id(TAR *t, int kind, const char *name, unsigned long *id);
+
+/* free the owner caches of t */
+void tar_owner_free(TAR *t);
+
+
+/***** codec.c ************************************************************/
+
 /* calculate header checksum */
 int th_crc_calc(TAR *t);
-#define th_crc_ok(t) (th_get_crc(t) == th_crc_calc(t))
+#define th_crc_ok(t) (oct_to_size((t)->th_buf.chksum, \
+				      sizeof((t)->th_buf.chksum)) \
+		      == th_crc_calc(t))
+
+/* test for an all-zero block */
+int th_block_is_zero(const void *buf);
+
+/* string-octal to integer conversion; no more than octlen bytes are read */
+int oct_to_int(char *oct, size_t octlen);
 
-/* string-octal to integer conversion */
-int oct_to_int(char *oct);
+/* numeric field to 64-bit integer conversion (octal or GNU base-256) */
+tar_off_t oct_to_size(char *oct, size_t octlen);
 
 /* integer to NULL-terminated string-octal conversion */
 #define int_to_oct(num, oct, octlen) \
-	snprintf((oct), (octlen), "%0*lo", (octlen) - 1, (unsigned long)(num))
+	size_to_oct((tar_off_t)(num), (oct), (octlen))
 
 /* integer to string-octal conversion, no NULL */
 void int_to_oct_nonull(int num, char *oct, size_t octlen);
 
+/* 64-bit integer to numeric field conversion (GNU base-256 if too big) */
+void size_to_oct(tar_off_t num, char *oct, size_t octlen);
+
+
+
+/***** pax.c **************************************************************/
+
+/* parse the records of a pax extended header into p */
+int th_pax_parse(char *buf, size_t len, struct tar_pax *p);
+
+/* read the records of the 'x' or 'g' header in t->th_buf */
+int th_pax_read(TAR *t);
+
+/* write an 'x' header for the fields that don't fit in t->th_buf */
+int th_pax_write(TAR *t);
+
+
+/***** sparse.c ***********************************************************/
+
+/* read the sparse map of the member th_read() just read, if it has one */
+int th_sparse_read(TAR *t);
+
+/* append a regular file with holes as a sparse member; returns 1 if
+   it has none, and nothing was written */
+int tar_append_sparse(TAR *t, char *realname, struct stat *s);
+
+
+/***** match.c ************************************************************/
+
+/* a set of literal paths and globs */
+typedef struct tar_matcher tar_matcher_t;
+
+tar_matcher_t *tar_matcher_new(void);
+int tar_matcher_add(tar_matcher_t *m, const char *pattern, int literal);
+int tar_matcher_match(tar_matcher_t *m, const char *pathname);
+int tar_matcher_done(tar_matcher_t *m);
+void tar_matcher_free(tar_matcher_t *m);
+
 
 /***** wrapper.c **********************************************************/
 
 /* extract groups of files */
 int tar_extract_glob(TAR *t, char *globname, char *prefix);
+int tar_extract_globs(TAR *t, tar_matcher_t *m, char *prefix);
 int tar_extract_all(TAR *t, char *prefix);
 
 /* add a whole tree of files */
 int tar_append_tree(TAR *t, char *realdir, char *savedir);
 
+/* read this many files ahead in tar_append_list() and batched trees */
+int tar_set_prefetch(TAR *t, int files);
+
+/* a file for tar_append_list() */
+typedef struct
+{
+	char *realname;
+	char *savename;		/* NULL to save it as realname */
+	struct stat *st;	/* its lstat(), or NULL to have it made */
+}
+tar_listent_t;
+
+/* add the files of a list, in order */
+int tar_append_list(TAR *t, tar_listent_t *files, size_t count);
+
+/* conditions a header must meet; zeroed fields match everything */
+typedef struct
+{
+	tar_matcher_t *include;
+	tar_matcher_t *exclude;
+	int types;		/* (1 << TH_TYPE_*) for each wanted type */
+	tar_off_t min_size;
+	int newer;		/* compare against newer_than? */
+	time_t newer_than;
+	long newer_than_nsec;
+}
+tar_filter_t;
+
+/* does the current header meet f? */
+int th_match(TAR *t, const tar_filter_t *f);
+
+/* read headers, skipping members that don't meet f */
+int th_read_match(TAR *t, const tar_filter_t *f);
+
+
+/***** incremental.c ******************************************************/
+
+/* the directories of a GNU listed-incremental snapshot file */
+typedef struct tar_snapshot tar_snapshot_t;
+
+/* load a snapshot file; a missing one means a full (level 0) dump */
+int tar_snapshot_open(tar_snapshot_t **sp, const char *pathname);
+
+/* write the directories appended since tar_snapshot_open() */
+int tar_snapshot_save(tar_snapshot_t *s, const char *pathname);
+
+void tar_snapshot_free(tar_snapshot_t *s);
+
+/* add the files of a tree that changed since s was taken */
+int tar_append_tree_incremental(TAR *t, tar_snapshot_t *s, char *realdir,
+				char *savedir);
+
+/* remove the names in realname that the current dumpdir doesn't list */
+int tar_extract_dumpdir(TAR *t, char *realname);
+
 
 #ifdef __cplusplus
 }
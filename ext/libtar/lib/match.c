@@ -0,0 +1,274 @@
+/*
+**  match.c - libtar code to match pathnames against many patterns at once
+**
+**  Literal paths go into a hash, so looking one up doesn't depend on how
+**  many there are.  Globs are filed in a trie under their literal prefix
+**  (everything before the first wildcard); a pathname walks the trie and
+**  only the globs whose prefix it starts with are passed to fnmatch().
+**  Once every literal has been seen and there are no globs, the matcher
+**  is done and the caller can stop reading the archive.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+
+#define MATCH_BUCKETS		1024
+
+#define GLOB_CHARS		"*?[\\"
+
+struct tar_literal
+{
+	char *tl_path;
+	int tl_found;
+};
+typedef struct tar_literal tar_literal_t;
+
+struct tar_glob
+{
+	char *tg_pattern;
+	struct tar_glob *tg_next;
+};
+typedef struct tar_glob tar_glob_t;
+
+/* one node per character of a literal prefix */
+struct tar_trie
+{
+	char tt_c;
+	struct tar_trie *tt_child;
+	struct tar_trie *tt_sibling;
+	tar_glob_t *tt_globs;	/* globs whose prefix ends here */
+};
+typedef struct tar_trie tar_trie_t;
+
+struct tar_matcher
+{
+	libtar_hash_t *tm_literals;
+	unsigned int tm_nliterals;
+	unsigned int tm_nfound;
+	unsigned int tm_nglobs;
+	tar_trie_t tm_root;
+};
+
+
+/* hashing function for literal paths */
+static unsigned int
+literal_hash(tar_literal_t *tl, unsigned int numbuckets)
+{
+	unsigned int h = 0;
+	const char *p;
+
+	for (p = tl->tl_path; *p != '\0'; p++)
+		h = h * 33 + (unsigned char)*p;
+
+	return h % numbuckets;
+}
+
+
+/* matching function for literal paths */
+static int
+literal_match(tar_literal_t *key, tar_literal_t *tl)
+{
+	return (strcmp(key->tl_path, tl->tl_path) == 0);
+}
+
+
+static void
+literal_free(tar_literal_t *tl)
+{
+	free(tl->tl_path);
+	free(tl);
+}
+
+
+static tar_literal_t *
+literal_find(tar_matcher_t *m, const char *path)
+{
+	libtar_hashptr_t hp;
+	tar_literal_t key;
+
+	if (m->tm_literals == NULL)
+		return NULL;
+
+	key.tl_path = (char *)path;
+	libtar_hashptr_reset(&hp);
+	if (!libtar_hash_getkey(m->tm_literals, &hp, &key,
+				(libtar_matchfunc_t)literal_match))
+		return NULL;
+
+	return (tar_literal_t *)libtar_hashptr_data(&hp);
+}
+
+
+static void
+trie_free(tar_trie_t *tt)
+{
+	tar_trie_t *child, *next;
+	tar_glob_t *tg, *tgnext;
+
+	for (tg = tt->tt_globs; tg != NULL; tg = tgnext)
+	{
+		tgnext = tg->tg_next;
+		free(tg->tg_pattern);
+		free(tg);
+	}
+
+	for (child = tt->tt_child; child != NULL; child = next)
+	{
+		next = child->tt_sibling;
+		trie_free(child);
+		free(child);
+	}
+}
+
+
+tar_matcher_t *
+tar_matcher_new(void)
+{
+	return (tar_matcher_t *)calloc(1, sizeof(tar_matcher_t));
+}
+
+
+void
+tar_matcher_free(tar_matcher_t *m)
+{
+	if (m->tm_literals != NULL)
+		libtar_hash_free(m->tm_literals,
+				 (libtar_freefunc_t)literal_free);
+	trie_free(&(m->tm_root));
+	free(m);
+}
+
+
+/*
+** add a pattern to m; it is treated as a glob if it contains a wildcard,
+** unless literal is set.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+tar_matcher_add(tar_matcher_t *m, const char *pattern, int literal)
+{
+	tar_literal_t *tl;
+	tar_glob_t *tg;
+	tar_trie_t *tt, *child;
+	size_t i, prefixlen;
+
+	if (literal || strpbrk(pattern, GLOB_CHARS) == NULL)
+	{
+		if (literal_find(m, pattern) != NULL)
+			return 0;
+
+		if (m->tm_literals == NULL)
+		{
+			m->tm_literals = libtar_hash_new(MATCH_BUCKETS,
+					(libtar_hashfunc_t)literal_hash);
+			if (m->tm_literals == NULL)
+				return -1;
+		}
+
+		tl = (tar_literal_t *)calloc(1, sizeof(tar_literal_t));
+		if (tl == NULL)
+			return -1;
+		tl->tl_path = strdup(pattern);
+		if (tl->tl_path == NULL || libtar_hash_add(m->tm_literals, tl) != 0)
+		{
+			free(tl->tl_path);
+			free(tl);
+			return -1;
+		}
+		m->tm_nliterals++;
+		return 0;
+	}
+
+	/* file the glob under its literal prefix */
+	prefixlen = strcspn(pattern, GLOB_CHARS);
+	for (tt = &(m->tm_root), i = 0; i < prefixlen; i++, tt = child)
+	{
+		for (child = tt->tt_child; child != NULL;
+		     child = child->tt_sibling)
+			if (child->tt_c == pattern[i])
+				break;
+		if (child == NULL)
+		{
+			child = (tar_trie_t *)calloc(1, sizeof(tar_trie_t));
+			if (child == NULL)
+				return -1;
+			child->tt_c = pattern[i];
+			child->tt_sibling = tt->tt_child;
+			tt->tt_child = child;
+		}
+	}
+
+	tg = (tar_glob_t *)calloc(1, sizeof(tar_glob_t));
+	if (tg == NULL)
+		return -1;
+	tg->tg_pattern = strdup(pattern);
+	if (tg->tg_pattern == NULL)
+	{
+		free(tg);
+		return -1;
+	}
+	tg->tg_next = tt->tt_globs;
+	tt->tt_globs = tg;
+	m->tm_nglobs++;
+
+	return 0;
+}
+
+
+/*
+** returns:
+**	1	pathname matches one of the patterns in m
+**	0	it doesn't
+*/
+int
+tar_matcher_match(tar_matcher_t *m, const char *pathname)
+{
+	tar_literal_t *tl;
+	tar_trie_t *tt;
+	tar_glob_t *tg;
+	const char *p;
+
+	tl = literal_find(m, pathname);
+	if (tl != NULL)
+	{
+		if (!tl->tl_found)
+		{
+			tl->tl_found = 1;
+			m->tm_nfound++;
+		}
+		return 1;
+	}
+
+	for (tt = &(m->tm_root), p = pathname; tt != NULL; p++)
+	{
+		for (tg = tt->tt_globs; tg != NULL; tg = tg->tg_next)
+			if (fnmatch(tg->tg_pattern, pathname,
+				    FNM_PATHNAME | FNM_PERIOD) == 0)
+				return 1;
+
+		if (*p == '\0')
+			break;
+		for (tt = tt->tt_child; tt != NULL; tt = tt->tt_sibling)
+			if (tt->tt_c == *p)
+				break;
+	}
+
+	return 0;
+}
+
+
+/* has every literal been matched, with no globs left to match more? */
+int
+tar_matcher_done(tar_matcher_t *m)
+{
+	return (m->tm_nglobs == 0 && m->tm_nliterals > 0
+		&& m->tm_nfound == m->tm_nliterals);
+}
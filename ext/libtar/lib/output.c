@@ -13,8 +13,6 @@
 #include <internal.h>
 
 #include <stdio.h>
-#include <pwd.h>
-#include <grp.h>
 #include <time.h>
 #include <limits.h>
 #include <sys/param.h>
@@ -56,24 +54,37 @@ th_print(TAR *t)
 	       (t->th_buf.gnu_longname ? t->th_buf.gnu_longname : "[NULL]"));
 	printf("  gnu_longlink = \"%s\"\n",
 	       (t->th_buf.gnu_longlink ? t->th_buf.gnu_longlink : "[NULL]"));
+	if (t->th_buf.pax.flags & TAR_PAX_PATH)
+		printf("  pax path = \"%s\"\n", t->th_buf.pax.path);
+	if (t->th_buf.pax.flags & TAR_PAX_LINKPATH)
+		printf("  pax linkpath = \"%s\"\n", t->th_buf.pax.linkpath);
+	if (t->th_buf.pax.flags & TAR_PAX_SIZE)
+		printf("  pax size = %lld\n", (long long)t->th_buf.pax.size);
+	if (t->th_buf.pax.flags & TAR_PAX_MTIME)
+		printf("  pax mtime = %lld.%09ld\n",
+		       (long long)t->th_buf.pax.mtime, t->th_buf.pax.mtime_nsec);
+	if (t->th_buf.pax.flags & TAR_PAX_UID)
+		printf("  pax uid = %lu\n", t->th_buf.pax.uid);
+	if (t->th_buf.pax.flags & TAR_PAX_GID)
+		printf("  pax gid = %lu\n", t->th_buf.pax.gid);
+	if (t->th_buf.pax.flags & TAR_PAX_UNAME)
+		printf("  pax uname = \"%s\"\n", t->th_buf.pax.uname);
+	if (t->th_buf.pax.flags & TAR_PAX_GNAME)
+		printf("  pax gname = \"%s\"\n", t->th_buf.pax.gname);
 }
 
 
 void
 th_print_long_ls(TAR *t)
 {
-	char *filename;
 	char modestring[12];
-#ifndef _WIN32
-	struct passwd *pw;
-	struct group *gr;
-#endif
+	const char *name;
 	uid_t uid;
 	gid_t gid;
 	char username[_POSIX_LOGIN_NAME_MAX];
 	char groupname[_POSIX_LOGIN_NAME_MAX];
 	time_t mtime;
-	struct tm *mtm;
+	struct tm tmbuf, *mtm;
 
 #ifdef HAVE_STRFTIME
 	char timebuf[18];
@@ -85,36 +96,33 @@ th_print_long_ls(TAR *t)
 #endif
 
 	uid = th_get_uid(t);
-#ifndef _WIN32
-	pw = getpwuid(uid);
-	if (pw == NULL)
+	name = tar_owner_name(t, TAR_OWNER_USER, uid);
+	if (name == NULL)
 		snprintf(username, sizeof(username), "%d", uid);
 	else
-		strlcpy(username, pw->pw_name, sizeof(username));
-#else
-	snprintf(username, sizeof(username), "%d", uid);
-#endif
+		strlcpy(username, name, sizeof(username));
 
 	gid = th_get_gid(t);
-#ifndef _WIN32
-	gr = getgrgid(gid);
-	if (gr == NULL)
+	name = tar_owner_name(t, TAR_OWNER_GROUP, gid);
+	if (name == NULL)
 		snprintf(groupname, sizeof(groupname), "%d", gid);
 	else
-		strlcpy(groupname, gr->gr_name, sizeof(groupname));
-#else
-	snprintf(groupname, sizeof(groupname), "%d", gid);
-#endif
+		strlcpy(groupname, name, sizeof(groupname));
 	strmode(th_get_mode(t), modestring);
 	printf("%.10s %-8.8s %-8.8s ", modestring, username, groupname);
 
 	if (TH_ISCHR(t) || TH_ISBLK(t))
-		printf(" %3d, %3d ", th_get_devmajor(t), th_get_devminor(t));
+		printf(" %3lu, %3lu ", th_get_devmajor(t), th_get_devminor(t));
 	else
-		printf("%9ld ", (long)th_get_size(t));
+		printf("%9lld ", (long long)th_get_size(t));
 
 	mtime = th_get_mtime(t);
-	mtm = localtime(&mtime);
+#ifdef _WIN32
+	localtime_s(&tmbuf, &mtime);
+#else
+	localtime_r(&mtime, &tmbuf);
+#endif
+	mtm = &tmbuf;
 #ifdef HAVE_STRFTIME
 	strftime(timebuf, sizeof(timebuf), "%h %e %H:%M %Y", mtm);
 	printf("%s", timebuf);
@@ -124,9 +132,7 @@ th_print_long_ls(TAR *t)
 	       mtm->tm_mday, mtm->tm_hour, mtm->tm_min, mtm->tm_year + 1900);
 #endif
 
-	filename = th_get_pathname(t);
-	printf(" %s", filename);
-	free(filename);
+	printf(" %s", th_get_pathname(t));
 
 	if (TH_ISSYM(t) || TH_ISLNK(t))
 	{
@@ -134,10 +140,7 @@ th_print_long_ls(TAR *t)
 			printf(" -> ");
 		else
 			printf(" link to ");
-		if ((t->options & TAR_GNU) && t->th_buf.gnu_longlink != NULL)
-			printf("%s", t->th_buf.gnu_longlink);
-		else
-			printf("%.100s", t->th_buf.linkname);
+		printf("%s", th_get_linkname(t));
 	}
 
 	putchar('\n');
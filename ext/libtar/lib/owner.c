@@ -0,0 +1,272 @@
+/*
+**  owner.c - libtar code to map uids and gids to user and group names
+**
+**  Every lookup goes through the password and group databases, which
+**  may be backed by a network service.  Archives usually contain only
+**  a handful of owners, so the results (including failed lookups) are
+**  remembered in two hashes on the TAR handle, one keyed by id and one
+**  by name.  With TAR_NUMERIC_OWNER no lookups are made at all.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+
+#define OWNER_BUCKETS		64
+
+/* first and largest buffer size for the getpw*_r()/getgr*_r() calls */
+#define OWNER_BUFSIZE		1024
+#define OWNER_MAXBUFSIZE	(1024 * 1024)
+
+/* id of a name that the lookup didn't find */
+#define OWNER_NONE		((unsigned long)-1)
+
+struct tar_owner
+{
+	int to_kind;		/* TAR_OWNER_USER or TAR_OWNER_GROUP */
+	unsigned long to_id;
+	char *to_name;		/* NULL if the lookup failed */
+};
+typedef struct tar_owner tar_owner_t;
+
+
+/* hashing function for owners looked up by id */
+static unsigned int
+owner_id_hash(tar_owner_t *to, unsigned int numbuckets)
+{
+	return (unsigned int)((to->to_id * 2 + to->to_kind) % numbuckets);
+}
+
+
+/* matching function for owners looked up by id */
+static int
+owner_id_match(tar_owner_t *key, tar_owner_t *to)
+{
+	return (key->to_kind == to->to_kind && key->to_id == to->to_id);
+}
+
+
+/* hashing function for owners looked up by name */
+static unsigned int
+owner_name_hash(tar_owner_t *to, unsigned int numbuckets)
+{
+	unsigned int h = to->to_kind;
+	const char *p;
+
+	for (p = to->to_name; *p != '\0'; p++)
+		h = h * 33 + (unsigned char)*p;
+
+	return h % numbuckets;
+}
+
+
+/* matching function for owners looked up by name */
+static int
+owner_name_match(tar_owner_t *key, tar_owner_t *to)
+{
+	return (key->to_kind == to->to_kind
+		&& strcmp(key->to_name, to->to_name) == 0);
+}
+
+
+static void
+owner_free(tar_owner_t *to)
+{
+	if (to->to_name != NULL)
+		free(to->to_name);
+	free(to);
+}
+
+
+/* add an entry to *hp, creating the hash on first use; name is taken over */
+static tar_owner_t *
+owner_add(libtar_hash_t **hp, libtar_hashfunc_t hashfunc, int kind,
+	  unsigned long id, char *name)
+{
+	tar_owner_t *to;
+
+	if (*hp == NULL)
+	{
+		*hp = libtar_hash_new(OWNER_BUCKETS, hashfunc);
+		if (*hp == NULL)
+			goto fail;
+	}
+
+	to = (tar_owner_t *)calloc(1, sizeof(tar_owner_t));
+	if (to == NULL)
+		goto fail;
+	to->to_kind = kind;
+	to->to_id = id;
+	to->to_name = name;
+
+	if (libtar_hash_add(*hp, to) != 0)
+	{
+		owner_free(to);
+		return NULL;
+	}
+
+	return to;
+
+  fail:
+	if (name != NULL)
+		free(name);
+	return NULL;
+}
+
+
+/*
+** look up a user or group by name, or by *id if name is NULL; on success
+** *id and *namep (malloc'd, if namep isn't NULL) are set.  the _r
+** functions keep the result out of static storage, so separate handles
+** can be used from separate threads.
+*/
+static int
+owner_lookup(int kind, const char *name, unsigned long *id, char **namep)
+{
+#ifndef _WIN32
+	struct passwd pw, *pwp = NULL;
+	struct group gr, *grp = NULL;
+	char *buf = NULL, *ptr;
+	size_t bufsize = OWNER_BUFSIZE;
+	const char *found = NULL;
+	int i = 0;
+
+	do
+	{
+		ptr = (char *)realloc(buf, bufsize);
+		if (ptr == NULL)
+			break;
+		buf = ptr;
+
+		if (kind == TAR_OWNER_USER)
+			i = (name != NULL
+			     ? getpwnam_r(name, &pw, buf, bufsize, &pwp)
+			     : getpwuid_r((uid_t)*id, &pw, buf, bufsize, &pwp));
+		else
+			i = (name != NULL
+			     ? getgrnam_r(name, &gr, buf, bufsize, &grp)
+			     : getgrgid_r((gid_t)*id, &gr, buf, bufsize, &grp));
+		bufsize *= 4;
+	}
+	while (i == ERANGE && bufsize <= OWNER_MAXBUFSIZE);
+
+	if (pwp != NULL)
+	{
+		*id = pwp->pw_uid;
+		found = pwp->pw_name;
+	}
+	else if (grp != NULL)
+	{
+		*id = grp->gr_gid;
+		found = grp->gr_name;
+	}
+	if (found != NULL && namep != NULL)
+		*namep = strdup(found);
+
+	if (buf != NULL)
+		free(buf);
+	return (found != NULL ? 0 : -1);
+#else
+	return -1;
+#endif
+}
+
+
+/* user or group name for id, or NULL if there is none */
+const char *
+tar_owner_name(TAR *t, int kind, unsigned long id)
+{
+	libtar_hashptr_t hp;
+	tar_owner_t key, *to;
+	char *name = NULL;
+
+	if (t->options & TAR_NUMERIC_OWNER)
+		return NULL;
+
+	key.to_kind = kind;
+	key.to_id = id;
+	if (t->owner_ids != NULL)
+	{
+		libtar_hashptr_reset(&hp);
+		if (libtar_hash_getkey(t->owner_ids, &hp, &key,
+				       (libtar_matchfunc_t)owner_id_match))
+			return ((tar_owner_t *)libtar_hashptr_data(&hp))->to_name;
+	}
+
+	owner_lookup(kind, NULL, &id, &name);
+#ifdef DEBUG
+	printf("    tar_owner_name(): %s %lu is \"%s\"\n",
+	       (kind == TAR_OWNER_USER ? "uid" : "gid"), id,
+	       (name ? name : "(null)"));
+#endif
+
+	to = owner_add(&(t->owner_ids), (libtar_hashfunc_t)owner_id_hash,
+		       kind, id, name);
+	return (to != NULL ? to->to_name : NULL);
+}
+
+
+/* uid or gid for the user or group name; returns -1 if there is none */
+int
+tar_owner_id(TAR *t, int kind, const char *name, unsigned long *id)
+{
+	libtar_hashptr_t hp;
+	tar_owner_t key, *to;
+	char *copy;
+	int found;
+
+	if ((t->options & TAR_NUMERIC_OWNER) || name == NULL || *name == '\0')
+		return -1;
+
+	key.to_kind = kind;
+	key.to_name = (char *)name;
+	if (t->owner_names != NULL)
+	{
+		libtar_hashptr_reset(&hp);
+		if (libtar_hash_getkey(t->owner_names, &hp, &key,
+				       (libtar_matchfunc_t)owner_name_match))
+		{
+			to = (tar_owner_t *)libtar_hashptr_data(&hp);
+			if (to->to_id == OWNER_NONE)
+				return -1;
+			*id = to->to_id;
+			return 0;
+		}
+	}
+
+	found = (owner_lookup(kind, name, id, NULL) == 0);
+	if (!found)
+		*id = OWNER_NONE;
+#ifdef DEBUG
+	printf("    tar_owner_id(): %s \"%s\" is %ld\n",
+	       (kind == TAR_OWNER_USER ? "user" : "group"), name,
+	       (found ? (long)*id : -1L));
+#endif
+
+	copy = strdup(name);
+	if (copy != NULL)
+		owner_add(&(t->owner_names), (libtar_hashfunc_t)owner_name_hash,
+			  kind, *id, copy);
+	return (found ? 0 : -1);
+}
+
+
+/* free the owner caches of t */
+void
+tar_owner_free(TAR *t)
+{
+	if (t->owner_ids != NULL)
+		libtar_hash_free(t->owner_ids, (libtar_freefunc_t)owner_free);
+	if (t->owner_names != NULL)
+		libtar_hash_free(t->owner_names, (libtar_freefunc_t)owner_free);
+	t->owner_ids = t->owner_names = NULL;
+}
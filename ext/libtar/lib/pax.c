@@ -0,0 +1,576 @@
+/*
+**  pax.c - libtar code to read and write POSIX.1-2001 pax extended headers
+**
+**  The records of an extended header have the form "%d %s=%s\n", where
+**  the leading decimal is the length of the whole record.  They are
+**  parsed in place: the values returned in struct tar_pax point into
+**  the record buffers owned by the TAR handle, which are reused from
+**  one member to the next.  The values of 'g' headers apply to every
+**  member that follows, so they are copied into t->pax_global.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef STDC_HEADERS
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+
+/* refuse extended headers larger than this */
+#define PAX_MAXSIZE		(16 * 1024 * 1024)
+
+
+/* parse a signed decimal value, optionally followed by a fraction */
+static int
+pax_parse_number(char *val, tar_off_t *num, long *nsec)
+{
+	tar_off_t n = 0;
+	long frac = 0;
+	int neg = 0, digits = 0;
+
+	if (*val == '-')
+	{
+		neg = 1;
+		val++;
+	}
+	if (*val < '0' || *val > '9')
+		return -1;
+	for (; *val >= '0' && *val <= '9'; val++)
+		n = n * 10 + (*val - '0');
+
+	if (*val == '.' && nsec != NULL)
+	{
+		for (val++; *val >= '0' && *val <= '9'; val++)
+			if (digits < 9)
+			{
+				frac = frac * 10 + (*val - '0');
+				digits++;
+			}
+		for (; digits < 9; digits++)
+			frac *= 10;
+	}
+	if (*val != '\0' && *val != '.')
+		return -1;
+
+	if (neg && frac != 0)
+	{
+		/* -1.25 is 2 seconds before the epoch plus 750ms */
+		n++;
+		frac = 1000000000L - frac;
+	}
+	*num = (neg ? -n : n);
+	if (nsec != NULL)
+		*nsec = frac;
+	return 0;
+}
+
+
+/* apply a single record; an empty value removes the key */
+static void
+pax_set(struct tar_pax *p, char *key, char *val)
+{
+	tar_off_t num;
+	long nsec;
+	int flag = 0;
+
+	switch (key[0])
+	{
+	case 'p':
+		if (strcmp(key, "path") == 0)
+		{
+			flag = TAR_PAX_PATH;
+			p->path = val;
+		}
+		break;
+	case 'l':
+		if (strcmp(key, "linkpath") == 0)
+		{
+			flag = TAR_PAX_LINKPATH;
+			p->linkpath = val;
+		}
+		break;
+	case 's':
+		if (strcmp(key, "size") == 0)
+		{
+			flag = TAR_PAX_SIZE;
+			if (*val && pax_parse_number(val, &num, NULL) == 0)
+				p->size = num;
+		}
+		break;
+	case 'm':
+		if (strcmp(key, "mtime") == 0)
+		{
+			flag = TAR_PAX_MTIME;
+			if (*val && pax_parse_number(val, &num, &nsec) == 0)
+			{
+				p->mtime = num;
+				p->mtime_nsec = nsec;
+			}
+		}
+		break;
+	case 'u':
+		if (strcmp(key, "uid") == 0)
+		{
+			flag = TAR_PAX_UID;
+			if (*val && pax_parse_number(val, &num, NULL) == 0)
+				p->uid = (unsigned long)num;
+		}
+		else if (strcmp(key, "uname") == 0)
+		{
+			flag = TAR_PAX_UNAME;
+			p->uname = val;
+		}
+		break;
+	case 'G':
+		/* formats 0.1 and 1.0 of GNU tar's sparse files */
+		if (strncmp(key, "GNU.sparse.", 11) != 0)
+			break;
+		key += 11;
+		flag = TAR_PAX_SPARSE;
+		if (strcmp(key, "major") == 0)
+		{
+			if (*val && pax_parse_number(val, &num, NULL) == 0)
+				p->sparse_major = (int)num;
+		}
+		else if (strcmp(key, "name") == 0)
+			p->sparse_name = val;
+		else if (strcmp(key, "realsize") == 0
+			 || strcmp(key, "size") == 0)
+		{
+			if (*val && pax_parse_number(val, &num, NULL) == 0)
+				p->sparse_realsize = num;
+		}
+		else if (strcmp(key, "map") == 0)
+			p->sparse_map = val;
+		else
+			flag = 0;
+		if (flag != 0 && *val != '\0')
+			p->flags |= flag;
+		p->local |= flag;
+		return;
+	case 'g':
+		if (strcmp(key, "gid") == 0)
+		{
+			flag = TAR_PAX_GID;
+			if (*val && pax_parse_number(val, &num, NULL) == 0)
+				p->gid = (unsigned long)num;
+		}
+		else if (strcmp(key, "gname") == 0)
+		{
+			flag = TAR_PAX_GNAME;
+			p->gname = val;
+		}
+		break;
+	}
+
+	/* atime, ctime, charset, comment, vendor keys etc. are ignored */
+	if (*val != '\0')
+		p->flags |= flag;
+	else
+		p->flags &= ~flag;
+	p->local |= flag;
+}
+
+
+/* parse the records of a pax extended header into p */
+int
+th_pax_parse(char *buf, size_t len, struct tar_pax *p)
+{
+	char *rec, *end, *key, *val, *nl;
+	size_t reclen;
+
+	for (rec = buf, end = buf + len; rec < end && *rec != '\0'; rec = nl + 1)
+	{
+		reclen = 0;
+		for (key = rec; key < end && *key >= '0' && *key <= '9'; key++)
+		{
+			reclen = reclen * 10 + (*key - '0');
+			if (reclen > len)
+				break;
+		}
+		if (key == rec || key >= end || *key != ' '
+		    || reclen > (size_t)(end - rec)
+		    || reclen < (size_t)(key - rec) + 3)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		nl = rec + reclen - 1;
+		if (*nl != '\n')
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		*nl = '\0';
+
+		key++;
+		val = strchr(key, '=');
+		if (val == NULL || val == key)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		*val++ = '\0';
+
+#ifdef DEBUG
+		printf("    th_pax_parse(): %s=\"%s\"\n", key, val);
+#endif
+		pax_set(p, key, val);
+	}
+
+	return 0;
+}
+
+
+/* replace a string of the global values with a copy of val, or with none */
+static int
+pax_global_str(char **dst, const char *val)
+{
+	char *str = NULL;
+
+	if (val != NULL && (str = strdup(val)) == NULL)
+		return -1;
+	if (*dst != NULL)
+		free(*dst);
+	*dst = str;
+	return 0;
+}
+
+
+/*
+** apply the records of a 'g' header, parsed into g, on top of the global
+** values: the keys it carries replace or remove theirs, the others stay.
+** the strings are copied, since the next 'g' header reuses the buffer
+** that g points into.
+*/
+static int
+pax_global_merge(struct tar_pax *glob, struct tar_pax *g)
+{
+	int set = g->local;
+
+#define PAX_GLOBAL_STR(flag, field) \
+	((set & (flag)) \
+	 && pax_global_str(&(glob->field), \
+			   (g->flags & (flag)) ? g->field : NULL) != 0)
+
+	if (PAX_GLOBAL_STR(TAR_PAX_PATH, path)
+	    || PAX_GLOBAL_STR(TAR_PAX_LINKPATH, linkpath)
+	    || PAX_GLOBAL_STR(TAR_PAX_UNAME, uname)
+	    || PAX_GLOBAL_STR(TAR_PAX_GNAME, gname)
+	    || PAX_GLOBAL_STR(TAR_PAX_SPARSE, sparse_name)
+	    || PAX_GLOBAL_STR(TAR_PAX_SPARSE, sparse_map))
+		return -1;
+
+#undef PAX_GLOBAL_STR
+
+	if (set & TAR_PAX_SIZE)
+		glob->size = g->size;
+	if (set & TAR_PAX_MTIME)
+	{
+		glob->mtime = g->mtime;
+		glob->mtime_nsec = g->mtime_nsec;
+	}
+	if (set & TAR_PAX_UID)
+		glob->uid = g->uid;
+	if (set & TAR_PAX_GID)
+		glob->gid = g->gid;
+	if (set & TAR_PAX_SPARSE)
+	{
+		glob->sparse_major = g->sparse_major;
+		glob->sparse_realsize = g->sparse_realsize;
+	}
+	glob->flags = (glob->flags & ~set) | (g->flags & set);
+	return 0;
+}
+
+
+/*
+** give the member being read the global values for every key its 'x'
+** header did not set or remove; p->local tells which ones it did.
+*/
+static void
+pax_inherit(struct tar_pax *p, struct tar_pax *glob)
+{
+	struct tar_pax x = *p;
+
+	*p = *glob;
+	p->local = x.local;
+	p->flags = (glob->flags & ~x.local) | (x.flags & x.local);
+
+	if (x.local & TAR_PAX_PATH)
+		p->path = x.path;
+	if (x.local & TAR_PAX_LINKPATH)
+		p->linkpath = x.linkpath;
+	if (x.local & TAR_PAX_SIZE)
+		p->size = x.size;
+	if (x.local & TAR_PAX_MTIME)
+	{
+		p->mtime = x.mtime;
+		p->mtime_nsec = x.mtime_nsec;
+	}
+	if (x.local & TAR_PAX_UID)
+		p->uid = x.uid;
+	if (x.local & TAR_PAX_GID)
+		p->gid = x.gid;
+	if (x.local & TAR_PAX_UNAME)
+		p->uname = x.uname;
+	if (x.local & TAR_PAX_GNAME)
+		p->gname = x.gname;
+	if (x.local & TAR_PAX_SPARSE)
+	{
+		p->sparse_major = x.sparse_major;
+		p->sparse_realsize = x.sparse_realsize;
+		p->sparse_name = x.sparse_name;
+		p->sparse_map = x.sparse_map;
+	}
+}
+
+
+/* free the strings of the global values */
+void
+th_pax_global_free(TAR *t)
+{
+	struct tar_pax *glob = &(t->pax_global);
+
+	if (glob->path != NULL)
+		free(glob->path);
+	if (glob->linkpath != NULL)
+		free(glob->linkpath);
+	if (glob->uname != NULL)
+		free(glob->uname);
+	if (glob->gname != NULL)
+		free(glob->gname);
+	if (glob->sparse_name != NULL)
+		free(glob->sparse_name);
+	if (glob->sparse_map != NULL)
+		free(glob->sparse_map);
+	memset(glob, 0, sizeof(struct tar_pax));
+}
+
+
+/* read the records of the 'x' or 'g' header in t->th_buf */
+int
+th_pax_read(TAR *t)
+{
+	tar_off_t sz;
+	size_t j, need;
+	char **bufp, *ptr;
+	size_t *sizep;
+	struct tar_pax g;
+	int i;
+
+	sz = oct_to_size(t->th_buf.size, sizeof(t->th_buf.size));
+	if (sz < 0 || sz > PAX_MAXSIZE)
+	{
+		errno = EINVAL;
+		return tar_fail(t);
+	}
+	j = ((size_t)sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
+
+	if (TH_ISPAXGLOBAL(t))
+	{
+		bufp = &(t->pax_gbuf);
+		sizep = &(t->pax_gbufsize);
+	}
+	else
+	{
+		bufp = &(t->pax_buf);
+		sizep = &(t->pax_bufsize);
+	}
+
+	/* the buffers only ever grow, so most headers cost no allocation */
+	need = j * T_BLOCKSIZE + 1;
+	if (*sizep < need)
+	{
+		ptr = (char *)realloc(*bufp, need);
+		if (ptr == NULL)
+			return tar_fail(t);
+		*bufp = ptr;
+		*sizep = need;
+	}
+
+#ifdef DEBUG
+	printf("    th_pax_read(): pax %s header detected "
+	       "(%ld bytes, %d blocks)\n",
+	       (TH_ISPAXGLOBAL(t) ? "global" : "extended"), (long)sz, (int)j);
+#endif
+	for (ptr = *bufp; j > 0; j--, ptr += T_BLOCKSIZE)
+	{
+		i = tar_block_read(t, ptr);
+		if (i != T_BLOCKSIZE)
+		{
+			if (i != -1)
+				errno = EINVAL;
+			return tar_fail(t);
+		}
+	}
+	(*bufp)[sz] = '\0';
+
+	if (TH_ISPAXGLOBAL(t))
+	{
+		memset(&g, 0, sizeof(g));
+		if (th_pax_parse(t->pax_gbuf, (size_t)sz, &g) != 0
+		    || pax_global_merge(&(t->pax_global), &g) != 0)
+			return tar_fail(t);
+		pax_inherit(&(t->th_buf.pax), &(t->pax_global));
+		return 0;
+	}
+
+	return th_pax_parse(t->pax_buf, (size_t)sz, &(t->th_buf.pax));
+}
+
+
+/* append a record to t->pax_buf at *off */
+static int
+pax_add(TAR *t, size_t *off, const char *key, const char *val)
+{
+	size_t base, len, digits, n, need;
+	char *ptr;
+
+	/* the length prefix counts its own digits */
+	base = strlen(key) + strlen(val) + 3;
+	for (len = base + 1; ; len++)
+	{
+		for (digits = 0, n = len; n > 0; n /= 10)
+			digits++;
+		if (base + digits == len)
+			break;
+	}
+
+	need = *off + len + T_BLOCKSIZE;
+	if (t->pax_bufsize < need)
+	{
+		ptr = (char *)realloc(t->pax_buf, need);
+		if (ptr == NULL)
+			return tar_fail(t);
+		t->pax_buf = ptr;
+		t->pax_bufsize = need;
+	}
+
+	*off += sprintf(t->pax_buf + *off, "%lu %s=%s\n", (unsigned long)len,
+			key, val);
+	return 0;
+}
+
+
+/* write an 'x' header for the fields that don't fit in t->th_buf */
+int
+th_pax_write(TAR *t)
+{
+	struct tar_pax *p = &(t->th_buf.pax);
+	char num[48];
+	char size2[sizeof(t->th_buf.size)];
+	char type2;
+	size_t off = 0;
+	size_t j;
+	char *ptr;
+	int i;
+
+	if (t->th_buf.gnu_longname != NULL
+	    && pax_add(t, &off, "path", t->th_buf.gnu_longname) != 0)
+		return tar_fail(t);
+	if (t->th_buf.gnu_longlink != NULL
+	    && pax_add(t, &off, "linkpath", t->th_buf.gnu_longlink) != 0)
+		return tar_fail(t);
+	if (p->flags & TAR_PAX_SIZE)
+	{
+		sprintf(num, "%lld", (long long)p->size);
+		if (pax_add(t, &off, "size", num) != 0)
+			return tar_fail(t);
+	}
+	if (p->flags & TAR_PAX_MTIME)
+	{
+		if (p->mtime_nsec != 0 && p->mtime < 0)
+		{
+			sprintf(num, "-%lld.%09ld", -(long long)(p->mtime + 1),
+				1000000000L - p->mtime_nsec);
+			for (i = strlen(num); num[i - 1] == '0'; i--)
+				num[i - 1] = '\0';
+		}
+		else if (p->mtime_nsec != 0)
+		{
+			sprintf(num, "%lld.%09ld", (long long)p->mtime,
+				p->mtime_nsec);
+			for (i = strlen(num); num[i - 1] == '0'; i--)
+				num[i - 1] = '\0';
+		}
+		else
+			sprintf(num, "%lld", (long long)p->mtime);
+		if (pax_add(t, &off, "mtime", num) != 0)
+			return tar_fail(t);
+	}
+	if (p->flags & TAR_PAX_UID)
+	{
+		sprintf(num, "%lu", p->uid);
+		if (pax_add(t, &off, "uid", num) != 0)
+			return tar_fail(t);
+	}
+	if (p->flags & TAR_PAX_GID)
+	{
+		sprintf(num, "%lu", p->gid);
+		if (pax_add(t, &off, "gid", num) != 0)
+			return tar_fail(t);
+	}
+	if ((p->flags & TAR_PAX_UNAME)
+	    && pax_add(t, &off, "uname", p->uname) != 0)
+		return tar_fail(t);
+	if ((p->flags & TAR_PAX_GNAME)
+	    && pax_add(t, &off, "gname", p->gname) != 0)
+		return tar_fail(t);
+	if (p->flags & TAR_PAX_SPARSE)
+	{
+		/* format 1.0: the map is at the start of the contents */
+		sprintf(num, "%lld", (long long)p->sparse_realsize);
+		if (pax_add(t, &off, "GNU.sparse.major", "1") != 0
+		    || pax_add(t, &off, "GNU.sparse.minor", "0") != 0
+		    || pax_add(t, &off, "GNU.sparse.name", p->sparse_name) != 0
+		    || pax_add(t, &off, "GNU.sparse.realsize", num) != 0)
+			return tar_fail(t);
+	}
+
+	if (off == 0)
+		return 0;
+
+#ifdef DEBUG
+	printf("th_pax_write(): writing %d bytes of pax records\n", (int)off);
+#endif
+
+	/* write out the extended header with fake size and type */
+	type2 = t->th_buf.typeflag;
+	memcpy(size2, t->th_buf.size, sizeof(size2));
+	t->th_buf.typeflag = PAX_HEADER_TYPE;
+	size_to_oct(off, t->th_buf.size, sizeof(t->th_buf.size));
+	th_finish(t);
+	i = tar_block_write(t, &(t->th_buf));
+	if (i != T_BLOCKSIZE)
+	{
+		if (i != -1)
+			errno = EINVAL;
+		return tar_fail(t);
+	}
+
+	/* write out the records, zero-padded to a full block */
+	j = (off / T_BLOCKSIZE) + (off % T_BLOCKSIZE ? 1 : 0);
+	memset(t->pax_buf + off, 0, j * T_BLOCKSIZE - off);
+	for (ptr = t->pax_buf; j > 0; j--, ptr += T_BLOCKSIZE)
+	{
+		i = tar_block_write(t, ptr);
+		if (i != T_BLOCKSIZE)
+		{
+			if (i != -1)
+				errno = EINVAL;
+			return tar_fail(t);
+		}
+	}
+
+	/* reset type and size to original values */
+	t->th_buf.typeflag = type2;
+	memcpy(t->th_buf.size, size2, sizeof(size2));
+
+	return 0;
+}
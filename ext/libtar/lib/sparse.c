@@ -0,0 +1,505 @@
+/*
+**  sparse.c - libtar code to read and write GNU sparse members
+**
+**  A sparse member stores only the data regions of a file, with a map
+**  of where they go.  Old GNU archives keep the map in an 'S' header
+**  and the extension blocks after it; pax archives (format 1.0) name
+**  the real file in GNU.sparse.* records and put the map, as decimal
+**  lines padded to a block, at the start of the contents.  Format 0.1,
+**  with the map in a GNU.sparse.map record, is understood when reading.
+*/
+
+/* for SEEK_DATA and SEEK_HOLE */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+
+/* where the map lives in an old GNU header and its extension blocks */
+#define GNU_SPARSE_OFFSET	386
+#define GNU_ISEXTENDED_OFFSET	482
+#define GNU_REALSIZE_OFFSET	483
+#define GNU_SPARSE_ENTRIES	4
+#define GNU_EXT_ENTRIES		21
+#define GNU_EXT_ISEXTENDED	504
+#define GNU_ENTRY_SIZE		24
+
+
+/* append a region to t->sparse_map at index *np */
+static int
+sparse_add(TAR *t, size_t *np, tar_off_t offset, tar_off_t numbytes)
+{
+	struct tar_sparse *map;
+	size_t n;
+
+	if (offset < 0 || numbytes < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the map only ever grows, so most members cost no allocation */
+	if (*np == t->sparse_alloc)
+	{
+		n = (t->sparse_alloc ? t->sparse_alloc * 2 : 16);
+		map = (struct tar_sparse *)realloc(t->sparse_map,
+					n * sizeof(struct tar_sparse));
+		if (map == NULL)
+			return -1;
+		t->sparse_map = map;
+		t->sparse_alloc = n;
+	}
+
+	t->sparse_map[*np].offset = offset;
+	t->sparse_map[*np].numbytes = numbytes;
+	(*np)++;
+
+	return 0;
+}
+
+
+/* add the used entries of an old GNU map */
+static int
+sparse_read_entries(TAR *t, size_t *np, char *p, int count)
+{
+	int i;
+
+	for (i = 0; i < count && p[0] != '\0'; i++, p += GNU_ENTRY_SIZE)
+		if (sparse_add(t, np, oct_to_size(p, 12),
+			       oct_to_size(p + 12, 12)) != 0)
+			return -1;
+
+	return 0;
+}
+
+
+/* read the map of an old GNU 'S' header and its extension blocks */
+static int
+sparse_read_gnu(TAR *t, size_t *np)
+{
+	char *hdr = (char *)&(t->th_buf);
+	char block[T_BLOCKSIZE];
+	int i, extended;
+
+	if (sparse_read_entries(t, np, hdr + GNU_SPARSE_OFFSET,
+				GNU_SPARSE_ENTRIES) != 0)
+		return -1;
+
+	for (extended = hdr[GNU_ISEXTENDED_OFFSET]; extended;
+	     extended = block[GNU_EXT_ISEXTENDED])
+	{
+		i = tar_block_read(t, block);
+		if (i != T_BLOCKSIZE)
+		{
+			if (i != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		if (sparse_read_entries(t, np, block, GNU_EXT_ENTRIES) != 0)
+			return -1;
+	}
+
+	t->sparse_size = oct_to_size(hdr + GNU_REALSIZE_OFFSET, 12);
+	return 0;
+}
+
+
+/* read the "count\noffset\nnumbytes\n..." map of a format 1.0 member */
+static int
+sparse_read_pax(TAR *t, size_t *np)
+{
+	char block[T_BLOCKSIZE];
+	tar_off_t num = 0, offset = 0, count = -1;
+	int i, j, digits = 0, have_offset = 0;
+
+	while (count < 0 || (tar_off_t)*np < count)
+	{
+		if (t->data_left < T_BLOCKSIZE)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		i = tar_block_read(t, block);
+		if (i != T_BLOCKSIZE)
+		{
+			if (i != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		t->data_left -= T_BLOCKSIZE;
+
+		for (j = 0; j < T_BLOCKSIZE
+			    && (count < 0 || (tar_off_t)*np < count); j++)
+		{
+			if (block[j] >= '0' && block[j] <= '9')
+			{
+				num = num * 10 + (block[j] - '0');
+				digits++;
+				continue;
+			}
+			if (block[j] != '\n' || digits == 0)
+			{
+				errno = EINVAL;
+				return -1;
+			}
+
+			if (count < 0)
+				count = num;
+			else if (!have_offset)
+			{
+				offset = num;
+				have_offset = 1;
+			}
+			else
+			{
+				if (sparse_add(t, np, offset, num) != 0)
+					return -1;
+				have_offset = 0;
+			}
+			num = 0;
+			digits = 0;
+		}
+	}
+
+	t->sparse_size = t->th_buf.pax.sparse_realsize;
+	return 0;
+}
+
+
+/* parse the "offset,numbytes,..." map of a format 0.1 member */
+static int
+sparse_read_map(TAR *t, size_t *np)
+{
+	tar_off_t offset;
+	char *p, *end;
+
+	for (p = t->th_buf.pax.sparse_map; *p != '\0'; p = end + 1)
+	{
+		offset = strtoll(p, &end, 10);
+		if (end == p || *end != ',')
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		p = end + 1;
+		if (sparse_add(t, np, offset, strtoll(p, &end, 10)) != 0)
+			return -1;
+		if (end == p || (*end != ',' && *end != '\0'))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		if (*end == '\0')
+			break;
+	}
+
+	t->sparse_size = t->th_buf.pax.sparse_realsize;
+	return 0;
+}
+
+
+/*
+** read the sparse map of the regfile th_read() just read, if it has one.
+** afterwards th_get_size() is the size of the expanded file, and
+** tar_read_data() returns zeros for the holes.
+** returns 0 for success, -1 (and sets errno) for failure.
+*/
+int
+th_sparse_read(TAR *t)
+{
+	struct tar_pax *p = &(t->th_buf.pax);
+	size_t n = 0;
+	int i;
+
+	if (t->th_buf.typeflag == GNU_SPARSE_TYPE)
+		i = sparse_read_gnu(t, &n);
+	else if ((p->flags & TAR_PAX_SPARSE) && p->sparse_map != NULL)
+		i = sparse_read_map(t, &n);
+	else if ((p->flags & TAR_PAX_SPARSE) && p->sparse_major == 1)
+		i = sparse_read_pax(t, &n);
+	else
+		return 0;
+	if (i != 0)
+		return tar_fail(t);
+
+#ifdef DEBUG
+	printf("    th_sparse_read(): %d regions, %lld bytes\n", (int)n,
+	       (long long)t->sparse_size);
+#endif
+
+	/* an all-hole file still gets a region, so the member is sparse */
+	if (n == 0 && sparse_add(t, &n, t->sparse_size, 0) != 0)
+		return tar_fail(t);
+
+	t->sparse_count = n;
+	t->sparse_idx = 0;
+	t->sparse_pos = 0;
+	t->th_buf.info.valid = 0;
+
+	return 0;
+}
+
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+
+/* find the data regions of fd with SEEK_DATA and SEEK_HOLE */
+static int
+sparse_scan(TAR *t, int fd, tar_off_t size, size_t *np)
+{
+	off_t data, hole;
+	tar_off_t pos = 0;
+
+	while (pos < size)
+	{
+		data = lseek(fd, (off_t)pos, SEEK_DATA);
+		if (data == -1)
+		{
+			/* ENXIO: nothing but a hole from pos to the end */
+			if (errno == ENXIO)
+				break;
+			return -1;
+		}
+		hole = lseek(fd, data, SEEK_HOLE);
+		if (hole == -1)
+			return -1;
+		if (hole > (off_t)size)
+			hole = (off_t)size;
+		if (hole > data
+		    && sparse_add(t, np, (tar_off_t)data,
+				  (tar_off_t)(hole - data)) != 0)
+			return -1;
+		pos = hole;
+	}
+
+	return 0;
+}
+
+
+/* write the old GNU 'S' header of a map, and its extension blocks */
+static int
+sparse_write_gnu(TAR *t, size_t n, tar_off_t size)
+{
+	char *hdr = (char *)&(t->th_buf);
+	char block[T_BLOCKSIZE];
+	size_t i, j;
+	char *p;
+	int k;
+
+	t->th_buf.typeflag = GNU_SPARSE_TYPE;
+	for (i = 0, p = hdr + GNU_SPARSE_OFFSET;
+	     i < n && i < GNU_SPARSE_ENTRIES; i++, p += GNU_ENTRY_SIZE)
+	{
+		size_to_oct(t->sparse_map[i].offset, p, 12);
+		size_to_oct(t->sparse_map[i].numbytes, p + 12, 12);
+	}
+	hdr[GNU_ISEXTENDED_OFFSET] = (n > GNU_SPARSE_ENTRIES);
+	size_to_oct(size, hdr + GNU_REALSIZE_OFFSET, 12);
+
+	if (t->options & TAR_VERBOSE)
+		th_print_long_ls(t);
+
+	if (th_write(t) != 0)
+		return -1;
+
+	while (i < n)
+	{
+		memset(block, 0, T_BLOCKSIZE);
+		for (j = 0, p = block; i < n && j < GNU_EXT_ENTRIES;
+		     i++, j++, p += GNU_ENTRY_SIZE)
+		{
+			size_to_oct(t->sparse_map[i].offset, p, 12);
+			size_to_oct(t->sparse_map[i].numbytes, p + 12, 12);
+		}
+		block[GNU_EXT_ISEXTENDED] = (i < n);
+		k = tar_block_write(t, block);
+		if (k != T_BLOCKSIZE)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+** write the pax header of a format 1.0 member, which names a
+** GNUSparseFile.0 directory, and the map at the start of its contents.
+*/
+static int
+sparse_write_pax(TAR *t, size_t n, tar_off_t size, tar_off_t packed)
+{
+	char *name, *base, *path, *map;
+	size_t i, len, maplen;
+	int ret = -1;
+
+	name = strdup(th_get_pathname(t));
+	if (name == NULL)
+		return -1;
+	base = strrchr(name, '/');
+	len = strlen(name) + sizeof("/GNUSparseFile.0/");
+	path = (char *)malloc(len);
+	maplen = (n + 1) * 2 * 24 + T_BLOCKSIZE;
+	map = (char *)calloc(1, maplen);
+	if (path == NULL || map == NULL)
+		goto out;
+	if (base != NULL)
+		snprintf(path, len, "%.*s/GNUSparseFile.0/%s",
+			 (int)(base - name), name, base + 1);
+	else
+		snprintf(path, len, "GNUSparseFile.0/%s", name);
+
+	len = sprintf(map, "%lu\n", (unsigned long)n);
+	for (i = 0; i < n; i++)
+		len += sprintf(map + len, "%lld\n%lld\n",
+			       (long long)t->sparse_map[i].offset,
+			       (long long)t->sparse_map[i].numbytes);
+	len = (len + T_BLOCKSIZE - 1) / T_BLOCKSIZE * T_BLOCKSIZE;
+
+	t->th_buf.pax.flags |= TAR_PAX_SPARSE;
+	t->th_buf.pax.sparse_name = name;
+	t->th_buf.pax.sparse_realsize = size;
+	th_set_path(t, path);
+	th_set_size(t, (tar_off_t)len + packed);
+
+	if (t->options & TAR_VERBOSE)
+		th_print_long_ls(t);
+
+	if (th_write(t) != 0)
+		goto out;
+
+	t->data_left = (tar_off_t)len + packed;
+	t->data_bufoff = t->data_buflen = 0;
+	ret = tar_write_data(t, map, len);
+
+  out:
+	t->th_buf.pax.flags &= ~TAR_PAX_SPARSE;
+	t->th_buf.pax.sparse_name = NULL;
+	free(name);
+	free(path);
+	free(map);
+	return ret;
+}
+
+#endif /* SEEK_DATA && SEEK_HOLE */
+
+
+/*
+** append the contents of the regular file realname, whose header has
+** been set up from s but not written, as a sparse member if it has
+** holes.  this needs TAR_SPARSE and either TAR_GNU or TAR_PAX.
+** returns:
+**	1	the file has no holes; nothing was written
+**	0	success
+**	-1	error (and sets errno)
+*/
+int
+tar_append_sparse(TAR *t, char *realname, struct stat *s)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	char buf[T_BLOCKSIZE * 32];
+	tar_off_t size = s->st_size, packed = 0, left;
+	size_t i, n = 0;
+	ssize_t k;
+	int fd;
+
+	if (!(t->options & TAR_SPARSE) || !(t->options & (TAR_GNU | TAR_PAX))
+	    || (tar_off_t)s->st_blocks * 512 >= size)
+		return 1;
+
+	fd = open(realname, O_RDONLY);
+	if (fd == -1)
+		return tar_fail(t);
+
+	if (sparse_scan(t, fd, size, &n) != 0)
+	{
+		/* file systems without SEEK_DATA fail with EINVAL */
+		close(fd);
+		return 1;
+	}
+	if (n == 1 && t->sparse_map[0].offset == 0
+	    && t->sparse_map[0].numbytes == size)
+	{
+		close(fd);
+		return 1;
+	}
+
+	/* a trailing hole is marked by an empty region at the end */
+	if ((n == 0 || t->sparse_map[n - 1].offset
+		       + t->sparse_map[n - 1].numbytes < size)
+	    && sparse_add(t, &n, size, 0) != 0)
+		goto fail;
+
+	for (i = 0; i < n; i++)
+		packed += t->sparse_map[i].numbytes;
+
+#ifdef DEBUG
+	printf("    tar_append_sparse(): \"%s\": %d regions, %lld of %lld "
+	       "bytes\n", realname, (int)n, (long long)packed,
+	       (long long)size);
+#endif
+
+	if (t->options & TAR_PAX)
+	{
+		if (sparse_write_pax(t, n, size, packed) != 0)
+			goto fail;
+	}
+	else
+	{
+		th_set_size(t, packed);
+		if (sparse_write_gnu(t, n, size) != 0)
+			goto fail;
+		t->data_left = packed;
+		t->data_bufoff = t->data_buflen = 0;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		if (lseek(fd, (off_t)t->sparse_map[i].offset, SEEK_SET) == -1)
+			goto fail;
+		for (left = t->sparse_map[i].numbytes; left > 0; left -= k)
+		{
+			k = read(fd, buf, (left < (tar_off_t)sizeof(buf)
+					   ? (size_t)left : sizeof(buf)));
+			if (k == -1)
+				goto fail;
+			if (k == 0)
+			{
+				/* the file shrank while it was being read */
+				errno = EINVAL;
+				goto fail;
+			}
+			if (tar_write_data(t, buf, (size_t)k) != 0)
+				goto fail;
+		}
+	}
+
+	close(fd);
+	return 0;
+
+  fail:
+	tar_fail(t);
+	close(fd);
+	errno = t->errnum;
+	return -1;
+#else
+	return 1;
+#endif
+}
@@ -0,0 +1,471 @@
+/*
+**  uring.c - batched whole-file reads and writes with io_uring
+**
+**  Each file is a chain of three linked requests: an openat() into a
+**  slot of the ring's fixed file table, a read or write of the whole
+**  contents through that slot, and a close() of the slot.  A statx()
+**  of a file is a chain of its own, with a single request.  A batch of
+**  chains goes to the kernel in a single io_uring_enter().  The ring is
+**  driven with raw system calls, so no liburing is needed; where
+**  io_uring is missing or disabled, tar_uring_new() fails and the
+**  callers do the work with plain system calls instead.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef __linux__
+# include <linux/version.h>
+/* the headers of 5.17 have everything used here */
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/sysmacros.h>
+#  include <linux/io_uring.h>
+#  include <linux/stat.h>
+#  ifdef __NR_io_uring_setup
+#   define TAR_HAVE_URING 1
+#  endif
+# endif
+#endif
+
+
+#ifdef TAR_HAVE_URING
+
+/* requests in the longest chain */
+#define CHAIN_LEN		3
+
+/* the outcome of each chain is in the user_data of its CQEs */
+#define CHAIN_DATA(i, step)	((unsigned long long)(i) * CHAIN_LEN + (step))
+
+struct tar_uring
+{
+	int fd;
+	unsigned int chains;		/* slots in the fixed file table */
+	unsigned int queued;		/* chains waiting for tar_uring_run() */
+	unsigned int pending;		/* and the requests they make up */
+	int *results;			/* of the read or write of each chain */
+	int statx;			/* IORING_OP_STATX is supported */
+	struct statx *stx;		/* what each statx() chain found */
+
+	void *ring;			/* the SQ and CQ rings, mapped at once */
+	size_t ring_size;
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+
+/*
+** the opcodes a chain uses, as reported by IORING_REGISTER_PROBE.
+** statx() is optional: without it, tar_uring_lstat() fails.
+*/
+static int
+uring_probe(tar_uring_t *r, int fd)
+{
+	struct io_uring_probe *probe;
+	size_t len;
+	int ok;
+
+	len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	if ((probe = (struct io_uring_probe *)calloc(1, len)) == NULL)
+		return -1;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+		    probe, 256) != 0)
+	{
+		free(probe);
+		return -1;
+	}
+	ok = (probe->last_op >= IORING_OP_CLOSE
+	      && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+	      && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+	      && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+	      && (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED));
+	r->statx = (probe->last_op >= IORING_OP_STATX
+		    && (probe->ops[IORING_OP_STATX].flags
+			& IO_URING_OP_SUPPORTED));
+	free(probe);
+	if (!ok)
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif /* TAR_HAVE_URING */
+
+
+/*
+** set up a ring for up to chains files at a time.
+** returns NULL (and sets errno) where io_uring can't be used.
+*/
+tar_uring_t *
+tar_uring_new(unsigned int chains)
+{
+#ifdef TAR_HAVE_URING
+	struct io_uring_params p;
+	tar_uring_t *r;
+	size_t cq_size;
+	int *fds;
+	unsigned int i;
+	int errnum;
+
+	if ((r = (tar_uring_t *)calloc(1, sizeof(tar_uring_t))) == NULL)
+		return NULL;
+	r->fd = -1;
+	r->chains = chains;
+	r->results = (int *)calloc(chains, sizeof(int));
+	fds = (int *)malloc(chains * sizeof(int));
+	if (r->results == NULL || fds == NULL)
+		goto fail;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = (int)syscall(__NR_io_uring_setup, chains * CHAIN_LEN, &p);
+	if (r->fd == -1)
+		goto fail;
+
+	/* direct descriptors in openat() and close() came with CQE_SKIP */
+	if (!(p.features & IORING_FEAT_CQE_SKIP)
+	    || !(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		errno = ENOSYS;
+		goto fail;
+	}
+	if (uring_probe(r, r->fd) != 0)
+		goto fail;
+
+	/* an empty fixed file table, one slot per chain */
+	for (i = 0; i < chains; i++)
+		fds[i] = -1;
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES,
+		    fds, chains) != 0)
+		goto fail;
+
+	r->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_size > r->ring_size)
+		r->ring_size = cq_size;
+	r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->ring == MAP_FAILED)
+	{
+		r->ring = NULL;
+		goto fail;
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_size,
+					      PROT_READ | PROT_WRITE,
+					      MAP_SHARED | MAP_POPULATE,
+					      r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+	{
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sq_tail = (unsigned int *)((char *)r->ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->ring + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->ring + p.cq_off.cqes);
+
+	free(fds);
+	return r;
+
+  fail:
+	errnum = errno;
+	free(fds);
+	tar_uring_free(r);
+	errno = errnum;
+	return NULL;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+
+void
+tar_uring_free(tar_uring_t *r)
+{
+#ifdef TAR_HAVE_URING
+	if (r == NULL)
+		return;
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->sqes_size);
+	if (r->ring != NULL)
+		munmap(r->ring, r->ring_size);
+	if (r->fd != -1)
+		close(r->fd);
+	free(r->results);
+	free(r->stx);
+	free(r);
+#endif
+}
+
+
+#ifdef TAR_HAVE_URING
+
+/* the next free SQE, filled with zeros */
+static struct io_uring_sqe *
+uring_sqe(tar_uring_t *r)
+{
+	unsigned int tail = *(r->sq_tail) + r->pending++;
+	unsigned int idx = tail & *(r->sq_mask);
+	struct io_uring_sqe *sqe = &(r->sqes[idx]);
+
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	return sqe;
+}
+
+
+/* queue the openat(), read or write, and close() of one file */
+static int
+uring_queue(tar_uring_t *r, const char *path, int oflags, int op,
+	    void *buf, size_t len)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int i = r->queued;
+
+	if (i == r->chains)
+	{
+		errno = ENOSPC;
+		return -1;
+	}
+
+	sqe = uring_sqe(r);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)path;
+	sqe->len = 0666;
+	sqe->open_flags = oflags;
+	sqe->file_index = i + 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = CHAIN_DATA(i, 0);
+
+	/* a failed read or write still closes the slot */
+	sqe = uring_sqe(r);
+	sqe->opcode = op;
+	sqe->fd = i;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = 0;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	sqe->user_data = CHAIN_DATA(i, 1);
+
+	sqe = uring_sqe(r);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = i + 1;
+	sqe->user_data = CHAIN_DATA(i, 2);
+
+	r->results[i] = 0;
+	return r->queued++;
+}
+
+#endif /* TAR_HAVE_URING */
+
+
+/* the ring of t, set up on first use; NULL where io_uring can't be used */
+tar_uring_t *
+tar_uring(TAR *t)
+{
+	if (t->uring == NULL && !t->uring_failed
+	    && (t->uring = tar_uring_new(URING_BATCH)) == NULL)
+		t->uring_failed = 1;
+
+	return t->uring;
+}
+
+
+/* queue creating path with the len bytes of buf; returns the chain index */
+int
+tar_uring_write_file(tar_uring_t *r, const char *path, const void *buf,
+		     size_t len)
+{
+#ifdef TAR_HAVE_URING
+	return uring_queue(r, path, O_WRONLY | O_CREAT | O_TRUNC,
+			   IORING_OP_WRITE, (void *)buf, len);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/* queue reading up to len bytes of path into buf */
+int
+tar_uring_read_file(tar_uring_t *r, const char *path, void *buf, size_t len)
+{
+#ifdef TAR_HAVE_URING
+	return uring_queue(r, path, O_RDONLY, IORING_OP_READ, buf, len);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/*
+** queue an lstat() of path, made with statx(); tar_uring_stat() gives
+** what it found once the chain has run
+*/
+int
+tar_uring_lstat(tar_uring_t *r, const char *path)
+{
+#ifdef TAR_HAVE_URING
+	struct io_uring_sqe *sqe;
+	unsigned int i = r->queued;
+
+	if (!r->statx)
+	{
+		errno = ENOSYS;
+		return -1;
+	}
+	if (i == r->chains)
+	{
+		errno = ENOSPC;
+		return -1;
+	}
+	if (r->stx == NULL
+	    && (r->stx = (struct statx *)malloc(r->chains
+						* sizeof(struct statx))) == NULL)
+		return -1;
+
+	sqe = uring_sqe(r);
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)path;
+	sqe->len = STATX_BASIC_STATS;
+	sqe->off = (unsigned long)&(r->stx[i]);
+	sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+	sqe->user_data = CHAIN_DATA(i, 1);
+
+	r->results[i] = 0;
+	return r->queued++;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/* what the statx() chain i found, as a struct stat */
+void
+tar_uring_stat(tar_uring_t *r, int i, struct stat *s)
+{
+#ifdef TAR_HAVE_URING
+	struct statx *x = &(r->stx[i]);
+
+	memset(s, 0, sizeof(*s));
+	s->st_dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+	s->st_ino = x->stx_ino;
+	s->st_mode = x->stx_mode;
+	s->st_nlink = x->stx_nlink;
+	s->st_uid = x->stx_uid;
+	s->st_gid = x->stx_gid;
+	s->st_rdev = makedev(x->stx_rdev_major, x->stx_rdev_minor);
+	s->st_size = x->stx_size;
+	s->st_blksize = x->stx_blksize;
+	s->st_blocks = x->stx_blocks;
+	s->st_atim.tv_sec = x->stx_atime.tv_sec;
+	s->st_atim.tv_nsec = x->stx_atime.tv_nsec;
+	s->st_mtim.tv_sec = x->stx_mtime.tv_sec;
+	s->st_mtim.tv_nsec = x->stx_mtime.tv_nsec;
+	s->st_ctim.tv_sec = x->stx_ctime.tv_sec;
+	s->st_ctim.tv_nsec = x->stx_ctime.tv_nsec;
+#endif
+}
+
+
+/*
+** submit the queued chains and wait for all of them.  afterwards
+** tar_uring_result() gives the outcome of each.
+** returns 0 for success, -1 (and sets errno) if the ring failed.
+*/
+int
+tar_uring_run(tar_uring_t *r)
+{
+#ifdef TAR_HAVE_URING
+	unsigned int want, submitted = 0, done = 0, head, i, step;
+	struct io_uring_cqe *cqe;
+	long k;
+
+	want = r->pending;
+	if (want == 0)
+		return 0;
+
+	/* publish the SQEs, then have the kernel take them all */
+	__atomic_store_n(r->sq_tail, *(r->sq_tail) + want, __ATOMIC_RELEASE);
+
+	while (done < want)
+	{
+		k = syscall(__NR_io_uring_enter, r->fd, want - submitted,
+			    want - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (k == -1 && errno != EINTR)
+		{
+			r->queued = r->pending = 0;
+			return -1;
+		}
+		if (k > 0)
+			submitted += (unsigned int)k;
+
+		head = *(r->cq_head);
+		while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &(r->cqes[head & *(r->cq_mask)]);
+			i = (unsigned int)(cqe->user_data / CHAIN_LEN);
+			step = (unsigned int)(cqe->user_data % CHAIN_LEN);
+
+			/* keep the first failure, or the bytes moved */
+			if (i < r->queued
+			    && (cqe->res < 0 ? r->results[i] >= 0 : step == 1))
+				r->results[i] = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	r->queued = r->pending = 0;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/*
+** the outcome of chain i of the last tar_uring_run(): the bytes read
+** or written (0 for a statx()), or minus the errno of the first request
+** that failed.
+*/
+int
+tar_uring_result(tar_uring_t *r, int i)
+{
+#ifdef TAR_HAVE_URING
+	return r->results[i];
+#else
+	return -ENOSYS;
+#endif
+}
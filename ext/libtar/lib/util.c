@@ -25,13 +25,22 @@
 int
 path_hashfunc(char *key, int numbuckets)
 {
-	char buf[MAXPATHLEN];
-	char *p;
-
-	strcpy(buf, key);
-	p = basename(buf);
-
-	return (((unsigned int)p[0]) % numbuckets);
+	const char *p;
+	size_t len;
+
+	/*
+	** the first character of basename(key), found in place: the
+	** compat basename() returns a static buffer
+	*/
+	len = strlen(key);
+	while (len > 1 && key[len - 1] == '/')
+		len--;
+	for (p = key + len; p > key && p[-1] != '/'; p--)
+		;
+	if (p == key + len)
+		p = (len > 0 ? key + len - 1 : ".");
+
+	return (((unsigned int)(unsigned char)p[0]) % numbuckets);
 }
 
 
@@ -119,39 +128,39 @@ mkdirhier(char *path)
 }
 
 
-/* calculate header checksum */
-int
-th_crc_calc(TAR *t)
-{
-	int i, sum = 0;
-
-	for (i = 0; i < T_BLOCKSIZE; i++)
-		sum += ((unsigned char *)(&(t->th_buf)))[i];
-	for (i = 0; i < 8; i++)
-		sum += (' ' - (unsigned char)t->th_buf.chksum[i]);
-
-	return sum;
-}
-
-
-/* string-octal to integer conversion */
+/*
+** mkdirhier_parent() - create the directories leading up to path
+** this is mkdirhier(dirname(path)), except that path is left untouched
+** and no static buffer is involved, so it is safe to call from several
+** threads at once.
+** returns:
+**	0			success
+**	1			all directories already exist
+**	-1 (and sets errno)	error
+*/
 int
-oct_to_int(char *oct)
+mkdirhier_parent(char *path)
 {
-	int i;
-
-	sscanf(oct, "%o", &i);
-
-	return i;
-}
+	char dir[MAXPATHLEN];
+	size_t len;
 
+	if (strlcpy(dir, path, sizeof(dir)) >= sizeof(dir))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
 
-/* integer to string-octal conversion, no NULL */
-void
-int_to_oct_nonull(int num, char *oct, size_t octlen)
-{
-	snprintf(oct, octlen, "%0*lo", octlen - 1, (unsigned long)num);
-	oct[octlen - 1] = 0;
+	/* strip trailing slashes, the last component, and its separators */
+	len = strlen(dir);
+	while (len > 1 && dir[len - 1] == '/')
+		len--;
+	while (len > 0 && dir[len - 1] != '/')
+		len--;
+	while (len > 1 && dir[len - 1] == '/')
+		len--;
+	if (len == 0)
+		return 1;
+	dir[len] = '\0';
+
+	return mkdirhier(dir);
 }
-
-
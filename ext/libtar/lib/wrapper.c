@@ -16,11 +16,103 @@
 #include <sys/param.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef STDC_HEADERS
+# include <stdlib.h>
 # include <string.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+# include <linux/fiemap.h>
+#endif
+
+
+/* with TAR_PHYSICAL_ORDER, how many files are sorted at a time */
+#define ORDER_BATCH		4096
+
+/* the sort key of a file whose data can't be located */
+#define PHYS_UNKNOWN		(~0ULL)
+
+/* a file waiting in a batch of tar_append_tree() or tar_append_list() */
+struct batch_file
+{
+	char *realname;
+	char *savename;
+	unsigned long long phys;	/* disk address of its first block */
+	struct stat st;
+	int statted;			/* is st its lstat()? */
+	const char *data;		/* its contents, if read with io_uring */
+	int chain;
+};
+
+struct append_batch
+{
+	struct batch_file files[ORDER_BATCH];
+	size_t count;
+	int sort;			/* into disk order */
+	char *buf;			/* URING_BATCH_BYTES for io_uring reads */
+};
+
+/*
+** returns:
+**	1	the current header meets every condition in f
+**	0	it doesn't
+*/
+int
+th_match(TAR *t, const tar_filter_t *f)
+{
+	struct tar_info *info = th_info(t);
+
+	if (f->types != 0 && !(info->types & f->types))
+		return 0;
+	if (info->size < f->min_size)
+		return 0;
+	if (f->newer && (info->mtime < f->newer_than
+			 || (info->mtime == f->newer_than
+			     && info->mtime_nsec <= f->newer_than_nsec)))
+		return 0;
+
+	/* the cheap tests come first, so fnmatch() runs only if needed */
+	if (f->include != NULL && !tar_matcher_match(f->include, info->pathname))
+		return 0;
+	if (f->exclude != NULL && tar_matcher_match(f->exclude, info->pathname))
+		return 0;
+
+	return 1;
+}
+
+
+/*
+** like th_read(), but members that don't meet f are skipped (seeking
+** over their contents where possible) until one does.  once every
+** literal path in f->include has been found, 1 is returned at once.
+*/
+int
+th_read_match(TAR *t, const tar_filter_t *f)
+{
+	int i;
+
+	for (;;)
+	{
+		if (f->include != NULL && tar_matcher_done(f->include))
+			return 1;
+		if ((i = th_read(t)) != 0)
+			return i;
+		if (th_match(t, f))
+			return 0;
+		if (TH_ISREG(t) && tar_skip_regfile(t))
+			return tar_fail(t);
+	}
+}
+
+
 int
 tar_extract_glob(TAR *t, char *globname, char *prefix)
 {
@@ -33,10 +125,8 @@ tar_extract_glob(TAR *t, char *globname, char *prefix)
 		filename = th_get_pathname(t);
 		if (fnmatch(globname, filename, FNM_PATHNAME | FNM_PERIOD))
 		{
-			if (TH_ISREG(t) && tar_skip_regfile(t)){
-				free(filename);
-				return -1;
-			}
+			if (TH_ISREG(t) && tar_skip_regfile(t))
+				return tar_fail(t);
 			continue;
 		}
 		if (t->options & TAR_VERBOSE)
@@ -45,14 +135,42 @@ tar_extract_glob(TAR *t, char *globname, char *prefix)
 			snprintf(buf, sizeof(buf), "%s/%s", prefix, filename);
 		else
 			strlcpy(buf, filename, sizeof(buf));
-		if (tar_extract_file(t, buf) != 0) {
-			free(filename);
-			return -1;
+		if (tar_extract_queued(t, buf) != 0)
+			return tar_fail(t);
+	}
+
+	return (i == 1 ? tar_extract_sync(t) : -1);
+}
+
+
+/* extract the members matching m, stopping once m is done */
+int
+tar_extract_globs(TAR *t, tar_matcher_t *m, char *prefix)
+{
+	char *filename;
+	char buf[MAXPATHLEN];
+	int i = 1;
+
+	while (!tar_matcher_done(m) && (i = th_read(t)) == 0)
+	{
+		filename = th_get_pathname(t);
+		if (!tar_matcher_match(m, filename))
+		{
+			if (TH_ISREG(t) && tar_skip_regfile(t))
+				return tar_fail(t);
+			continue;
 		}
-		free(filename);
+		if (t->options & TAR_VERBOSE)
+			th_print_long_ls(t);
+		if (prefix != NULL)
+			snprintf(buf, sizeof(buf), "%s/%s", prefix, filename);
+		else
+			strlcpy(buf, filename, sizeof(buf));
+		if (tar_extract_queued(t, buf) != 0)
+			return tar_fail(t);
 	}
 
-	return (i == 1 ? 0 : -1);
+	return (i == -1 ? -1 : tar_extract_sync(t));
 }
 
 
@@ -81,22 +199,296 @@ tar_extract_all(TAR *t, char *prefix)
 		else
 			strlcpy(buf, filename, sizeof(buf));
 #ifdef DEBUG
-		printf("    tar_extract_all(): calling tar_extract_file(t, "
+		printf("    tar_extract_all(): calling tar_extract_queued(t, "
 		       "\"%s\")\n", buf);
 #endif
-		if (tar_extract_file(t, buf) != 0){
-			free(filename);
-			return -1;
+		if (tar_extract_queued(t, buf) != 0)
+			return tar_fail(t);
+	}
+
+	return (i == 1 ? tar_extract_sync(t) : -1);
+}
+
+
+/*
+** the address on disk where the data of realname starts, found with
+** FIEMAP, or PHYS_UNKNOWN where the file system can't tell (or keeps
+** the data inline)
+*/
+static unsigned long long
+physical_offset(char *realname)
+{
+#ifdef FS_IOC_FIEMAP
+	unsigned long long buf[(sizeof(struct fiemap)
+				+ sizeof(struct fiemap_extent)) / 8 + 1];
+	struct fiemap *fm = (struct fiemap *)buf;
+	int fd, i;
+
+	if ((fd = open(realname, O_RDONLY)) == -1)
+		return PHYS_UNKNOWN;
+	memset(buf, 0, sizeof(buf));
+	fm->fm_length = FIEMAP_MAX_OFFSET;
+	fm->fm_extent_count = 1;
+	i = ioctl(fd, FS_IOC_FIEMAP, fm);
+	close(fd);
+
+	if (i == 0 && fm->fm_mapped_extents > 0
+	    && !(fm->fm_extents[0].fe_flags
+		 & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)))
+		return fm->fm_extents[0].fe_physical;
+#endif
+
+	return PHYS_UNKNOWN;
+}
+
+
+/* ask for the contents of realname to be read in the background */
+static void
+prefetch(char *realname)
+{
+#ifdef POSIX_FADV_WILLNEED
+	int fd;
+
+	if ((fd = open(realname, O_RDONLY)) == -1)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+#endif
+}
+
+
+/* files with known addresses come first, in disk order, then by inode */
+static int
+batch_cmp(const void *a, const void *b)
+{
+	const struct batch_file *fa = (const struct batch_file *)a;
+	const struct batch_file *fb = (const struct batch_file *)b;
+
+	if (fa->phys != fb->phys)
+		return (fa->phys < fb->phys ? -1 : 1);
+	if (fa->st.st_ino != fb->st.st_ino)
+		return (fa->st.st_ino < fb->st.st_ino ? -1 : 1);
+	return 0;
+}
+
+
+/* free the names of the files left in b */
+static void
+batch_free(struct append_batch *b)
+{
+	size_t i;
+
+	for (i = 0; i < b->count; i++)
+	{
+		free(b->files[i].realname);
+		free(b->files[i].savename);
+	}
+	b->count = 0;
+}
+
+
+/*
+** lstat() the files of b that haven't been, with batches of io_uring
+** statx() requests.  a file that can't be statted this way is left to
+** tar_append_file(), which then reports what is wrong with it.
+*/
+static void
+batch_stat(TAR *t, struct append_batch *b)
+{
+	tar_uring_t *r = t->uring;
+	struct batch_file *f;
+	size_t i, from = 0;
+	int n, ok = 1;
+
+	while (ok && from < b->count)
+	{
+		for (i = from, n = 0; i < b->count && n < URING_BATCH; i++)
+		{
+			f = &(b->files[i]);
+			f->chain = -1;
+			if (f->statted)
+				continue;
+			if ((f->chain = tar_uring_lstat(r, f->realname)) == -1)
+			{
+				/* no statx() in this kernel */
+				ok = 0;
+				break;
+			}
+			n++;
 		}
-		free(filename);
+		if (tar_uring_run(r) != 0)
+			ok = 0;
+		for (; from < i; from++)
+		{
+			f = &(b->files[from]);
+			if (ok && f->chain != -1
+			    && tar_uring_result(r, f->chain) == 0)
+			{
+				tar_uring_stat(r, f->chain, &(f->st));
+				f->statted = 1;
+			}
+		}
+	}
+}
+
+
+/*
+** read the small files among those of b from the from'th on with one
+** batch of io_uring requests, up to URING_BATCH of them or as many as
+** fit in b->buf.  returns the index of the first file it didn't cover.
+** a file that can't be read, or whose size changed, is left to be read
+** by tar_append_file() as usual.
+*/
+static size_t
+batch_read(TAR *t, struct append_batch *b, size_t from)
+{
+	tar_uring_t *r = t->uring;
+	struct batch_file *f;
+	size_t i, used = 0;
+	int n = 0;
+
+	for (i = from; i < b->count && n < URING_BATCH; i++)
+	{
+		f = &(b->files[i]);
+		f->data = NULL;
+		f->chain = -1;
+		if (!f->statted || !S_ISREG(f->st.st_mode)
+		    || f->st.st_size > URING_MAX_FILE)
+			continue;
+		/* one byte more shows a file that has grown */
+		if (used + (size_t)f->st.st_size + 1 > URING_BATCH_BYTES)
+			break;
+		f->chain = tar_uring_read_file(r, f->realname, b->buf + used,
+					       (size_t)f->st.st_size + 1);
+		if (f->chain == -1)
+			break;
+		f->data = b->buf + used;
+		used += (size_t)f->st.st_size + 1;
+		n++;
+	}
+
+	if (tar_uring_run(r) != 0)
+		n = 0;
+	for (; from < i; from++)
+	{
+		f = &(b->files[from]);
+		if (f->chain == -1)
+			continue;
+		if (n == 0
+		    || tar_uring_result(r, f->chain) != (int)f->st.st_size)
+			f->data = NULL;
 	}
 
-	return (i == 1 ? 0 : -1);
+	return i;
 }
 
 
+/*
+** append the files of b, in the order their data lies on disk if
+** b->sort is set, with the next t->prefetch of them being read ahead.
+** with TAR_IO_URING, they are statted and small files are read in
+** batches first.
+*/
+static int
+batch_flush(TAR *t, struct append_batch *b)
+{
+	size_t i, next = 0, read = 0;
+	struct batch_file *f;
+	int ret = 0;
+
+	if (b->sort)
+		qsort(b->files, b->count, sizeof(struct batch_file),
+		      batch_cmp);
+
+	if ((t->options & TAR_IO_URING) && tar_uring(t) != NULL)
+	{
+		batch_stat(t, b);
+		if (b->buf == NULL
+		    && (b->buf = (char *)malloc(URING_BATCH_BYTES)) == NULL)
+			ret = -1;
+	}
+
+	for (i = 0; i < b->count && ret == 0; i++)
+	{
+		f = &(b->files[i]);
+		if (b->buf != NULL && i == read)
+			read = batch_read(t, b, i);
+		for (; t->prefetch > 0 && next < b->count
+		     && next <= i + (size_t)t->prefetch; next++)
+			prefetch(b->files[next].realname);
+		if (i < read && f->data != NULL)
+			ret = tar_append_file_data(t, f->realname,
+						   f->savename, &(f->st),
+						   f->data,
+						   (size_t)f->st.st_size);
+		else
+			ret = tar_append_file_data(t, f->realname,
+						   f->savename,
+						   (f->statted ? &(f->st) : NULL),
+						   NULL, 0);
+	}
+
+	if (ret != 0)
+		tar_fail(t);
+	batch_free(b);
+	if (ret != 0)
+		errno = t->errnum;
+	return ret;
+}
+
+
+/*
+** queue a file in b, with its lstat() if s isn't NULL, appending the
+** batch once it is full
+*/
+static int
+batch_add(TAR *t, struct append_batch *b, char *realname, char *savename,
+	  struct stat *s)
+{
+	struct batch_file *f = &(b->files[b->count]);
+
+	f->realname = strdup(realname);
+	f->savename = (savename ? strdup(savename) : NULL);
+	if (f->realname == NULL || (savename != NULL && f->savename == NULL))
+	{
+		free(f->realname);
+		free(f->savename);
+		return -1;
+	}
+	f->phys = (b->sort ? physical_offset(realname) : PHYS_UNKNOWN);
+	f->statted = (s != NULL);
+	if (s != NULL)
+		f->st = *s;
+	b->count++;
+
+	if (b->count == ORDER_BATCH)
+		return batch_flush(t, b);
+	return 0;
+}
+
+
+/*
+** set how many files ahead of the one being appended are read in the
+** background by tar_append_list(), and by tar_append_tree() with
+** TAR_PHYSICAL_ORDER or TAR_IO_URING.  0 (the default) turns it off.
+*/
 int
-tar_append_tree(TAR *t, char *realdir, char *savedir)
+tar_set_prefetch(TAR *t, int files)
+{
+	if (files < 0)
+	{
+		errno = EINVAL;
+		return tar_fail(t);
+	}
+
+	t->prefetch = files;
+	return 0;
+}
+
+
+/* walk a tree for tar_append_tree(); regular files go to b if it is set */
+static int
+append_tree(TAR *t, char *realdir, char *savedir, struct append_batch *b)
 {
 	char realpath[MAXPATHLEN];
 	char savepath[MAXPATHLEN];
@@ -113,7 +505,7 @@ tar_append_tree(TAR *t, char *realdir, char *savedir)
 #endif
 
 	if (tar_append_file(t, realdir, savedir) != 0)
-		return -1;
+		return tar_fail(t);
 
 #ifdef DEBUG
 	puts("    tar_append_tree(): done with tar_append_file()...");
@@ -134,7 +526,7 @@ tar_append_tree(TAR *t, char *realdir, char *savedir)
 			return 0;
 		}
 #endif
-		return -1;
+		return tar_fail(t);
 	}
 	while ((dent = readdir(dp)) != NULL)
 	{
@@ -149,24 +541,121 @@ tar_append_tree(TAR *t, char *realdir, char *savedir)
 				 dent->d_name);
 
 		if (lstat(realpath, &s) != 0)
-			return -1;
+			goto fail;
 
 		if (S_ISDIR(s.st_mode))
 		{
-			if (tar_append_tree(t, realpath,
-					    (savedir ? savepath : NULL)) != 0)
-				return -1;
+			if (append_tree(t, realpath,
+					(savedir ? savepath : NULL), b) != 0)
+				goto fail;
+			continue;
+		}
+
+		if (b != NULL && S_ISREG(s.st_mode))
+		{
+			if (batch_add(t, b, realpath,
+				      (savedir ? savepath : NULL), &s) != 0)
+				goto fail;
 			continue;
 		}
 
 		if (tar_append_file(t, realpath,
 				    (savedir ? savepath : NULL)) != 0)
-			return -1;
+			goto fail;
 	}
 
 	closedir(dp);
 
 	return 0;
+
+  fail:
+	/* don't leak the directory stream of every level on the way out */
+	tar_fail(t);
+	closedir(dp);
+	errno = t->errnum;
+	return -1;
+}
+
+
+/* a batch for tar_append_tree() or tar_append_list() */
+static struct append_batch *
+batch_new(int sort)
+{
+	struct append_batch *b;
+
+	if ((b = (struct append_batch *)malloc(sizeof(*b))) == NULL)
+		return NULL;
+	b->count = 0;
+	b->sort = sort;
+	b->buf = NULL;
+
+	return b;
 }
 
 
+static void
+batch_delete(struct append_batch *b)
+{
+	batch_free(b);
+	free(b->buf);
+	free(b);
+}
+
+
+/*
+** append a whole tree.  with TAR_PHYSICAL_ORDER, regular files are
+** gathered in batches of ORDER_BATCH and each batch is read in the
+** order its data lies on disk (by FIEMAP, or by inode number where
+** that's unavailable), so cold trees are read with little seeking.
+** the directories still come before the files in them.  TAR_IO_URING
+** batches regular files the same way, to read the small ones together.
+*/
+int
+tar_append_tree(TAR *t, char *realdir, char *savedir)
+{
+	struct append_batch *b = NULL;
+	int ret;
+
+	if ((t->options & (TAR_PHYSICAL_ORDER | TAR_IO_URING))
+	    && (b = batch_new(t->options & TAR_PHYSICAL_ORDER)) == NULL)
+		return tar_fail(t);
+
+	ret = append_tree(t, realdir, savedir, b);
+	if (b != NULL)
+	{
+		if (ret == 0)
+			ret = batch_flush(t, b);
+		batch_delete(b);
+	}
+
+	return ret;
+}
+
+
+/*
+** append the files of a list, in its order, as tar_append_file() would
+** one by one.  a directory is added without its contents.  the files
+** go through the batches of tar_append_tree(): with TAR_IO_URING, those
+** whose lstat() isn't given are statted together and the small regular
+** ones read together, and t->prefetch files are read ahead.
+*/
+int
+tar_append_list(TAR *t, tar_listent_t *files, size_t count)
+{
+	struct append_batch *b;
+	size_t i;
+	int ret = 0;
+
+	if ((b = batch_new(0)) == NULL)
+		return tar_fail(t);
+
+	for (i = 0; i < count && ret == 0; i++)
+		if (batch_add(t, b, files[i].realname, files[i].savename,
+			      files[i].st) != 0)
+			ret = tar_fail(t);
+	if (ret == 0)
+		ret = batch_flush(t, b);
+	batch_delete(b);
+
+	return ret;
+}
@@ -1,5 +1,7 @@
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 #ifdef HAVE_ZLIB_H
 #include <zlib.h>
 #endif
@@ -8,7 +10,15 @@
 #endif
 #include "libtar.h"
 #include "ruby.h"
-#include "rubysig.h"
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+#ifdef HAVE_RUBY_IO_H
+#include "ruby/io.h"
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #ifndef RSTRING_PTR
 #define RSTRING_PTR(s) (RSTRING(s)->ptr)
@@ -33,521 +43,2902 @@
 
 #define INT2TIME(i) rb_funcall(rb_cTime, rb_intern("at"), 1, INT2NUM(i))
 
+#ifdef HAVE_RB_TIME_NANO_NEW
+#define NSEC2TIME(s, ns) rb_time_nano_new((s), (ns))
+#else
+#define NSEC2TIME(s, ns) rb_funcall(rb_cTime, rb_intern("at"), 2, LONG2NUM(s), LONG2NUM((ns) / 1000))
+#endif
+
+#ifndef RB_PASS_CALLED_KEYWORDS
+#define RETURN_ENUMERATOR_KW(obj, argc, argv, kw_splat) RETURN_ENUMERATOR(obj, argc, argv)
+#endif
+
+#ifndef RB_WAITFD_IN
+#define RB_WAITFD_IN  0x001
+#define RB_WAITFD_OUT 0x004
+#endif
+
+#if defined(RB_THREAD_LOCAL_SPECIFIER)
+#define TARRUBY_THREAD_LOCAL RB_THREAD_LOCAL_SPECIFIER
+#elif defined(_MSC_VER)
+#define TARRUBY_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define TARRUBY_THREAD_LOCAL __thread
+#endif
+
 #define VERSION "0.1.4"
 
+/* default chunk size of Tar::Entry#each_chunk */
+#define CHUNK_SIZE (64 * 1024)
+
 static VALUE Tar;
+static VALUE Entry;
 static VALUE Error;
 
+/* an archive read from or written to a Ruby IO */
+struct tarruby_io {
+  VALUE io;
+  int fd;      /* -1 if io has no descriptor and is used through #read/#write */
+  int events;
+  int state;   /* tag of an exception raised inside a libtar call */
+  char *buf;
+  size_t len;
+  tar_off_t offset; /* arguments of #seek */
+  int whence;
+  void *z;     /* compression state when the IO was opened with Tar.gzopen/bzopen */
+  VALUE pending;    /* what Ruby had read ahead of fd, returned before fd is read */
+  long pending_off;
+};
+
 struct tarruby_tar {
   TAR *tar;
   int extracted;
+  unsigned long generation; /* bumped whenever another header is read */
+  int busy;                 /* libtar is working on the handle, possibly without the GVL */
+  struct tarruby_io io;
 };
 
-#ifdef HAVE_ZLIB_H
-// copy from libtar.c
-// Copyright 1998-2003 University of Illinois Board of Trustees
-// Copyright 1998-2003 Mark D. Roth
-static int gzopen_frontend(char *pathname, int oflags, int mode) {
-  char *gzoflags;
-  gzFile gzf;
-#ifndef _WIN32
-  int fd;
+/* a header decoded in one pass; its contents can be read while the member is current */
+struct tarruby_entry {
+  VALUE tar;
+  unsigned long generation;
+  int types;
+  char typeflag;
+  mode_t mode;
+  tar_off_t size;
+  time_t mtime;
+  long mtime_nsec;
+  unsigned long uid;
+  unsigned long gid;
+  unsigned long devmajor;
+  unsigned long devminor;
+  int crc;
+  char *pathname; /* both in one allocation */
+  char *linkname;
+  VALUE v_pathname; /* frozen and created on first use */
+  VALUE v_linkname;
+  VALUE v_mtime;
+  int changes;      /* TARRUBY_SET_* made to an entry of Tar.transform */
+  VALUE v_data;     /* frozen contents given to #data= */
+};
+
+/* what the block of Tar.transform changed */
+#define TARRUBY_SET_PATHNAME 0x01
+#define TARRUBY_SET_LINKNAME 0x02
+#define TARRUBY_SET_MODE     0x04
+#define TARRUBY_SET_MTIME    0x08
+#define TARRUBY_SET_UID      0x10
+#define TARRUBY_SET_GID      0x20
+#define TARRUBY_SET_DATA     0x40
+#define TARRUBY_DROP         0x80
+
+/* arguments and result of a libtar call made without the GVL */
+struct tarruby_call {
+  struct tarruby_tar *handle; /* marked busy during the call */
+  struct tarruby_tar *source; /* the other handle of tar_append_member(), if any */
+  TAR *tar;
+  char *s1;
+  char *s2;
+  tar_off_t size;
+  mode_t mode;
+  time_t mtime;
+  uid_t uid;
+  gid_t gid;
+  void *data;
+  int durability;
+  int result;
+  int error;
+  void *(*func)(void *);
+  int state;                  /* an exception raised while libtar was retrying EINTR */
+};
+
+static VALUE tarruby_io_wait0(VALUE arg) {
+  struct tarruby_io *p = (struct tarruby_io *) arg;
+
+#ifdef HAVE_RB_IO_WAIT
+  /* goes through the fiber scheduler, if there is one */
+  rb_io_wait(p->io, INT2NUM(p->events), Qnil);
+#else
+  if (p->events == RB_WAITFD_IN) {
+    rb_thread_wait_fd(p->fd);
+  } else {
+    rb_thread_fd_writable(p->fd);
+  }
 #endif
 
-  switch (oflags & O_ACCMODE) {
-  case O_WRONLY:
-    gzoflags = "wb";
-    break;
+  return Qnil;
+}
 
-  case O_RDONLY:
-    gzoflags = "rb";
-    break;
+static VALUE tarruby_io_read0(VALUE arg) {
+  struct tarruby_io *p = (struct tarruby_io *) arg;
+  VALUE str;
 
-  default:
-  case O_RDWR:
-    errno = EINVAL;
+  str = rb_funcall(p->io, rb_intern("read"), 1, LONG2NUM(p->len));
+
+  if (NIL_P(str)) {
+    return INT2FIX(0);
+  }
+
+  StringValue(str);
+
+  if ((size_t) RSTRING_LEN(str) > p->len) {
+    rb_raise(rb_eIOError, "read returned more than %ld bytes", (long) p->len);
+  }
+
+  memcpy(p->buf, RSTRING_PTR(str), RSTRING_LEN(str));
+
+  return LONG2NUM(RSTRING_LEN(str));
+}
+
+static VALUE tarruby_io_write0(VALUE arg) {
+  struct tarruby_io *p = (struct tarruby_io *) arg;
+  return rb_funcall(p->io, rb_intern("write"), 1, rb_str_new(p->buf, p->len));
+}
+
+static VALUE tarruby_io_flush0(VALUE arg) {
+  struct tarruby_io *p = (struct tarruby_io *) arg;
+
+  if (rb_respond_to(p->io, rb_intern("flush"))) {
+    rb_funcall(p->io, rb_intern("flush"), 0);
+  }
+
+  return Qnil;
+}
+
+/* waits for the descriptor; an exception is saved in p->state for later */
+static int tarruby_io_wait(struct tarruby_io *p, int events) {
+  p->events = events;
+  rb_protect(tarruby_io_wait0, (VALUE) p, &p->state);
+
+  if (p->state) {
+    errno = EINTR;
     return -1;
   }
 
-#ifndef _WIN32
-  fd = open(pathname, oflags, mode);
+  return 0;
+}
 
-  if (fd == -1) {
+static int tarruby_io_retry(struct tarruby_io *p, int events) {
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return tarruby_io_wait(p, events) == 0;
+  }
+
+  if (errno == EINTR) {
+    rb_protect((VALUE (*)(VALUE)) rb_thread_check_ints, Qnil, &p->state);
+    return !p->state;
+  }
+
+  return 0;
+}
+
+/* returns as soon as anything was read, so a socket is never read past the end of the archive */
+static ssize_t tarruby_io_read_some(struct tarruby_io *p, void *buf, size_t len) {
+  ssize_t n;
+  VALUE v;
+
+  if (!NIL_P(p->pending)) {
+    n = RSTRING_LEN(p->pending) - p->pending_off;
+    if ((size_t) n > len) { n = len; }
+    memcpy(buf, RSTRING_PTR(p->pending) + p->pending_off, n);
+    p->pending_off += n;
+    if (p->pending_off == RSTRING_LEN(p->pending)) { p->pending = Qnil; }
+
+    return n;
+  }
+
+  if (p->fd != -1) {
+    while ((n = read(p->fd, buf, len)) == -1) {
+      if (!tarruby_io_retry(p, RB_WAITFD_IN)) { return -1; }
+    }
+
+    return n;
+  }
+
+  p->buf = (char *) buf;
+  p->len = len;
+  v = rb_protect(tarruby_io_read0, (VALUE) p, &p->state);
+
+  if (p->state) {
+    errno = EIO;
     return -1;
   }
 
-  if ((oflags & O_CREAT) && fchmod(fd, mode)) {
+  return NUM2LONG(v);
+}
+
+/* libtar wants whole blocks, so short reads from pipes and sockets are continued */
+static ssize_t tarruby_io_read(long fd, void *buf, size_t len) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < len) {
+    if ((n = tarruby_io_read_some(p, (char *) buf + done, len - done)) == -1) {
+      return -1;
+    }
+
+    if (n == 0) {
+      break;
+    }
+
+    done += n;
+  }
+
+  return done;
+}
+
+static ssize_t tarruby_io_write(long fd, const void *buf, size_t len) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  size_t done = 0;
+  ssize_t n;
+
+  if (p->fd == -1) {
+    p->buf = (char *) buf;
+    p->len = len;
+    rb_protect(tarruby_io_write0, (VALUE) p, &p->state);
+
+    if (p->state) {
+      errno = EIO;
+      return -1;
+    }
+
+    return len;
+  }
+
+  while (done < len) {
+    n = write(p->fd, (const char *) buf + done, len - done);
+
+    if (n == -1) {
+      if (tarruby_io_retry(p, RB_WAITFD_OUT)) { continue; }
+      return -1;
+    }
+
+    done += n;
+  }
+
+  return done;
+}
+
+/* the IO belongs to the caller and is left open */
+static int tarruby_io_close(long fd) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+
+  if (p->fd == -1 && !NIL_P(p->io)) {
+    rb_protect(tarruby_io_flush0, (VALUE) p, &p->state);
+
+    if (p->state) {
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static VALUE tarruby_io_seek0(VALUE arg) {
+  struct tarruby_io *p = (struct tarruby_io *) arg;
+
+  if (p->offset != 0 || p->whence != SEEK_CUR) {
+    rb_funcall(p->io, rb_intern("seek"), 2, LL2NUM(p->offset), INT2FIX(p->whence));
+  }
+
+  return rb_funcall(p->io, rb_intern("pos"), 0);
+}
+
+/* lets libtar skip contents and find the end of an archive to append to; pipes fail with ESPIPE */
+static tar_off_t tarruby_io_seek(long fd, tar_off_t offset, int whence) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  tar_off_t pos;
+  VALUE v;
+
+  if (p->fd != -1) {
+    /* the descriptor is ahead of the archive by what is left of the read-ahead bytes */
+    if (!NIL_P(p->pending) && whence == SEEK_CUR) {
+      offset -= RSTRING_LEN(p->pending) - p->pending_off;
+    }
+
+    if ((pos = lseek(p->fd, (off_t) offset, whence)) != -1) {
+      p->pending = Qnil;
+    }
+
+    return pos;
+  }
+
+  if (!rb_respond_to(p->io, rb_intern("seek")) || !rb_respond_to(p->io, rb_intern("pos"))) {
+    errno = ESPIPE;
     return -1;
   }
 
-  gzf = gzdopen(fd, gzoflags);
-#else
-  gzf = gzopen(pathname, gzoflags);
+  p->offset = offset;
+  p->whence = whence;
+  v = rb_protect(tarruby_io_seek0, (VALUE) p, &p->state);
+
+  if (p->state) {
+    errno = EIO;
+    return -1;
+  }
+
+  return NUM2LL(v);
+}
+
+static tartype_t tarruby_io_type = {
+  (openfunc_t)  NULL,
+  (closefunc_t) tarruby_io_close,
+  (readfunc_t)  tarruby_io_read,
+  (writefunc_t) tarruby_io_write,
+  (seekfunc_t)  tarruby_io_seek
+};
+
+/* zlib and bzip2 count in unsigned ints */
+#define ZIO_MAX_LEN (1 << 30)
+
+#ifdef HAVE_ZLIB_H
+/* a gzip stream on top of an IO, compressed CHUNK_SIZE bytes at a time */
+struct tarruby_gzio {
+  z_stream z;
+  int writing;
+  int eof;
+  char buf[CHUNK_SIZE];
+};
+
+static int tarruby_gzio_init(struct tarruby_io *p, int oflags) {
+  struct tarruby_gzio *gz;
+  int i;
+
+  if ((oflags & O_ACCMODE) == O_RDWR) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  gz = ZALLOC(struct tarruby_gzio);
+  gz->writing = ((oflags & O_ACCMODE) == O_WRONLY);
+
+  /* 16: write a gzip header, 32: accept gzip or zlib headers */
+  if (gz->writing) {
+    i = deflateInit2(&gz->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  } else {
+    i = inflateInit2(&gz->z, 15 + 32);
+  }
+
+  if (i != Z_OK) {
+    xfree(gz);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  p->z = gz;
+
+  return 0;
+}
+
+static ssize_t tarruby_gzio_read(long fd, void *buf, size_t len) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  struct tarruby_gzio *gz = (struct tarruby_gzio *) p->z;
+  ssize_t n;
+  int i;
+
+  if (len > ZIO_MAX_LEN) { len = ZIO_MAX_LEN; }
+  gz->z.next_out = (Bytef *) buf;
+  gz->z.avail_out = (uInt) len;
+
+  while (gz->z.avail_out > 0 && !gz->eof) {
+    if (gz->z.avail_in == 0) {
+      if ((n = tarruby_io_read_some(p, gz->buf, sizeof(gz->buf))) == -1) {
+        return -1;
+      }
+
+      if (n == 0) {
+        gz->eof = 1;
+        break;
+      }
+
+      gz->z.next_in = (Bytef *) gz->buf;
+      gz->z.avail_in = (uInt) n;
+    }
+
+    i = inflate(&gz->z, Z_NO_FLUSH);
+
+    if (i == Z_STREAM_END) {
+      /* concatenated gzip members are read as one stream */
+      inflateReset(&gz->z);
+    } else if (i != Z_OK && i != Z_BUF_ERROR) {
+      errno = (i == Z_MEM_ERROR) ? ENOMEM : EIO;
+      return -1;
+    }
+  }
+
+  return len - gz->z.avail_out;
+}
+
+static int tarruby_gzio_deflate(struct tarruby_io *p, struct tarruby_gzio *gz, int flush) {
+  size_t have;
+  int i;
+
+  do {
+    gz->z.next_out = (Bytef *) gz->buf;
+    gz->z.avail_out = sizeof(gz->buf);
+    i = deflate(&gz->z, flush);
+
+    if (i == Z_STREAM_ERROR) {
+      errno = EIO;
+      return -1;
+    }
+
+    have = sizeof(gz->buf) - gz->z.avail_out;
+
+    if (have > 0 && tarruby_io_write((long) p, gz->buf, have) != (ssize_t) have) {
+      return -1;
+    }
+  } while (flush == Z_FINISH ? i != Z_STREAM_END : gz->z.avail_out == 0);
+
+  return 0;
+}
+
+static ssize_t tarruby_gzio_write(long fd, const void *buf, size_t len) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  struct tarruby_gzio *gz = (struct tarruby_gzio *) p->z;
+
+  if (len > ZIO_MAX_LEN) { len = ZIO_MAX_LEN; }
+  gz->z.next_in = (Bytef *) buf;
+  gz->z.avail_in = (uInt) len;
+
+  return (tarruby_gzio_deflate(p, gz, Z_NO_FLUSH) == 0) ? (ssize_t) len : -1;
+}
+
+/* the trailer is not written when the archive is freed by the GC without being closed */
+static int tarruby_gzio_close(long fd) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  struct tarruby_gzio *gz = (struct tarruby_gzio *) p->z;
+  int result = 0;
+
+  if (gz->writing) {
+    if (!NIL_P(p->io)) { result = tarruby_gzio_deflate(p, gz, Z_FINISH); }
+    deflateEnd(&gz->z);
+  } else {
+    inflateEnd(&gz->z);
+  }
+
+  xfree(gz);
+  p->z = NULL;
+
+  return (tarruby_io_close(fd) == 0) ? result : -1;
+}
+
+static tartype_t tarruby_gzio_type = {
+  (openfunc_t)  NULL,
+  (closefunc_t) tarruby_gzio_close,
+  (readfunc_t)  tarruby_gzio_read,
+  (writefunc_t) tarruby_gzio_write,
+  (seekfunc_t)  NULL
+};
 #endif
-  if (!gzf) {
+
+#ifdef HAVE_BZLIB_H
+/* a bzip2 stream on top of an IO, compressed CHUNK_SIZE bytes at a time */
+struct tarruby_bzio {
+  bz_stream bz;
+  int writing;
+  int eof;
+  char buf[CHUNK_SIZE];
+};
+
+static int tarruby_bzio_init(struct tarruby_io *p, int oflags) {
+  struct tarruby_bzio *bz;
+  int i;
+
+  if ((oflags & O_ACCMODE) == O_RDWR) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  bz = ZALLOC(struct tarruby_bzio);
+  bz->writing = ((oflags & O_ACCMODE) == O_WRONLY);
+
+  if (bz->writing) {
+    i = BZ2_bzCompressInit(&bz->bz, 9, 0, 0);
+  } else {
+    i = BZ2_bzDecompressInit(&bz->bz, 0, 0);
+  }
+
+  if (i != BZ_OK) {
+    xfree(bz);
     errno = ENOMEM;
     return -1;
   }
 
-  return (int) gzf;
+  p->z = bz;
+
+  return 0;
+}
+
+static ssize_t tarruby_bzio_read(long fd, void *buf, size_t len) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  struct tarruby_bzio *bz = (struct tarruby_bzio *) p->z;
+  ssize_t n;
+  int i;
+
+  if (len > ZIO_MAX_LEN) { len = ZIO_MAX_LEN; }
+  bz->bz.next_out = (char *) buf;
+  bz->bz.avail_out = (unsigned int) len;
+
+  while (bz->bz.avail_out > 0 && !bz->eof) {
+    if (bz->bz.avail_in == 0) {
+      if ((n = tarruby_io_read_some(p, bz->buf, sizeof(bz->buf))) == -1) {
+        return -1;
+      }
+
+      if (n == 0) {
+        bz->eof = 1;
+        break;
+      }
+
+      bz->bz.next_in = bz->buf;
+      bz->bz.avail_in = (unsigned int) n;
+    }
+
+    i = BZ2_bzDecompress(&bz->bz);
+
+    if (i == BZ_STREAM_END) {
+      /* concatenated bzip2 streams (as written by pbzip2) are read as one */
+      char *next_in = bz->bz.next_in, *next_out = bz->bz.next_out;
+      unsigned int avail_in = bz->bz.avail_in, avail_out = bz->bz.avail_out;
+
+      BZ2_bzDecompressEnd(&bz->bz);
+
+      if (BZ2_bzDecompressInit(&bz->bz, 0, 0) != BZ_OK) {
+        errno = ENOMEM;
+        return -1;
+      }
+
+      bz->bz.next_in = next_in;
+      bz->bz.avail_in = avail_in;
+      bz->bz.next_out = next_out;
+      bz->bz.avail_out = avail_out;
+    } else if (i != BZ_OK) {
+      errno = (i == BZ_MEM_ERROR) ? ENOMEM : EIO;
+      return -1;
+    }
+  }
+
+  return len - bz->bz.avail_out;
+}
+
+static int tarruby_bzio_compress(struct tarruby_io *p, struct tarruby_bzio *bz, int action) {
+  size_t have;
+  int i;
+
+  do {
+    bz->bz.next_out = bz->buf;
+    bz->bz.avail_out = sizeof(bz->buf);
+    i = BZ2_bzCompress(&bz->bz, action);
+
+    if (i < 0) {
+      errno = EIO;
+      return -1;
+    }
+
+    have = sizeof(bz->buf) - bz->bz.avail_out;
+
+    if (have > 0 && tarruby_io_write((long) p, bz->buf, have) != (ssize_t) have) {
+      return -1;
+    }
+  } while (action == BZ_FINISH ? i != BZ_STREAM_END : bz->bz.avail_in > 0);
+
+  return 0;
+}
+
+static ssize_t tarruby_bzio_write(long fd, const void *buf, size_t len) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  struct tarruby_bzio *bz = (struct tarruby_bzio *) p->z;
+
+  if (len > ZIO_MAX_LEN) { len = ZIO_MAX_LEN; }
+  bz->bz.next_in = (char *) buf;
+  bz->bz.avail_in = (unsigned int) len;
+
+  return (tarruby_bzio_compress(p, bz, BZ_RUN) == 0) ? (ssize_t) len : -1;
+}
+
+static int tarruby_bzio_close(long fd) {
+  struct tarruby_io *p = (struct tarruby_io *) fd;
+  struct tarruby_bzio *bz = (struct tarruby_bzio *) p->z;
+  int result = 0;
+
+  if (bz->writing) {
+    if (!NIL_P(p->io)) { result = tarruby_bzio_compress(p, bz, BZ_FINISH); }
+    BZ2_bzCompressEnd(&bz->bz);
+  } else {
+    BZ2_bzDecompressEnd(&bz->bz);
+  }
+
+  xfree(bz);
+  p->z = NULL;
+
+  return (tarruby_io_close(fd) == 0) ? result : -1;
+}
+
+static tartype_t tarruby_bzio_type = {
+  (openfunc_t)  NULL,
+  (closefunc_t) tarruby_bzio_close,
+  (readfunc_t)  tarruby_bzio_read,
+  (writefunc_t) tarruby_bzio_write,
+  (seekfunc_t)  NULL
+};
+#endif
+
+/* the hooks of these types call into Ruby */
+static int tarruby_is_io_type(tartype_t *type) {
+#ifdef HAVE_ZLIB_H
+  if (type == &tarruby_gzio_type) { return 1; }
+#endif
+#ifdef HAVE_BZLIB_H
+  if (type == &tarruby_bzio_type) { return 1; }
+#endif
+  return type == &tarruby_io_type;
+}
+
+/* the handles are busy until the call returns, so no other thread can use or free them meanwhile */
+static void tarruby_hold(struct tarruby_call *call) {
+  if (call->handle->busy || (call->source && call->source->busy)) {
+    rb_raise(Error, "Archive is in use by another call");
+  }
+
+  call->handle->busy = 1;
+  if (call->source) { call->source->busy = 1; }
+}
+
+static void tarruby_release(struct tarruby_call *call) {
+  call->handle->busy = 0;
+  if (call->source) { call->source->busy = 0; }
+}
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) && defined(TARRUBY_THREAD_LOCAL)
+/* the call this thread is making without the GVL */
+static TARRUBY_THREAD_LOCAL struct tarruby_call *tarruby_current_call;
+
+static void *tarruby_check_ints(void *arg) {
+  rb_protect((VALUE (*)(VALUE)) rb_thread_check_ints, Qnil, (int *) arg);
+  return NULL;
+}
+
+/* runs the interrupt that broke a read or write of a plain archive; the call goes on unless it raised */
+static int tarruby_resume(void) {
+  struct tarruby_call *call = tarruby_current_call;
+
+  if (!call || call->state) {
+    return 0;
+  }
+
+  rb_thread_call_with_gvl(tarruby_check_ints, &call->state);
+
+  return !call->state;
+}
+
+static void *tarruby_nogvl0(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+
+  tarruby_current_call = call;
+  call->func(call);
+  tarruby_current_call = NULL;
+
+  return NULL;
+}
+
+#ifdef HAVE_ZLIB_H
+static tartype_t gztype;
+#endif
+#ifdef HAVE_BZLIB_H
+static tartype_t bztype;
+#endif
+
+/* only the plain file functions can be resumed after EINTR; zlib and bzip2 would lose their place */
+static rb_unblock_function_t *tarruby_ubf(TAR *t) {
+#ifdef HAVE_ZLIB_H
+  if (t->type == &gztype) { return NULL; }
+#endif
+#ifdef HAVE_BZLIB_H
+  if (t->type == &bztype) { return NULL; }
+#endif
+  return RUBY_UBF_IO;
+}
+#endif
+
+/* libtar must not touch Ruby objects here; an interrupted read/write is resumed by tarruby_resume */
+static int tarruby_call_nogvl(void *(*func)(void *), struct tarruby_call *call) {
+  struct tarruby_io *io = &call->handle->io, *src_io = call->source ? &call->source->io : NULL;
+  int state;
+
+  tarruby_hold(call);
+
+  /* the IO hooks need the GVL, and give it up in rb_io_wait instead */
+  if (tarruby_is_io_type(call->tar->type) || (call->source && tarruby_is_io_type(call->source->tar->type))) {
+    func(call);
+    tarruby_release(call);
+
+    if (io->state || (src_io && src_io->state)) {
+      state = io->state ? io->state : src_io->state;
+      io->state = 0;
+      if (src_io) { src_io->state = 0; }
+      rb_jump_tag(state);
+    }
+
+    errno = call->error;
+
+    return call->result;
+  }
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) && defined(TARRUBY_THREAD_LOCAL)
+  call->func = func;
+  call->state = 0;
+  rb_thread_call_without_gvl(tarruby_nogvl0, call, tarruby_ubf(call->tar), NULL);
+  tarruby_release(call);
+
+  if (call->state) {
+    rb_jump_tag(call->state);
+  }
+#elif defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+  /* nothing would resume a read cut short, so the call runs to the end before interrupts are handled */
+  rb_thread_call_without_gvl(func, call, NULL, NULL);
+  tarruby_release(call);
+#else
+  func(call);
+  tarruby_release(call);
+#endif
+
+  errno = call->error;
+
+  return call->result;
+}
+
+/* an archive that was written to gets its end-of-archive marker first */
+static void *tarruby_close_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  int result = 0, error = 0;
+
+  if ((call->tar->oflags & O_ACCMODE) != O_RDONLY && tar_append_eof(call->tar) != 0) {
+    result = -1;
+    error = errno;
+  }
+
+  if (tar_close(call->tar) != 0 && result == 0) {
+    result = -1;
+    error = errno;
+  }
+
+  call->result = result;
+  call->error = error;
+  return NULL;
+}
+
+static void *tarruby_append_file_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_append_file(call->tar, call->s1, call->s2);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_append_header_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_append_header(call->tar, call->s1, call->size, call->mode, call->mtime);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_write_data_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_write_data(call->tar, call->data, (size_t) call->size);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_append_tree_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_append_tree(call->tar, call->s1, call->s2);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_append_buffers_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_append_buffers(call->tar, (tar_buffer_t *) call->data, (size_t) call->size, call->mode, call->mtime, call->uid, call->gid);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_append_list_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_append_list(call->tar, (tar_listent_t *) call->data, (size_t) call->size);
+  call->error = errno;
+  return NULL;
+}
+
+/* load the snapshot, add what changed and write the snapshot back */
+static void *tarruby_append_tree_incremental_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  const char *snapshot = (const char *) call->data;
+  tar_snapshot_t *ts;
+
+  if (tar_snapshot_open(&ts, snapshot) != 0) {
+    call->result = -1;
+    call->error = errno;
+    return NULL;
+  }
+
+  call->result = tar_append_tree_incremental(call->tar, ts, call->s1, call->s2);
+
+  if (call->result == 0) {
+    call->result = tar_snapshot_save(ts, snapshot);
+  }
+
+  call->error = errno;
+  tar_snapshot_free(ts);
+  return NULL;
+}
+
+static void *tarruby_extract_file_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_extract_file(call->tar, call->s1);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_extract_glob_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+
+  if (tar_set_durability(call->tar, call->durability) != 0) {
+    call->result = -1;
+    call->error = errno;
+    return NULL;
+  }
+
+  call->result = tar_extract_glob(call->tar, call->s1, call->s2);
+  call->error = errno;
+  tar_set_durability(call->tar, TAR_DURABLE_NONE);
+  return NULL;
+}
+
+static void *tarruby_extract_globs_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+
+  if (tar_set_durability(call->tar, call->durability) != 0) {
+    call->result = -1;
+    call->error = errno;
+    return NULL;
+  }
+
+  call->result = tar_extract_globs(call->tar, (tar_matcher_t *) call->data, call->s1);
+  call->error = errno;
+  tar_set_durability(call->tar, TAR_DURABLE_NONE);
+  return NULL;
+}
+
+static void *tarruby_extract_all_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+
+  if (tar_set_durability(call->tar, call->durability) != 0) {
+    call->result = -1;
+    call->error = errno;
+    return NULL;
+  }
+
+  call->result = tar_extract_all(call->tar, call->s1);
+  call->error = errno;
+  tar_set_durability(call->tar, TAR_DURABLE_NONE);
+  return NULL;
+}
+
+static void *tarruby_skip_regfile_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_skip_regfile(call->tar);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_read_data_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  ssize_t n = tar_read_data(call->tar, call->data, (size_t) call->size);
+  call->result = (n == -1) ? -1 : 0;
+  call->size = n;
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_th_read_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = th_read(call->tar);
+  call->error = errno;
+  return NULL;
+}
+
+static void *tarruby_th_read_match_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = th_read_match(call->tar, (tar_filter_t *) call->data);
+  call->error = errno;
+  return NULL;
+}
+
+#ifdef HAVE_ZLIB_H
+// copy from libtar.c
+// Copyright 1998-2003 University of Illinois Board of Trustees
+// Copyright 1998-2003 Mark D. Roth
+static long gzopen_frontend(const char *pathname, int oflags, int mode) {
+  const char *gzoflags;
+  gzFile gzf;
+#ifndef _WIN32
+  int fd;
+#endif
+
+  switch (oflags & O_ACCMODE) {
+  case O_WRONLY:
+    gzoflags = "wb";
+    break;
+
+  case O_RDONLY:
+    gzoflags = "rb";
+    break;
+
+  default:
+  case O_RDWR:
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifndef _WIN32
+  fd = open(pathname, oflags, mode);
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  if ((oflags & O_CREAT) && fchmod(fd, mode)) {
+    close(fd);
+    return -1;
+  }
+
+  gzf = gzdopen(fd, gzoflags);
+#else
+  gzf = gzopen(pathname, gzoflags);
+#endif
+  if (!gzf) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return (long) gzf;
+}
+
+/* the handle is a pointer, and zlib counts in unsigned ints */
+static int gzclose_frontend(long fd) {
+  return (gzclose((gzFile) fd) == Z_OK) ? 0 : -1;
+}
+
+static ssize_t gzread_frontend(long fd, void *buf, size_t len) {
+  return gzread((gzFile) fd, buf, (unsigned) ((len > ZIO_MAX_LEN) ? ZIO_MAX_LEN : len));
+}
+
+static ssize_t gzwrite_frontend(long fd, const void *buf, size_t len) {
+  int n = gzwrite((gzFile) fd, buf, (unsigned) ((len > ZIO_MAX_LEN) ? ZIO_MAX_LEN : len));
+
+  if (n == 0 && len > 0) {
+    errno = EIO;
+    return -1;
+  }
+
+  return n;
+}
+
+static tartype_t gztype = {
+  (openfunc_t)  gzopen_frontend,
+  (closefunc_t) gzclose_frontend,
+  (readfunc_t)  gzread_frontend,
+  (writefunc_t) gzwrite_frontend,
+  (seekfunc_t)  NULL
+};
+#endif
+
+#ifdef HAVE_BZLIB_H
+static long bzopen_frontend(const char *pathname, int oflags, int mode) {
+  const char *bzoflags;
+  BZFILE *bzf;
+#ifndef _WIN32
+  int fd;
+#endif
+
+  switch (oflags & O_ACCMODE) {
+  case O_WRONLY:
+    bzoflags = "wb";
+    break;
+
+  case O_RDONLY:
+    bzoflags = "rb";
+    break;
+
+  default:
+  case O_RDWR:
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifndef _WIN32
+  fd = open(pathname, oflags, mode);
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  if ((oflags & O_CREAT) && fchmod(fd, mode)) {
+    close(fd);
+    return -1;
+  }
+
+  bzf = BZ2_bzdopen(fd, bzoflags);
+#else
+  bzf = BZ2_bzopen(pathname, bzoflags);
+#endif
+  if (!bzf) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return (long) bzf;
+}
+
+static int bzclose_frontend(long fd) {
+  BZ2_bzclose((BZFILE *) fd);
+  return 0;
+}
+
+static ssize_t bzread_frontend(long fd, void *buf, size_t len) {
+  return BZ2_bzread((BZFILE *) fd, buf, (int) ((len > ZIO_MAX_LEN) ? ZIO_MAX_LEN : len));
+}
+
+static ssize_t bzwrite_frontend(long fd, const void *buf, size_t len) {
+  return BZ2_bzwrite((BZFILE *) fd, (void *) buf, (int) ((len > ZIO_MAX_LEN) ? ZIO_MAX_LEN : len));
+}
+
+static tartype_t bztype = {
+  (openfunc_t)  bzopen_frontend,
+  (closefunc_t) bzclose_frontend,
+  (readfunc_t)  bzread_frontend,
+  (writefunc_t) bzwrite_frontend,
+  (seekfunc_t)  NULL
+};
+#endif
+
+/* the path without a trailing separator; the caller's string is left alone */
+static VALUE strip_sep(VALUE path) {
+  long len;
+
+  Check_Type(path, T_STRING);
+  len = RSTRING_LEN(path);
+
+  if (len > 0 && (RSTRING_PTR(path)[len - 1] == '/' || RSTRING_PTR(path)[len - 1] == '\\')) {
+    return rb_str_new(RSTRING_PTR(path), len - 1);
+  }
+
+  return rb_str_new_frozen(path);
+}
+
+static void tarruby_tar_mark(void *ptr) {
+  struct tarruby_tar *p = (struct tarruby_tar *) ptr;
+  rb_gc_mark(p->io.io);
+  rb_gc_mark(p->io.pending);
+}
+
+/* an archive that was never closed is closed here, without calling into Ruby */
+static void tarruby_tar_free(void *ptr) {
+  struct tarruby_tar *p = (struct tarruby_tar *) ptr;
+
+  if (p->tar) {
+    p->io.io = Qnil;
+    tar_close(p->tar);
+  }
+
+  xfree(p);
+}
+
+static size_t tarruby_tar_memsize(const void *ptr) {
+  const struct tarruby_tar *p = (const struct tarruby_tar *) ptr;
+  return sizeof(struct tarruby_tar) + (p->tar ? sizeof(TAR) : 0);
+}
+
+static const rb_data_type_t tarruby_tar_type = {
+  "tarruby",
+  { tarruby_tar_mark, tarruby_tar_free, tarruby_tar_memsize, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE tarruby_tar_alloc(VALUE klass) {
+  struct tarruby_tar *p;
+  VALUE tar = TypedData_Make_Struct(klass, struct tarruby_tar, &tarruby_tar_type, p);
+
+  p->tar = NULL;
+  p->extracted = 1;
+  p->generation = 0;
+  p->busy = 0;
+  p->io.io = Qnil;
+  p->io.fd = -1;
+  p->io.state = 0;
+  p->io.z = NULL;
+  p->io.pending = Qnil;
+
+  return tar;
+}
+
+/* all methods but #close need the archive to be open */
+static struct tarruby_tar *tarruby_get_tar(VALUE self) {
+  struct tarruby_tar *p_tar;
+
+  TypedData_Get_Struct(self, struct tarruby_tar, &tarruby_tar_type, p_tar);
+
+  if (!p_tar->tar) {
+    rb_raise(Error, "Archive is closed");
+  }
+
+  if (p_tar->busy) {
+    rb_raise(Error, "Archive is in use by another call");
+  }
+
+  return p_tar;
+}
+
+/* */
+static VALUE tarruby_close0(VALUE self, int abort) {
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+
+  TypedData_Get_Struct(self, struct tarruby_tar, &tarruby_tar_type, p_tar);
+
+  if (!p_tar->tar) {
+    return Qnil;
+  }
+
+  if (p_tar->busy) {
+    rb_raise(Error, "Archive is in use by another call");
+  }
+
+  /* flushes the gzip/bzip2 stream, which can take a while */
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  p_tar->tar = NULL;
+
+  if (tarruby_call_nogvl(tarruby_close_nogvl, &call) != 0 && abort) {
+    rb_raise(Error, "Close archive failed: %s", strerror(errno));
+  }
+
+  return Qnil;
+}
+
+/* */
+static VALUE tarruby_close(VALUE self) {
+  return tarruby_close0(self, 1);
+}
+
+/* reads and writes go straight to the descriptor, as IO::Buffer#read/#write do */
+static void tarruby_io_init(struct tarruby_io *p, VALUE io) {
+#ifdef HAVE_RB_IO_READ_PENDING
+  rb_io_t *fptr;
+  VALUE str;
+#endif
+
+  p->io = io;
+  p->fd = -1;
+  p->pending = Qnil;
+  p->pending_off = 0;
+
+  if (TYPE(io) == T_FILE) {
+    rb_io_flush(io);
+#ifdef HAVE_RB_IO_READ_PENDING
+    /* bytes already in Ruby's read buffer (after IO#gets, say) come first */
+    GetOpenFile(io, fptr);
+
+    while (rb_io_read_pending(fptr) > 0) {
+      str = rb_funcall(io, rb_intern("readpartial"), 1, INT2NUM(CHUNK_SIZE));
+      p->pending = NIL_P(p->pending) ? str : rb_str_append(p->pending, str);
+    }
+#else
+    /* what Ruby may have buffered can't be seen, so reads go through #read */
+    if (rb_respond_to(io, rb_intern("read"))) {
+      return;
+    }
+#endif
+#ifdef HAVE_RB_IO_DESCRIPTOR
+    p->fd = rb_io_descriptor(io);
+#else
+    p->fd = NUM2INT(rb_funcall(io, rb_intern("fileno"), 0));
+#endif
+  }
+}
+
+/* an IO is read and written through the tarruby_*io_type hooks, compressed if tartype says so */
+static void tarruby_open0(VALUE self, VALUE pathname, tartype_t *tartype, VALUE oflags, VALUE mode, VALUE options) {
+  struct tarruby_tar *p_tar;
+  tartype_t *iotype = &tarruby_io_type;
+  int i_oflags, i_mode = 0644, i_options = 0;
+  int is_io, result;
+
+  is_io = TYPE(pathname) != T_STRING
+    && (rb_respond_to(pathname, rb_intern("read")) || rb_respond_to(pathname, rb_intern("write")));
+  if (!is_io) { Check_Type(pathname, T_STRING); }
+  i_oflags = NUM2INT(oflags);
+  if (!NIL_P(mode)) { i_mode = NUM2INT(mode); }
+  if (!NIL_P(options)) { i_options = NUM2INT(options); }
+
+  TypedData_Get_Struct(self, struct tarruby_tar, &tarruby_tar_type, p_tar);
+
+  if (p_tar->tar) {
+    rb_raise(Error, "Archive is already open");
+  }
+
+  if (is_io) {
+    tarruby_io_init(&p_tar->io, pathname);
+    result = 0;
+
+#ifdef HAVE_ZLIB_H
+    if (tartype == &gztype) {
+      iotype = &tarruby_gzio_type;
+      result = tarruby_gzio_init(&p_tar->io, i_oflags);
+    }
+#endif
+#ifdef HAVE_BZLIB_H
+    if (tartype == &bztype) {
+      iotype = &tarruby_bzio_type;
+      result = tarruby_bzio_init(&p_tar->io, i_oflags);
+    }
+#endif
+
+    if (result == 0) {
+      result = tar_fdopen(&p_tar->tar, (long) &p_tar->io, NULL, iotype, i_oflags, i_mode, i_options);
+
+      if (result == -1 && p_tar->io.z) {
+        iotype->closefunc((long) &p_tar->io);
+      }
+    }
+  } else {
+    result = tar_open(&p_tar->tar, RSTRING_PTR(pathname), tartype, i_oflags, i_mode, i_options);
+  }
+
+  if (result == -1) {
+    p_tar->tar = NULL;
+    rb_raise(Error, "Open archive failed: %s", strerror(errno));
+  }
+}
+
+static VALUE tarruby_s_open0(int argc, VALUE *argv, VALUE self, tartype_t *tartype) {
+  VALUE tar, pathname, oflags, mode, options;
+
+  rb_scan_args(argc, argv, "22", &pathname, &oflags, &mode, &options);
+  tar = rb_obj_alloc(Tar);
+  tarruby_open0(tar, pathname, tartype, oflags, mode, options);
+
+  if (rb_block_given_p()) {
+    VALUE retval;
+    int status;
+
+    retval = rb_protect(rb_yield, tar, &status);
+    tarruby_close0(tar, 0);
+
+    if (status != 0) {
+      rb_jump_tag(status);
+    }
+
+    return retval;
+  } else {
+    return tar;
+  }
+}
+
+/* */
+static VALUE tarruby_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE io, oflags, options;
+
+  rb_scan_args(argc, argv, "21", &io, &oflags, &options);
+  tarruby_open0(self, io, NULL, oflags, Qnil, options);
+
+  return self;
+}
+
+/* */
+static VALUE tarruby_s_open(int argc, VALUE *argv, VALUE self) {
+  return tarruby_s_open0(argc, argv, self, NULL);
+}
+
+#ifdef HAVE_ZLIB_H
+/* */
+static VALUE tarruby_s_gzopen(int argc, VALUE *argv, VALUE self) {
+  return tarruby_s_open0(argc, argv, self, &gztype);
+}
+#endif
+
+#ifdef HAVE_BZLIB_H
+/* */
+static VALUE tarruby_s_bzopen(int argc, VALUE *argv, VALUE self) {
+  return tarruby_s_open0(argc, argv, self, &bztype);
+}
+#endif
+
+/* */
+static VALUE tarruby_append_file(int argc, VALUE *argv, VALUE self) {
+  VALUE realname, savename;
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  char *s_realname, *s_savename = NULL;
+
+  rb_scan_args(argc, argv, "11", &realname, &savename);
+  realname = strip_sep(realname);
+  s_realname = RSTRING_PTR(realname);
+
+  if (!NIL_P(savename)) {
+    savename = strip_sep(savename);
+    s_savename = RSTRING_PTR(savename);
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_realname;
+  call.s2 = s_savename;
+
+  if (tarruby_call_nogvl(tarruby_append_file_nogvl, &call) != 0) {
+    rb_raise(Error, "Append file failed: %s", strerror(errno));
+  }
+
+  RB_GC_GUARD(realname);
+  RB_GC_GUARD(savename);
+  return Qnil;
+}
+
+static void tarruby_append_header(struct tarruby_tar *p_tar, char *s_savename, tar_off_t size, mode_t mode, time_t mtime) {
+  struct tarruby_call call;
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_savename;
+  call.size = size;
+  call.mode = mode;
+  call.mtime = mtime;
+
+  if (tarruby_call_nogvl(tarruby_append_header_nogvl, &call) != 0) {
+    rb_raise(Error, "Append header failed: %s", strerror(errno));
+  }
+}
+
+static VALUE tarruby_write_data(VALUE arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+
+  if (tarruby_call_nogvl(tarruby_write_data_nogvl, call) != 0) {
+    rb_raise(Error, "Append data failed: %s", strerror(errno));
+  }
+
+  return Qnil;
+}
+
+/* the string is written in place, so it is locked while the GVL is released */
+static void tarruby_append_string(struct tarruby_tar *p_tar, char *s_savename, VALUE buffer, mode_t mode, time_t mtime) {
+  struct tarruby_call call;
+
+  tarruby_append_header(p_tar, s_savename, RSTRING_LEN(buffer), mode, mtime);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.data = RSTRING_PTR(buffer);
+  call.size = RSTRING_LEN(buffer);
+
+  rb_str_locktmp(buffer);
+  rb_ensure(tarruby_write_data, (VALUE) &call, rb_str_unlocktmp, buffer);
+}
+
+/* reads the contents in CHUNK_SIZE pieces, so only one chunk is held in memory */
+static void tarruby_append_stream(struct tarruby_tar *p_tar, char *s_savename, VALUE io, tar_off_t size, mode_t mode, time_t mtime) {
+  struct tarruby_call call;
+  VALUE buf, chunk;
+  tar_off_t left = size;
+  long len;
+
+  tarruby_append_header(p_tar, s_savename, size, mode, mtime);
+  buf = rb_str_buf_new(CHUNK_SIZE);
+
+  while (left > 0) {
+    len = (left < CHUNK_SIZE) ? (long) left : CHUNK_SIZE;
+    chunk = rb_funcall(io, rb_intern("read"), 2, LONG2NUM(len), buf);
+
+    if (NIL_P(chunk) || RSTRING_LEN(StringValue(chunk)) == 0) {
+      rb_raise(Error, "Append IO failed: end of input after %lld of %lld bytes",
+        (long long) (size - left), (long long) size);
+    }
+
+    if (RSTRING_LEN(chunk) > len) {
+      rb_raise(rb_eIOError, "read returned more than %ld bytes", len);
+    }
+
+    if (!p_tar->tar) {
+      rb_raise(Error, "Archive is closed");
+    }
+
+    call.handle = p_tar;
+    call.source = NULL;
+    call.tar = p_tar->tar;
+    call.data = RSTRING_PTR(chunk);
+    call.size = RSTRING_LEN(chunk);
+    tarruby_write_data((VALUE) &call);
+    left -= call.size;
+  }
+}
+
+/* */
+static VALUE tarruby_append_buffer(VALUE self, VALUE savename, VALUE buffer) {
+  struct tarruby_tar *p_tar;
+  char *s_savename;
+
+  Check_Type(buffer, T_STRING);
+  savename = strip_sep(savename);
+  s_savename = RSTRING_PTR(savename);
+
+  p_tar = tarruby_get_tar(self);
+  tarruby_append_string(p_tar, s_savename, buffer, 0644, time(NULL));
+
+  RB_GC_GUARD(savename);
+  return Qnil;
+}
+
+/* sorts the keywords of append_buffers('a.js' => a, mode: 0644) into buffers and options */
+static int tarruby_split_buffers_i(VALUE key, VALUE value, VALUE arg) {
+  VALUE *split = (VALUE *) arg;
+
+  rb_hash_aset(SYMBOL_P(key) ? split[1] : split[0], key, value);
+
+  return ST_CONTINUE;
+}
+
+/* */
+static VALUE tarruby_append_buffers(int argc, VALUE *argv, VALUE self) {
+  VALUE buffers, opts, pair, savename, buffer, keep, v_bufs, kwargs[4], split[2];
+  ID kwids[4];
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  tar_buffer_t *bufs;
+  long i, n;
+
+  rb_scan_args(argc, argv, "01:", &buffers, &opts);
+
+  if (argc == 0) {
+    rb_error_arity(0, 1, 1);
+  }
+
+  /* without braces the savenames arrive as keywords too */
+  if (NIL_P(buffers) && !NIL_P(opts)) {
+    split[0] = rb_hash_new();
+    split[1] = rb_hash_new();
+    rb_hash_foreach(opts, tarruby_split_buffers_i, (VALUE) split);
+    buffers = split[0];
+    opts = RHASH_EMPTY_P(split[1]) ? Qnil : split[1];
+  }
+
+  kwids[0] = rb_intern("mode");
+  kwids[1] = rb_intern("mtime");
+  kwids[2] = rb_intern("uid");
+  kwids[3] = rb_intern("gid");
+  rb_get_kwargs(opts, kwids, 0, 4, kwargs);
+
+  call.mode = (kwargs[0] != Qundef && !NIL_P(kwargs[0])) ? NUM2INT(kwargs[0]) : 0644;
+  call.mtime = (kwargs[1] != Qundef && !NIL_P(kwargs[1])) ? (time_t) NUM2LL(rb_Integer(kwargs[1])) : time(NULL);
+  call.uid = (kwargs[2] != Qundef && !NIL_P(kwargs[2])) ? NUM2UINT(kwargs[2]) : 0;
+  call.gid = (kwargs[3] != Qundef && !NIL_P(kwargs[3])) ? NUM2UINT(kwargs[3]) : 0;
+
+  /* a Hash of savename => data, or an array of such pairs */
+  buffers = rb_Array(buffers);
+  n = RARRAY_LEN(buffers);
+  keep = rb_ary_new_capa(n * 2);
+  bufs = ALLOCV_N(tar_buffer_t, v_bufs, n);
+
+  /* frozen copies share the contents, and stay as they are while the GVL is released */
+  for (i = 0; i < n; i++) {
+    pair = rb_ary_entry(buffers, i);
+    Check_Type(pair, T_ARRAY);
+    savename = strip_sep(rb_ary_entry(pair, 0));
+    buffer = rb_ary_entry(pair, 1);
+    Check_Type(buffer, T_STRING);
+    buffer = rb_str_new_frozen(buffer);
+    rb_ary_push(keep, savename);
+    rb_ary_push(keep, buffer);
+
+    bufs[i].savename = RSTRING_PTR(savename);
+    bufs[i].data = RSTRING_PTR(buffer);
+    bufs[i].len = RSTRING_LEN(buffer);
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.data = bufs;
+  call.size = n;
+
+  if (tarruby_call_nogvl(tarruby_append_buffers_nogvl, &call) != 0) {
+    rb_raise(Error, "Append buffers failed: %s", strerror(errno));
+  }
+
+  ALLOCV_END(v_bufs);
+  RB_GC_GUARD(keep);
+  return Qnil;
+}
+
+/* */
+static VALUE tarruby_append_io(int argc, VALUE *argv, VALUE self) {
+  VALUE savename, io, opts, kwargs[3];
+  ID kwids[3];
+  struct tarruby_tar *p_tar;
+  char *s_savename;
+  tar_off_t size;
+  mode_t mode = 0644;
+  time_t mtime;
+
+  rb_scan_args(argc, argv, "2:", &savename, &io, &opts);
+  savename = strip_sep(savename);
+  s_savename = RSTRING_PTR(savename);
+
+  kwids[0] = rb_intern("size");
+  kwids[1] = rb_intern("mode");
+  kwids[2] = rb_intern("mtime");
+  rb_get_kwargs(opts, kwids, 0, 3, kwargs);
+
+  if (kwargs[1] != Qundef && !NIL_P(kwargs[1])) { mode = NUM2INT(kwargs[1]); }
+  mtime = (kwargs[2] != Qundef && !NIL_P(kwargs[2])) ? (time_t) NUM2LL(rb_Integer(kwargs[2])) : time(NULL);
+
+  p_tar = tarruby_get_tar(self);
+
+  if (TYPE(io) == T_STRING) {
+    if (kwargs[0] != Qundef && !NIL_P(kwargs[0]) && NUM2LL(kwargs[0]) != RSTRING_LEN(io)) {
+      rb_raise(rb_eArgError, "size does not match the string length");
+    }
+
+    tarruby_append_string(p_tar, s_savename, io, mode, mtime);
+    RB_GC_GUARD(savename);
+    return Qnil;
+  }
+
+  if (kwargs[0] != Qundef && !NIL_P(kwargs[0])) {
+    size = NUM2LL(kwargs[0]);
+  } else if (rb_respond_to(io, rb_intern("size"))) {
+    /* whatever is left of a File, StringIO or Tempfile */
+    size = NUM2LL(rb_funcall(io, rb_intern("size"), 0));
+    if (rb_respond_to(io, rb_intern("pos"))) { size -= NUM2LL(rb_funcall(io, rb_intern("pos"), 0)); }
+  } else {
+    rb_raise(rb_eArgError, "size is required for an IO without #size");
+  }
+
+  if (size < 0) {
+    rb_raise(rb_eArgError, "negative size");
+  }
+
+  tarruby_append_stream(p_tar, s_savename, io, size, mode, mtime);
+
+  RB_GC_GUARD(savename);
+  return Qnil;
+}
+
+/* */
+static VALUE tarruby_append_tree(int argc, VALUE *argv, VALUE self) {
+  VALUE realdir, savedir, opts, snapshot, prefetch, kwargs[2];
+  ID kwids[2];
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  char *s_realdir, *s_savedir = NULL;
+
+  rb_scan_args(argc, argv, "11:", &realdir, &savedir, &opts);
+
+  /* listed_incremental: the GNU snapshot file of the tree */
+  /* prefetch: files read ahead with Tar::PHYSICAL_ORDER or Tar::IO_URING */
+  kwids[0] = rb_intern("listed_incremental");
+  kwids[1] = rb_intern("prefetch");
+  rb_get_kwargs(opts, kwids, 0, 2, kwargs);
+  snapshot = kwargs[0];
+  prefetch = kwargs[1];
+
+  if (snapshot != Qundef && !NIL_P(snapshot)) {
+    snapshot = rb_str_new_frozen(rb_get_path(snapshot));
+  } else {
+    snapshot = Qnil;
+  }
+
+  realdir = strip_sep(realdir);
+  s_realdir = RSTRING_PTR(realdir);
+
+  if (!NIL_P(savedir)) {
+    savedir = strip_sep(savedir);
+    s_savedir = RSTRING_PTR(savedir);
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  if (prefetch != Qundef && !NIL_P(prefetch) && tar_set_prefetch(p_tar->tar, NUM2INT(prefetch)) != 0) {
+    rb_raise(rb_eArgError, "negative prefetch");
+  }
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_realdir;
+  call.s2 = s_savedir;
+
+  if (!NIL_P(snapshot)) {
+    call.data = StringValueCStr(snapshot);
+
+    if (tarruby_call_nogvl(tarruby_append_tree_incremental_nogvl, &call) != 0) {
+      rb_raise(Error, "Append tree failed: %s", strerror(errno));
+    }
+
+    RB_GC_GUARD(snapshot);
+    RB_GC_GUARD(realdir);
+    RB_GC_GUARD(savedir);
+    return Qnil;
+  }
+
+  if (tarruby_call_nogvl(tarruby_append_tree_nogvl, &call) != 0) {
+    rb_raise(Error, "Append tree failed: %s", strerror(errno));
+  }
+
+  RB_GC_GUARD(realdir);
+  RB_GC_GUARD(savedir);
+  return Qnil;
+}
+
+/* the struct stat of a File::Stat, as far as tar_append_list() needs it */
+static void tarruby_stat(VALUE st, struct stat *s) {
+  struct timespec ts;
+
+  memset(s, 0, sizeof(*s));
+  s->st_mode = NUM2UINT(rb_funcall(st, rb_intern("mode"), 0));
+  s->st_uid = NUM2UINT(rb_funcall(st, rb_intern("uid"), 0));
+  s->st_gid = NUM2UINT(rb_funcall(st, rb_intern("gid"), 0));
+  s->st_size = NUM2LL(rb_funcall(st, rb_intern("size"), 0));
+  s->st_ino = NUM2ULL(rb_funcall(st, rb_intern("ino"), 0));
+  s->st_dev = NUM2ULL(rb_funcall(st, rb_intern("dev"), 0));
+  s->st_rdev = NUM2ULL(rb_funcall(st, rb_intern("rdev"), 0));
+  s->st_nlink = NUM2ULL(rb_funcall(st, rb_intern("nlink"), 0));
+#ifndef _WIN32
+  s->st_blocks = NUM2LL(rb_Integer(rb_funcall(st, rb_intern("blocks"), 0)));
+#endif
+
+  ts = rb_time_timespec(rb_funcall(st, rb_intern("mtime"), 0));
+  s->st_mtime = ts.tv_sec;
+#if defined(__APPLE__)
+  s->st_mtimespec.tv_nsec = ts.tv_nsec;
+#elif defined(st_mtime)
+  s->st_mtim.tv_nsec = ts.tv_nsec;
+#endif
+}
+
+/* */
+static VALUE tarruby_append_files(int argc, VALUE *argv, VALUE self) {
+  VALUE list, opts, prefetch, entry, realname, savename, st, keep, v_files, v_stats;
+  ID kwids[1];
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  tar_listent_t *files;
+  struct stat *stats;
+  long i, n;
+
+  rb_scan_args(argc, argv, "1:", &list, &opts);
+
+  /* prefetch: files read ahead */
+  kwids[0] = rb_intern("prefetch");
+  rb_get_kwargs(opts, kwids, 0, 1, &prefetch);
+
+  list = rb_Array(list);
+  n = RARRAY_LEN(list);
+  keep = rb_ary_new_capa(n);
+  files = ALLOCV_N(tar_listent_t, v_files, n);
+  stats = ALLOCV_N(struct stat, v_stats, n);
+
+  /* each entry is realname, or [realname, savename, File::Stat] with the last two optional */
+  for (i = 0; i < n; i++) {
+    entry = rb_ary_entry(list, i);
+    savename = st = Qnil;
+
+    if (TYPE(entry) == T_ARRAY) {
+      realname = rb_ary_entry(entry, 0);
+      savename = rb_ary_entry(entry, 1);
+      st = rb_ary_entry(entry, 2);
+    } else {
+      realname = entry;
+    }
+
+    realname = strip_sep(realname);
+    rb_ary_push(keep, realname);
+    files[i].realname = RSTRING_PTR(realname);
+    files[i].savename = NULL;
+    files[i].st = NULL;
+
+    if (!NIL_P(savename)) {
+      savename = strip_sep(savename);
+      rb_ary_push(keep, savename);
+      files[i].savename = RSTRING_PTR(savename);
+    }
+
+    if (!NIL_P(st)) {
+      tarruby_stat(st, &stats[i]);
+      files[i].st = &stats[i];
+    }
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  if (prefetch != Qundef && !NIL_P(prefetch) && tar_set_prefetch(p_tar->tar, NUM2INT(prefetch)) != 0) {
+    rb_raise(rb_eArgError, "negative prefetch");
+  }
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.data = files;
+  call.size = n;
+
+  if (tarruby_call_nogvl(tarruby_append_list_nogvl, &call) != 0) {
+    rb_raise(Error, "Append files failed: %s", strerror(errno));
+  }
+
+  ALLOCV_END(v_files);
+  ALLOCV_END(v_stats);
+  RB_GC_GUARD(keep);
+  return Qnil;
+}
+
+/* */
+static VALUE tarruby_extract_file(VALUE self, VALUE realname) {
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  char *s_realname;
+
+  /* a frozen copy, which no other thread can change while the GVL is released */
+  Check_Type(realname, T_STRING);
+  realname = rb_str_new_frozen(realname);
+  s_realname = RSTRING_PTR(realname);
+  p_tar = tarruby_get_tar(self);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_realname;
+
+  if (tarruby_call_nogvl(tarruby_extract_file_nogvl, &call) != 0) {
+    rb_raise(Error, "Extract file failed: %s", strerror(errno));
+  }
+
+  p_tar->extracted = 1;
+  RB_GC_GUARD(realname);
+
+  return Qnil;
+}
+
+/* */
+static VALUE tarruby_extract_buffer(VALUE self) {
+  VALUE buffer;
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  tar_off_t size;
+
+  p_tar = tarruby_get_tar(self);
+
+  if (!TH_ISREG(p_tar->tar)) {
+    return Qnil;
+  }
+
+  if ((size = tar_data_left(p_tar->tar)) > LONG_MAX) {
+    rb_raise(Error, "Extract buffer failed: %s", strerror(EFBIG));
+  }
+
+  /* sized from the header and filled in one call, whole blocks straight into the string */
+  buffer = rb_str_new(NULL, (long) size);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.data = RSTRING_PTR(buffer);
+  call.size = size;
+
+  if (tarruby_call_nogvl(tarruby_read_data_nogvl, &call) != 0) {
+    rb_raise(Error, "Extract buffer failed: %s", strerror(errno));
+  }
+
+  rb_str_set_len(buffer, (long) call.size);
+  p_tar->extracted = 1;
+
+  return buffer;
+}
+
+/* durability: :none, :batch, :per_file or :atomic */
+static int tarruby_durability(VALUE opts) {
+  VALUE durability = Qundef;
+  ID kwid, id;
+
+  kwid = rb_intern("durability");
+  rb_get_kwargs(opts, &kwid, 0, 1, &durability);
+
+  if (durability == Qundef || NIL_P(durability)) {
+    return TAR_DURABLE_NONE;
+  }
+
+  Check_Type(durability, T_SYMBOL);
+  id = SYM2ID(durability);
+
+  if (id == rb_intern("none")) {
+    return TAR_DURABLE_NONE;
+  } else if (id == rb_intern("batch")) {
+    return TAR_DURABLE_BATCH;
+  } else if (id == rb_intern("per_file")) {
+    return TAR_DURABLE_PER_FILE;
+  } else if (id == rb_intern("atomic")) {
+    return TAR_DURABLE_ATOMIC;
+  }
+
+  rb_raise(rb_eArgError, "unknown durability: %s", rb_id2name(id));
+  return TAR_DURABLE_NONE;
+}
+
+/* */
+static VALUE tarruby_extract_glob(int argc, VALUE *argv, VALUE self) {
+  VALUE globname, prefix, opts;
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  char *s_globname, *s_prefix = NULL;
+
+  rb_scan_args(argc, argv, "11:", &globname, &prefix, &opts);
+  call.durability = tarruby_durability(opts);
+  Check_Type(globname, T_STRING);
+  globname = rb_str_new_frozen(globname);
+  s_globname = RSTRING_PTR(globname);
+
+  if (!NIL_P(prefix)) {
+    Check_Type(prefix, T_STRING);
+    prefix = rb_str_new_frozen(prefix);
+    s_prefix = RSTRING_PTR(prefix);
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_globname;
+  call.s2 = s_prefix;
+
+  p_tar->generation++;
+
+  if (tarruby_call_nogvl(tarruby_extract_glob_nogvl, &call) != 0) {
+    rb_raise(Error, "Extract archive failed: %s", strerror(errno));
+  }
+
+  p_tar->extracted = 1;
+  RB_GC_GUARD(globname);
+  RB_GC_GUARD(prefix);
+
+  return Qnil;
+}
+
+static void tarruby_matcher_free(void *ptr) {
+  tar_matcher_free((tar_matcher_t *) ptr);
+}
+
+static const rb_data_type_t tarruby_matcher_type = {
+  "tarruby_matcher",
+  { NULL, tarruby_matcher_free, NULL, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/* compiles the patterns; the matcher is freed with the wrapper pushed onto keep */
+static tar_matcher_t *tarruby_matcher_new(VALUE patterns, int literal, VALUE keep) {
+  tar_matcher_t *m;
+  VALUE wrapper, pattern;
+  long i;
+
+  patterns = rb_Array(patterns);
+
+  if ((m = tar_matcher_new()) == NULL) {
+    rb_memerror();
+  }
+
+  wrapper = TypedData_Wrap_Struct(0, &tarruby_matcher_type, m);
+  rb_ary_push(keep, wrapper);
+
+  for (i = 0; i < RARRAY_LEN(patterns); i++) {
+    pattern = rb_ary_entry(patterns, i);
+
+    if (tar_matcher_add(m, StringValueCStr(pattern), literal) != 0) {
+      rb_raise(Error, "Add pattern failed: %s", strerror(errno));
+    }
+  }
+
+  return m;
+}
+
+static VALUE tarruby_extract_globs0(int argc, VALUE *argv, VALUE self, int literal) {
+  VALUE patterns, prefix, opts, keep = rb_ary_new();
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  char *s_prefix = NULL;
+
+  rb_scan_args(argc, argv, "11:", &patterns, &prefix, &opts);
+  call.durability = tarruby_durability(opts);
+
+  if (!NIL_P(prefix)) {
+    Check_Type(prefix, T_STRING);
+    prefix = rb_str_new_frozen(prefix);
+    s_prefix = RSTRING_PTR(prefix);
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_prefix;
+  call.data = tarruby_matcher_new(patterns, literal, keep);
+
+  p_tar->generation++;
+
+  if (tarruby_call_nogvl(tarruby_extract_globs_nogvl, &call) != 0) {
+    rb_raise(Error, "Extract archive failed: %s", strerror(errno));
+  }
+
+  p_tar->extracted = 1;
+  RB_GC_GUARD(keep);
+  RB_GC_GUARD(prefix);
+
+  return Qnil;
+}
+
+/* */
+static VALUE tarruby_extract_globs(int argc, VALUE *argv, VALUE self) {
+  return tarruby_extract_globs0(argc, argv, self, 0);
+}
+
+/* */
+static VALUE tarruby_extract_paths(int argc, VALUE *argv, VALUE self) {
+  return tarruby_extract_globs0(argc, argv, self, 1);
+}
+
+/* */
+static VALUE tarruby_extract_all(int argc, VALUE *argv, VALUE self) {
+  VALUE prefix, opts;
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  char *s_prefix = NULL;
+
+  rb_scan_args(argc, argv, "01:", &prefix, &opts);
+  call.durability = tarruby_durability(opts);
+
+  if (!NIL_P(prefix)) {
+    Check_Type(prefix, T_STRING);
+    prefix = rb_str_new_frozen(prefix);
+    s_prefix = RSTRING_PTR(prefix);
+  }
+
+  p_tar = tarruby_get_tar(self);
+
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.s1 = s_prefix;
+
+  p_tar->generation++;
+
+  if (tarruby_call_nogvl(tarruby_extract_all_nogvl, &call) != 0) {
+    rb_raise(Error, "Extract archive failed: %s", strerror(errno));
+  }
+
+  p_tar->extracted = 1;
+  RB_GC_GUARD(prefix);
+
+  return Qnil;
+}
+
+static void tarruby_skip_regfile_if_not_extracted(struct tarruby_tar *p) {
+  struct tarruby_call call;
+
+  if (!p->extracted) {
+    call.handle = p;
+    call.source = NULL;
+    call.tar = p->tar;
+
+    if (TH_ISREG(p->tar) && tarruby_call_nogvl(tarruby_skip_regfile_nogvl, &call) != 0) {
+      rb_raise(Error, "Read archive failed: %s", strerror(errno));
+    }
+
+    p->extracted = 1;
+  }
+}
+
+/* */
+static VALUE tarruby_read(VALUE self) {
+  struct tarruby_tar *p_tar;
+  struct tarruby_call call;
+  int i;
+
+  p_tar = tarruby_get_tar(self);
+  tarruby_skip_regfile_if_not_extracted(p_tar);
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  p_tar->generation++;
+
+  if ((i = tarruby_call_nogvl(tarruby_th_read_nogvl, &call)) == -1) {
+    rb_raise(Error, "Read archive failed: %s", strerror(errno));
+  }
+
+  p_tar->extracted = 0;
+
+  return (i == 0) ? Qtrue : Qfalse;
+}
+
+static int tarruby_filter_type(VALUE type) {
+  static const char *names[] = { "reg", "lnk", "sym", "chr", "blk", "dir", "fifo" };
+  static const int types[] = { TH_TYPE_REG, TH_TYPE_LNK, TH_TYPE_SYM, TH_TYPE_CHR, TH_TYPE_BLK, TH_TYPE_DIR, TH_TYPE_FIFO };
+  const char *name = rb_id2name(SYM2ID(rb_to_symbol(type)));
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return 1 << types[i];
+    }
+  }
+
+  rb_raise(rb_eArgError, "unknown type :%s", name);
+
+  return 0;
+}
+
+/* include:, exclude:, types:, min_size: and newer_than: are checked in C for every header */
+static tar_filter_t *tarruby_filter_init(tar_filter_t *filter, VALUE opts, VALUE keep) {
+  static const char *names[] = { "include", "exclude", "types", "min_size", "newer_than" };
+  ID kwids[5];
+  VALUE kwargs[5], types;
+  struct timespec ts;
+  long i;
+
+  if (NIL_P(opts)) {
+    return NULL;
+  }
+
+  for (i = 0; i < 5; i++) {
+    kwids[i] = rb_intern(names[i]);
+  }
+
+  rb_get_kwargs(opts, kwids, 0, 5, kwargs);
+  memset(filter, 0, sizeof(tar_filter_t));
+
+  if (kwargs[0] != Qundef && !NIL_P(kwargs[0])) {
+    filter->include = tarruby_matcher_new(kwargs[0], 0, keep);
+  }
+
+  if (kwargs[1] != Qundef && !NIL_P(kwargs[1])) {
+    filter->exclude = tarruby_matcher_new(kwargs[1], 0, keep);
+  }
+
+  if (kwargs[2] != Qundef && !NIL_P(kwargs[2])) {
+    types = rb_Array(kwargs[2]);
+
+    for (i = 0; i < RARRAY_LEN(types); i++) {
+      filter->types |= tarruby_filter_type(rb_ary_entry(types, i));
+    }
+  }
+
+  if (kwargs[3] != Qundef && !NIL_P(kwargs[3])) {
+    filter->min_size = NUM2LL(kwargs[3]);
+  }
+
+  if (kwargs[4] != Qundef && !NIL_P(kwargs[4])) {
+    ts = rb_time_timespec(kwargs[4]);
+    filter->newer = 1;
+    filter->newer_than = ts.tv_sec;
+    filter->newer_than_nsec = ts.tv_nsec;
+  }
+
+  return filter;
+}
+
+/* reads the next header that passes filter (if any); returns 1 at the end of the archive */
+static int tarruby_read_next(struct tarruby_tar *p_tar, tar_filter_t *filter) {
+  struct tarruby_call call;
+  int i;
+
+  /* the block of #each may have closed the archive */
+  if (!p_tar->tar) {
+    rb_raise(Error, "Archive is closed");
+  }
+
+  tarruby_skip_regfile_if_not_extracted(p_tar);
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.data = filter;
+  p_tar->generation++;
+
+  i = tarruby_call_nogvl(filter ? tarruby_th_read_match_nogvl : tarruby_th_read_nogvl, &call);
+
+  if (i == -1) {
+    rb_raise(Error, "Read archive failed: %s", strerror(errno));
+  }
+
+  if (i == 0) {
+    p_tar->extracted = 0;
+  }
+
+  return i;
+}
+
+/* */
+static VALUE tarruby_each(int argc, VALUE *argv, VALUE self) {
+  struct tarruby_tar *p_tar;
+  tar_filter_t f, *filter;
+  VALUE opts, keep = rb_ary_new();
+
+  RETURN_ENUMERATOR_KW(self, argc, argv, RB_PASS_CALLED_KEYWORDS);
+  rb_scan_args(argc, argv, "0:", &opts);
+  filter = tarruby_filter_init(&f, opts, keep);
+  p_tar = tarruby_get_tar(self);
+
+  while (tarruby_read_next(p_tar, filter) == 0) {
+    rb_yield(self);
+  }
+
+  RB_GC_GUARD(keep);
+
+  return Qnil;
+}
+
+static void tarruby_entry_mark(void *ptr) {
+  struct tarruby_entry *p = (struct tarruby_entry *) ptr;
+  rb_gc_mark(p->tar);
+  rb_gc_mark(p->v_pathname);
+  rb_gc_mark(p->v_linkname);
+  rb_gc_mark(p->v_mtime);
+  rb_gc_mark(p->v_data);
+}
+
+static void tarruby_entry_free(void *ptr) {
+  struct tarruby_entry *p = (struct tarruby_entry *) ptr;
+  xfree(p->pathname);
+  xfree(p);
+}
+
+static size_t tarruby_entry_memsize(const void *ptr) {
+  const struct tarruby_entry *p = (const struct tarruby_entry *) ptr;
+  return sizeof(struct tarruby_entry) + strlen(p->pathname) + strlen(p->linkname) + 2;
+}
+
+static const rb_data_type_t tarruby_entry_type = {
+  "tarruby_entry",
+  { tarruby_entry_mark, tarruby_entry_free, tarruby_entry_memsize, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/* copies out everything in the current header; no Ruby objects are made until asked for */
+static VALUE tarruby_entry_new0(VALUE tar, struct tarruby_tar *p_tar) {
+  struct tarruby_entry *p_entry;
+  struct tar_info *info;
+  size_t pathlen, linklen;
+  VALUE entry;
+
+  if (!p_tar->tar) {
+    rb_raise(Error, "Archive is closed");
+  }
+
+  entry = TypedData_Make_Struct(Entry, struct tarruby_entry, &tarruby_entry_type, p_entry);
+  p_entry->tar = tar;
+  p_entry->generation = p_tar->generation;
+  p_entry->v_pathname = p_entry->v_linkname = p_entry->v_mtime = Qnil;
+  p_entry->changes = 0;
+  p_entry->v_data = Qnil;
+
+  info = th_info(p_tar->tar);
+  p_entry->types = info->types;
+  p_entry->typeflag = p_tar->tar->th_buf.typeflag;
+  p_entry->mode = info->mode;
+  p_entry->size = info->size;
+  p_entry->mtime = info->mtime;
+  p_entry->mtime_nsec = info->mtime_nsec;
+  p_entry->uid = th_get_uid(p_tar->tar);
+  p_entry->gid = th_get_gid(p_tar->tar);
+  p_entry->devmajor = info->devmajor;
+  p_entry->devminor = info->devminor;
+  p_entry->crc = info->crc;
+
+  pathlen = strlen(info->pathname);
+  linklen = strlen(info->linkname);
+  p_entry->pathname = ALLOC_N(char, pathlen + linklen + 2);
+  p_entry->linkname = p_entry->pathname + pathlen + 1;
+  memcpy(p_entry->pathname, info->pathname, pathlen + 1);
+  memcpy(p_entry->linkname, info->linkname, linklen + 1);
+
+  return entry;
+}
+
+/* only the entries yielded by Tar.transform can be changed */
+static VALUE tarruby_entry_new(VALUE tar, struct tarruby_tar *p_tar) {
+  return rb_obj_freeze(tarruby_entry_new0(tar, p_tar));
+}
+
+/* */
+static VALUE tarruby_entry(VALUE self) {
+  struct tarruby_tar *p_tar;
+
+  p_tar = tarruby_get_tar(self);
+
+  return tarruby_entry_new(self, p_tar);
+}
+
+static struct tarruby_entry *tarruby_entry_get(VALUE self) {
+  struct tarruby_entry *p_entry;
+  TypedData_Get_Struct(self, struct tarruby_entry, &tarruby_entry_type, p_entry);
+  return p_entry;
+}
+
+/* */
+static VALUE tarruby_entry_pathname(VALUE self) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
+
+  if (NIL_P(p->v_pathname)) {
+    p->v_pathname = rb_obj_freeze(rb_str_new2(p->pathname));
+  }
+
+  return p->v_pathname;
+}
+
+/* */
+static VALUE tarruby_entry_linkname(VALUE self) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
+
+  if (NIL_P(p->v_linkname)) {
+    p->v_linkname = rb_obj_freeze(rb_str_new2(p->linkname));
+  }
+
+  return p->v_linkname;
+}
+
+/* */
+static VALUE tarruby_entry_mtime(VALUE self) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
+
+  if (NIL_P(p->v_mtime)) {
+    p->v_mtime = rb_obj_freeze(NSEC2TIME(p->mtime, p->mtime_nsec));
+  }
+
+  return p->v_mtime;
+}
+
+/* */
+static VALUE tarruby_entry_size(VALUE self) {
+  return LL2NUM(tarruby_entry_get(self)->size);
+}
+
+/* */
+static VALUE tarruby_entry_mode(VALUE self) {
+  return LONG2NUM(tarruby_entry_get(self)->mode);
+}
+
+/* */
+static VALUE tarruby_entry_uid(VALUE self) {
+  return ULONG2NUM(tarruby_entry_get(self)->uid);
 }
 
-static tartype_t gztype = {
-  (openfunc_t)  gzopen_frontend,
-  (closefunc_t) gzclose,
-  (readfunc_t)  gzread,
-  (writefunc_t) gzwrite
-};
-#endif
+/* */
+static VALUE tarruby_entry_gid(VALUE self) {
+  return ULONG2NUM(tarruby_entry_get(self)->gid);
+}
 
-#ifdef HAVE_BZLIB_H
-static int bzopen_frontend(char *pathname, int oflags, int mode) {
-  char *bzoflags;
-  BZFILE *bzf;
-#ifndef _WIN32
-  int fd;
-#endif
+/* */
+static VALUE tarruby_entry_set_pathname(VALUE self, VALUE pathname) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
 
-  switch (oflags & O_ACCMODE) {
-  case O_WRONLY:
-    bzoflags = "wb";
-    break;
+  rb_check_frozen(self);
+  StringValueCStr(pathname);
+  p->v_pathname = rb_str_new_frozen(pathname);
+  p->changes |= TARRUBY_SET_PATHNAME;
 
-  case O_RDONLY:
-    bzoflags = "rb";
-    break;
+  return pathname;
+}
 
-  default:
-  case O_RDWR:
-    errno = EINVAL;
-    return -1;
-  }
+/* */
+static VALUE tarruby_entry_set_linkname(VALUE self, VALUE linkname) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
 
-#ifndef _WIN32
-  fd = open(pathname, oflags, mode);
+  rb_check_frozen(self);
+  StringValueCStr(linkname);
+  p->v_linkname = rb_str_new_frozen(linkname);
+  p->changes |= TARRUBY_SET_LINKNAME;
 
-  if (fd == -1) {
-    return -1;
-  }
+  return linkname;
+}
 
-  if ((oflags & O_CREAT) && fchmod(fd, mode)) {
-    return -1;
-  }
+/* the permission bits; the type of the member stays as it is */
+static VALUE tarruby_entry_set_mode(VALUE self, VALUE mode) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
 
-  bzf = BZ2_bzdopen(fd, bzoflags);
-#else
-  bzf = BZ2_bzopen(pathname, bzoflags);
-#endif
-  if (!bzf) {
-    errno = ENOMEM;
-    return -1;
-  }
+  rb_check_frozen(self);
+  p->mode = (p->mode & ~07777) | (NUM2UINT(mode) & 07777);
+  p->changes |= TARRUBY_SET_MODE;
 
-  return (int) bzf;
+  return mode;
 }
 
-static tartype_t bztype = {
-  (openfunc_t)  bzopen_frontend,
-  (closefunc_t) BZ2_bzclose,
-  (readfunc_t)  BZ2_bzread,
-  (writefunc_t) BZ2_bzwrite
-};
-#endif
+/* a Time, or seconds since the epoch */
+static VALUE tarruby_entry_set_mtime(VALUE self, VALUE mtime) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
+  struct timespec ts;
 
-static void strip_sep(char *path) {
-  int len = strlen(path);
+  rb_check_frozen(self);
+  ts = rb_time_timespec(mtime);
+  p->mtime = ts.tv_sec;
+  p->mtime_nsec = ts.tv_nsec;
+  p->v_mtime = Qnil;
+  p->changes |= TARRUBY_SET_MTIME;
 
-  if (path[len - 1] == '/' || path[len - 1] == '\\') {
-    path[len - 1] = '\0';
-  }
+  return mtime;
 }
 
-static VALUE tarruby_tar_alloc(VALUE klass) {
-  struct tarruby_tar *p = ALLOC(struct tarruby_tar);
+/* */
+static VALUE tarruby_entry_set_uid(VALUE self, VALUE uid) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
 
-  p->tar = NULL;
-  p->extracted = 1;
+  rb_check_frozen(self);
+  p->uid = NUM2ULONG(uid);
+  p->changes |= TARRUBY_SET_UID;
 
-  return Data_Wrap_Struct(klass, 0, -1, p);
+  return uid;
 }
 
 /* */
-static VALUE tarruby_close0(VALUE self, int abort) {
-  struct tarruby_tar *p_tar;
+static VALUE tarruby_entry_set_gid(VALUE self, VALUE gid) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  rb_check_frozen(self);
+  p->gid = NUM2ULONG(gid);
+  p->changes |= TARRUBY_SET_GID;
 
-  if(tar_close(p_tar->tar) != 0 && abort) {
-    rb_raise(Error, "Close archive failed: %s", strerror(errno));
+  return gid;
+}
+
+/* replaces the contents of a regular file */
+static VALUE tarruby_entry_set_data(VALUE self, VALUE data) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
+
+  rb_check_frozen(self);
+  StringValue(data);
+
+  if (!(p->types & (1 << TH_TYPE_REG))) {
+    rb_raise(Error, "Only regular files have contents: %s", p->pathname);
   }
 
+  p->v_data = rb_str_new_frozen(data);
+  p->size = RSTRING_LEN(data);
+  p->changes |= TARRUBY_SET_DATA;
+
+  return data;
+}
+
+/* leaves the member out of the archive Tar.transform writes */
+static VALUE tarruby_entry_drop(VALUE self) {
+  struct tarruby_entry *p = tarruby_entry_get(self);
+
+  rb_check_frozen(self);
+  p->changes |= TARRUBY_DROP;
+
   return Qnil;
 }
 
 /* */
-static VALUE tarruby_close(VALUE self) {
-  return tarruby_close0(self, 1);
+static VALUE tarruby_entry_devmajor(VALUE self) {
+  return ULONG2NUM(tarruby_entry_get(self)->devmajor);
 }
 
-static VALUE tarruby_s_open0(int argc, VALUE *argv, VALUE self, tartype_t *tartype) {
-  VALUE tar, pathname, oflags, mode, options;
-  struct tarruby_tar *p_tar;
-  char *s_pathname;
-  int i_oflags, i_mode = 0644, i_options = 0;
-
-  rb_scan_args(argc, argv, "22", &pathname, &oflags, &mode, &options);
-  Check_Type(pathname, T_STRING);
-  s_pathname = RSTRING_PTR(pathname);
-  i_oflags = NUM2INT(oflags);
-  if (!NIL_P(mode)) { i_mode = NUM2INT(mode); }
-  if (!NIL_P(options)) { i_options = NUM2INT(options); }
+/* */
+static VALUE tarruby_entry_devminor(VALUE self) {
+  return ULONG2NUM(tarruby_entry_get(self)->devminor);
+}
 
-  tar = rb_funcall(Tar, rb_intern("new"), 0);
-  Data_Get_Struct(tar, struct tarruby_tar, p_tar);
+/* */
+static VALUE tarruby_entry_crc(VALUE self) {
+  return INT2NUM(tarruby_entry_get(self)->crc);
+}
 
-  if (tar_open(&p_tar->tar, s_pathname, tartype, i_oflags, i_mode, i_options) == -1) {
-    rb_raise(Error, "Open archive failed: %s", strerror(errno));
-  }
+/* */
+static VALUE tarruby_entry_is_reg(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_REG)) ? Qtrue : Qfalse;
+}
 
-  if (rb_block_given_p()) {
-    VALUE retval;
-    int status;
+/* */
+static VALUE tarruby_entry_is_lnk(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_LNK)) ? Qtrue : Qfalse;
+}
 
-    retval = rb_protect(rb_yield, tar, &status);
-    tarruby_close0(tar, 0);
+/* */
+static VALUE tarruby_entry_is_sym(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_SYM)) ? Qtrue : Qfalse;
+}
 
-    if (status != 0) {
-      rb_jump_tag(status);
-    }
+/* */
+static VALUE tarruby_entry_is_chr(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_CHR)) ? Qtrue : Qfalse;
+}
 
-    return retval;
-  } else {
-    return tar;
-  }
+/* */
+static VALUE tarruby_entry_is_blk(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_BLK)) ? Qtrue : Qfalse;
 }
 
 /* */
-static VALUE tarruby_s_open(int argc, VALUE *argv, VALUE self) {
-  return tarruby_s_open0(argc, argv, self, NULL);
+static VALUE tarruby_entry_is_dir(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_DIR)) ? Qtrue : Qfalse;
 }
 
-#ifdef HAVE_ZLIB_H
 /* */
-static VALUE tarruby_s_gzopen(int argc, VALUE *argv, VALUE self) {
-  return tarruby_s_open0(argc, argv, self, &gztype);
+static VALUE tarruby_entry_is_fifo(VALUE self) {
+  return (tarruby_entry_get(self)->types & (1 << TH_TYPE_FIFO)) ? Qtrue : Qfalse;
 }
-#endif
 
-#ifdef HAVE_BZLIB_H
 /* */
-static VALUE tarruby_s_bzopen(int argc, VALUE *argv, VALUE self) {
-  return tarruby_s_open0(argc, argv, self, &bztype);
+static VALUE tarruby_entry_is_longname(VALUE self) {
+  return (tarruby_entry_get(self)->typeflag == GNU_LONGNAME_TYPE) ? Qtrue : Qfalse;
 }
-#endif
 
 /* */
-static VALUE tarruby_append_file(int argc, VALUE *argv, VALUE self) {
-  VALUE realname, savename;
+static VALUE tarruby_entry_is_longlink(VALUE self) {
+  return (tarruby_entry_get(self)->typeflag == GNU_LONGLINK_TYPE) ? Qtrue : Qfalse;
+}
+
+/* the archive must still be positioned in the member the entry was made for */
+static struct tarruby_tar *tarruby_entry_tar(VALUE self) {
+  struct tarruby_entry *p_entry = tarruby_entry_get(self);
   struct tarruby_tar *p_tar;
-  char *s_realname, *s_savename = NULL;
 
-  rb_scan_args(argc, argv, "11", &realname, &savename);
-  Check_Type(realname, T_STRING);
-  s_realname = RSTRING_PTR(realname);
-  strip_sep(s_realname);
+  TypedData_Get_Struct(p_entry->tar, struct tarruby_tar, &tarruby_tar_type, p_tar);
 
-  if (!NIL_P(savename)) {
-    Check_Type(savename, T_STRING);
-    s_savename = RSTRING_PTR(savename);
-    strip_sep(s_savename);
+  if (!p_tar->tar || p_tar->generation != p_entry->generation) {
+    rb_raise(Error, "Entry is no longer the current member");
   }
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  if (p_tar->busy) {
+    rb_raise(Error, "Archive is in use by another call");
+  }
 
-  if (tar_append_file(p_tar->tar, s_realname, s_savename) != 0) {
-    rb_raise(Error, "Append file failed: %s", strerror(errno));
+  return p_tar;
+}
+
+static VALUE tarruby_entry_read_data(VALUE arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+
+  if (tarruby_call_nogvl(tarruby_read_data_nogvl, call) != 0) {
+    rb_raise(Error, "Read entry failed: %s", strerror(errno));
   }
 
   return Qnil;
 }
 
-static int tarruby_append_buffer0(char *buf, int len, void *data) {
-  char **p_buffer = (char **) data;
-  memcpy(buf, *p_buffer, len);
-  p_buffer += len;
-  return len;
-}
+/* reads len bytes (fewer only at the end of the member) into outbuf */
+static VALUE tarruby_entry_read0(struct tarruby_tar *p_tar, long len, VALUE outbuf) {
+  struct tarruby_call call;
 
-/* */
-static VALUE tarruby_append_buffer(VALUE self, VALUE savename, VALUE buffer) {
-  struct tarruby_tar *p_tar;
-  char *s_savename, *s_buffer;
-  int i_size;
+  if (NIL_P(outbuf)) {
+    outbuf = rb_str_new(NULL, len);
+  } else {
+    StringValue(outbuf);
+    rb_str_modify(outbuf);
+    rb_str_resize(outbuf, len);
+  }
 
-  Check_Type(savename, T_STRING);
-  Check_Type(buffer, T_STRING);
-  s_savename = RSTRING_PTR(savename);
-  strip_sep(s_savename);
-  s_buffer = RSTRING_PTR(buffer);
-  i_size = RSTRING_LEN(buffer);
+  call.handle = p_tar;
+  call.source = NULL;
+  call.tar = p_tar->tar;
+  call.data = RSTRING_PTR(outbuf);
+  call.size = len;
+
+  /* the caller's buffer is filled in place, so it is locked while the GVL is released */
+  rb_str_locktmp(outbuf);
+  rb_ensure(tarruby_entry_read_data, (VALUE) &call, rb_str_unlocktmp, outbuf);
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  rb_str_set_len(outbuf, (long) call.size);
 
-  if (tar_append_function(p_tar->tar, s_savename, i_size, (void *) &s_buffer, tarruby_append_buffer0) != 0) {
-    rb_raise(Error, "Append buffer failed: %s", strerror(errno));
+  return outbuf;
+}
+
+static long tarruby_entry_length(struct tarruby_tar *p_tar, VALUE length) {
+  long len = NUM2LONG(length);
+  tar_off_t left = tar_data_left(p_tar->tar);
+
+  if (len < 0) {
+    rb_raise(rb_eArgError, "negative length %ld given", len);
   }
 
-  return Qnil;
+  return (left < len) ? (long) left : len;
 }
 
 /* */
-static VALUE tarruby_append_tree(int argc, VALUE *argv, VALUE self) {
-  VALUE realdir, savedir;
+static VALUE tarruby_entry_read(int argc, VALUE *argv, VALUE self) {
+  VALUE length, outbuf;
   struct tarruby_tar *p_tar;
-  char *s_realdir, *s_savedir = NULL;
-  int result = -1;
+  tar_off_t left;
 
-  rb_scan_args(argc, argv, "11", &realdir, &savedir);
-  Check_Type(realdir, T_STRING);
-  s_realdir = RSTRING_PTR(realdir);
-  strip_sep(s_realdir);
+  rb_scan_args(argc, argv, "02", &length, &outbuf);
+  p_tar = tarruby_entry_tar(self);
+  left = tar_data_left(p_tar->tar);
 
-  if (!NIL_P(savedir)) {
-    Check_Type(savedir, T_STRING);
-    s_savedir = RSTRING_PTR(savedir);
-    strip_sep(s_savedir);
+  if (NIL_P(length)) {
+    if (left > LONG_MAX) {
+      rb_raise(Error, "Read entry failed: %s", strerror(EFBIG));
+    }
+
+    return tarruby_entry_read0(p_tar, (long) left, outbuf);
   }
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  if (left == 0 && NUM2LONG(length) > 0) {
+    if (!NIL_P(outbuf)) { rb_str_resize(outbuf, 0); }
+    return Qnil;
+  }
 
-  TRAP_BEG;
-  result = tar_append_tree(p_tar->tar, s_realdir, s_savedir);
-  TRAP_END;
+  return tarruby_entry_read0(p_tar, tarruby_entry_length(p_tar, length), outbuf);
+}
 
-  if (result != 0) {
-    rb_raise(Error, "Append tree failed: %s", strerror(errno));
+/* */
+static VALUE tarruby_entry_readpartial(int argc, VALUE *argv, VALUE self) {
+  VALUE maxlen, outbuf;
+  struct tarruby_tar *p_tar;
+
+  rb_scan_args(argc, argv, "11", &maxlen, &outbuf);
+  p_tar = tarruby_entry_tar(self);
+
+  if (tar_data_left(p_tar->tar) == 0 && NUM2LONG(maxlen) > 0) {
+    if (!NIL_P(outbuf)) { rb_str_resize(outbuf, 0); }
+    rb_eof_error();
   }
 
-  return Qnil;
+  return tarruby_entry_read0(p_tar, tarruby_entry_length(p_tar, maxlen), outbuf);
 }
 
 /* */
-static VALUE tarruby_extract_file(VALUE self, VALUE realname) {
+static VALUE tarruby_entry_each_chunk(int argc, VALUE *argv, VALUE self) {
+  VALUE size;
   struct tarruby_tar *p_tar;
-  char *s_realname;
+  long len = CHUNK_SIZE;
 
-  Check_Type(realname, T_STRING);
-  s_realname = RSTRING_PTR(realname);
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  rb_scan_args(argc, argv, "01", &size);
+  RETURN_ENUMERATOR(self, argc, argv);
 
-  if (tar_extract_file(p_tar->tar, s_realname) != 0) {
-    rb_raise(Error, "Extract file failed: %s", strerror(errno));
+  if (!NIL_P(size) && (len = NUM2LONG(size)) <= 0) {
+    rb_raise(rb_eArgError, "chunk size must be positive");
   }
 
-  p_tar->extracted = 1;
+  while (p_tar = tarruby_entry_tar(self), tar_data_left(p_tar->tar) > 0) {
+    rb_yield(tarruby_entry_read0(p_tar, tarruby_entry_length(p_tar, LONG2NUM(len)), Qnil));
+  }
 
-  return Qnil;
+  return self;
 }
 
-static int tarruby_extract_buffer0(char *buf, int len, void *data) {
-  VALUE buffer = (VALUE) data;
-  rb_str_buf_cat(buffer, buf, len);
-  return len;
+/* */
+static VALUE tarruby_entry_is_eof(VALUE self) {
+  struct tarruby_tar *p_tar = tarruby_entry_tar(self);
+  return (tar_data_left(p_tar->tar) == 0) ? Qtrue : Qfalse;
 }
 
 /* */
-static VALUE tarruby_extract_buffer(VALUE self) {
-  VALUE buffer;
+static VALUE tarruby_each_entry(int argc, VALUE *argv, VALUE self) {
   struct tarruby_tar *p_tar;
-  int i;
+  tar_filter_t f, *filter;
+  VALUE opts, keep = rb_ary_new();
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
-  buffer = rb_str_new("", 0);
+  RETURN_ENUMERATOR_KW(self, argc, argv, RB_PASS_CALLED_KEYWORDS);
+  rb_scan_args(argc, argv, "0:", &opts);
+  filter = tarruby_filter_init(&f, opts, keep);
+  p_tar = tarruby_get_tar(self);
 
-  if ((i = tar_extract_function(p_tar->tar, (void *) buffer,  tarruby_extract_buffer0)) == -1) {
-    rb_raise(Error, "Extract buffer failed: %s", strerror(errno));
+  while (tarruby_read_next(p_tar, filter) == 0) {
+    rb_yield(tarruby_entry_new(self, p_tar));
   }
 
-  p_tar->extracted = 1;
+  RB_GC_GUARD(keep);
 
-  return (i == 0) ? buffer : Qnil;
+  return self;
 }
 
 /* */
-static VALUE tarruby_extract_glob(int argc, VALUE *argv, VALUE self) {
-  VALUE globname, prefix;
+static VALUE tarruby_entries(int argc, VALUE *argv, VALUE self) {
   struct tarruby_tar *p_tar;
-  char *s_globname, *s_prefix = NULL;
-  int result = -1;
+  tar_filter_t f, *filter;
+  VALUE opts, keep = rb_ary_new(), entries = rb_ary_new();
 
-  rb_scan_args(argc, argv, "11", &globname, &prefix);
-  Check_Type(globname, T_STRING);
-  s_globname = RSTRING_PTR(globname);
+  rb_scan_args(argc, argv, "0:", &opts);
+  filter = tarruby_filter_init(&f, opts, keep);
+  p_tar = tarruby_get_tar(self);
 
-  if (!NIL_P(prefix)) {
-    Check_Type(prefix, T_STRING);
-    s_prefix = RSTRING_PTR(prefix);
+  while (tarruby_read_next(p_tar, filter) == 0) {
+    rb_ary_push(entries, tarruby_entry_new(self, p_tar));
   }
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  RB_GC_GUARD(keep);
 
-  TRAP_BEG;
-  result = tar_extract_glob(p_tar->tar, s_globname, s_prefix);
-  TRAP_END;
+  return entries;
+}
 
-  if (result != 0) {
-    rb_raise(Error, "Extract archive failed: %s", strerror(errno));
-  }
+static void *tarruby_append_member_nogvl(void *arg) {
+  struct tarruby_call *call = (struct tarruby_call *) arg;
+  call->result = tar_append_member(call->tar, (TAR *) call->data);
+  call->error = errno;
+  return NULL;
+}
 
-  p_tar->extracted = 1;
+/* reads one archive and writes another; the GVL is only released when neither goes through an IO */
+static int tarruby_append_member(struct tarruby_tar *p_dst, struct tarruby_tar *p_src) {
+  struct tarruby_call call;
 
-  return Qnil;
+  call.handle = p_dst;
+  call.source = p_src;
+  call.tar = p_dst->tar;
+  call.data = p_src ? p_src->tar : NULL;
+
+  return tarruby_call_nogvl(tarruby_append_member_nogvl, &call);
 }
 
-/* */
-static VALUE tarruby_extract_all(int argc, VALUE *argv, VALUE self) {
-  VALUE prefix;
-  struct tarruby_tar *p_tar;
-  char *s_prefix = NULL;
-  int result = -1;
+/* writes the member src is on to dst with the changes made to its entry */
+static void tarruby_transform_member(struct tarruby_tar *p_src, struct tarruby_tar *p_dst, struct tarruby_entry *p) {
+  struct tarruby_call call;
+  TAR *t = p_dst->tar;
 
-  rb_scan_args(argc, argv, "01", &prefix);
+  if (p->generation != p_src->generation) {
+    rb_raise(Error, "Archive was read from inside the block");
+  }
 
-  if (!NIL_P(prefix)) {
-    Check_Type(prefix, T_STRING);
-    s_prefix = RSTRING_PTR(prefix);
+  if (p->changes & TARRUBY_DROP) {
+    return;
+  }
+
+  if (!(p->changes & TARRUBY_SET_DATA) && TH_ISREG(p_src->tar)
+      && (p_src->extracted || tar_data_left(p_src->tar) != th_get_size(p_src->tar))) {
+    rb_raise(Error, "Contents of %s were read; give them back with Entry#data=", p->pathname);
   }
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  th_copy(t, p_src->tar);
 
-  TRAP_BEG;
-  result = tar_extract_all(p_tar->tar, s_prefix);
-  TRAP_END;
+  if (p->changes & TARRUBY_SET_PATHNAME) {
+    th_set_path(t, RSTRING_PTR(p->v_pathname));
+  }
 
-  if (result != 0) {
-    rb_raise(Error, "Extract archive failed: %s", strerror(errno));
+  if (p->changes & TARRUBY_SET_LINKNAME) {
+    th_set_link(t, RSTRING_PTR(p->v_linkname));
   }
 
-  p_tar->extracted = 1;
+  if (p->changes & TARRUBY_SET_MODE) {
+    th_set_mode(t, p->mode);
+  }
 
-  return Qnil;
-}
+  if (p->changes & TARRUBY_SET_MTIME) {
+    th_set_mtime(t, p->mtime);
 
-static void tarruby_skip_regfile_if_not_extracted(struct tarruby_tar *p) {
-  if (!p->extracted) {
-    if (TH_ISREG(p->tar) && tar_skip_regfile(p->tar) != 0) {
-      rb_raise(Error, "Read archive failed: %s", strerror(errno));
+    if ((t->options & TAR_PAX) && p->mtime_nsec != 0) {
+      t->th_buf.pax.flags |= TAR_PAX_MTIME;
+      t->th_buf.pax.mtime = p->mtime;
+      t->th_buf.pax.mtime_nsec = p->mtime_nsec;
     }
+  }
 
-    p->extracted = 1;
+  /* the names of the new owner are looked up, unless Tar::NUMERIC_OWNER leaves them empty */
+  if (p->changes & TARRUBY_SET_UID) {
+    memset(t->th_buf.uname, 0, sizeof(t->th_buf.uname));
+    th_set_user(t, (uid_t) p->uid);
+  }
+
+  if (p->changes & TARRUBY_SET_GID) {
+    memset(t->th_buf.gname, 0, sizeof(t->th_buf.gname));
+    th_set_group(t, (gid_t) p->gid);
+  }
+
+  if (!(p->changes & TARRUBY_SET_DATA)) {
+    if (tarruby_append_member(p_dst, p_src) != 0) {
+      rb_raise(Error, "Append member failed: %s", strerror(errno));
+    }
+
+    p_src->extracted = 1;
+    return;
+  }
+
+  /* the old contents are skipped when the next header is read */
+  th_set_size(t, RSTRING_LEN(p->v_data));
+
+  if (tarruby_append_member(p_dst, NULL) != 0) {
+    rb_raise(Error, "Append member failed: %s", strerror(errno));
   }
+
+  call.handle = p_dst;
+  call.source = NULL;
+  call.tar = t;
+  call.data = RSTRING_PTR(p->v_data);
+  call.size = RSTRING_LEN(p->v_data);
+  tarruby_write_data((VALUE) &call);
 }
 
-/* */
-static VALUE tarruby_read(VALUE self) {
-  struct tarruby_tar *p_tar;
-  int i;
+struct tarruby_transform {
+  VALUE src;
+  VALUE dst;
+  VALUE options;
+  int close_src; /* opened by Tar.transform from a path or an IO */
+  int close_dst;
+};
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
-  tarruby_skip_regfile_if_not_extracted(p_tar);
+static VALUE tarruby_transform_open(VALUE archive, int oflags, VALUE options, int *opened) {
+  VALUE tar;
 
-  if ((i = th_read(p_tar->tar)) == -1) {
-    rb_raise(Error, "Read archive failed: %s", strerror(errno));
+  if (rb_obj_is_kind_of(archive, Tar)) {
+    return archive;
   }
 
-  p_tar->extracted = 0;
+  tar = rb_obj_alloc(Tar);
+  tarruby_open0(tar, archive, NULL, INT2NUM(oflags), Qnil, options);
+  *opened = 1;
 
-  return (i == 0) ? Qtrue : Qfalse;
+  return tar;
 }
 
-/* */
-static VALUE tarruby_each(VALUE self) {
-  struct tarruby_tar *p_tar;
-  int i;
+static VALUE tarruby_transform0(VALUE arg) {
+  struct tarruby_transform *x = (struct tarruby_transform *) arg;
+  struct tarruby_tar *p_src, *p_dst;
+  VALUE entry;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
-  tarruby_skip_regfile_if_not_extracted(p_tar);
+  x->src = tarruby_transform_open(x->src, O_RDONLY, x->options, &x->close_src);
+  x->dst = tarruby_transform_open(x->dst, O_WRONLY | O_CREAT | O_TRUNC, x->options, &x->close_dst);
+  p_src = tarruby_get_tar(x->src);
+  p_dst = tarruby_get_tar(x->dst);
 
-  while ((i = th_read(p_tar->tar)) == 0) {
-    p_tar->extracted = 0;
-    rb_yield(self);
-    tarruby_skip_regfile_if_not_extracted(p_tar);
+  for (;;) {
+    if (!p_src->tar || !p_dst->tar) {
+      rb_raise(Error, "Archive is closed");
+    }
+
+    if (tarruby_read_next(p_src, NULL) != 0) {
+      break;
+    }
+
+    entry = tarruby_entry_new0(x->src, p_src);
+    rb_yield(entry);
+
+    if (!p_src->tar || !p_dst->tar) {
+      rb_raise(Error, "Archive is closed");
+    }
+
+    tarruby_transform_member(p_src, p_dst, tarruby_entry_get(entry));
+    RB_GC_GUARD(entry);
   }
 
-  if (i == -1) {
-    rb_raise(Error, "Read archive failed: %s", strerror(errno));
+  /* the end-of-archive marker goes in as it is closed */
+  if (x->close_dst) {
+    x->close_dst = 0;
+    tarruby_close0(x->dst, 1);
+  }
+
+  return Qnil;
+}
+
+static VALUE tarruby_transform_close(VALUE arg) {
+  struct tarruby_transform *x = (struct tarruby_transform *) arg;
+
+  if (x->close_dst) {
+    tarruby_close0(x->dst, 0);
+  }
+
+  if (x->close_src) {
+    tarruby_close0(x->src, 0);
   }
 
   return Qnil;
 }
 
+/* copies src to dst member by member; what the block leaves alone is copied without being decoded */
+static VALUE tarruby_s_transform(int argc, VALUE *argv, VALUE self) {
+  struct tarruby_transform x;
+  VALUE src, dst, options;
+
+  rb_scan_args(argc, argv, "21", &src, &dst, &options);
+  rb_need_block();
+
+  x.src = src;
+  x.dst = dst;
+  x.options = options;
+  x.close_src = x.close_dst = 0;
+
+  return rb_ensure(tarruby_transform0, (VALUE) &x, tarruby_transform_close, (VALUE) &x);
+}
+
 /* */
 static VALUE tarruby_crc(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return INT2NUM(th_get_crc(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_size(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
-  return INT2NUM(th_get_size(p_tar->tar));
+  p_tar = tarruby_get_tar(self);
+  return LL2NUM(th_get_size(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_mtime(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
-  return INT2TIME(th_get_mtime(p_tar->tar));
+  p_tar = tarruby_get_tar(self);
+  return NSEC2TIME(th_get_mtime(p_tar->tar), th_get_mtime_nsec(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_devmajor(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return INT2NUM(th_get_devmajor(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_devminor(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return INT2NUM(th_get_devminor(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_linkname(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return rb_str_new2(th_get_linkname(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_pathname(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return rb_str_new2(th_get_pathname(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_mode(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return LONG2NUM(th_get_mode(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_uid(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return LONG2NUM(th_get_uid(p_tar->tar));
 }
 
 /* */
 static VALUE tarruby_gid(VALUE self) {
   struct tarruby_tar *p_tar;
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   return LONG2NUM(th_get_gid(p_tar->tar));
 }
 
@@ -555,7 +2946,7 @@ static VALUE tarruby_gid(VALUE self) {
 static VALUE tarruby_print(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   th_print(p_tar->tar);
 
   return Qnil;
@@ -565,7 +2956,7 @@ static VALUE tarruby_print(VALUE self) {
 static VALUE tarruby_print_long_ls(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
   th_print_long_ls(p_tar->tar);
 
   return Qnil;
@@ -575,7 +2966,7 @@ static VALUE tarruby_print_long_ls(VALUE self) {
 static VALUE tarruby_is_reg(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISREG(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -584,7 +2975,7 @@ static VALUE tarruby_is_reg(VALUE self) {
 static VALUE tarruby_is_lnk(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISLNK(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -593,7 +2984,7 @@ static VALUE tarruby_is_lnk(VALUE self) {
 static VALUE tarruby_is_sym(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISSYM(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -602,7 +2993,7 @@ static VALUE tarruby_is_sym(VALUE self) {
 static VALUE tarruby_is_chr(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISCHR(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -611,7 +3002,7 @@ static VALUE tarruby_is_chr(VALUE self) {
 static VALUE tarruby_is_blk(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISBLK(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -620,7 +3011,7 @@ static VALUE tarruby_is_blk(VALUE self) {
 static VALUE tarruby_is_dir(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISDIR(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -629,7 +3020,7 @@ static VALUE tarruby_is_dir(VALUE self) {
 static VALUE tarruby_is_fifo(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISFIFO(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -638,7 +3029,7 @@ static VALUE tarruby_is_fifo(VALUE self) {
 static VALUE tarruby_is_longname(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISLONGNAME(p_tar->tar) ? Qtrue : Qfalse;
 }
@@ -647,20 +3038,63 @@ static VALUE tarruby_is_longname(VALUE self) {
 static VALUE tarruby_is_longlink(VALUE self) {
   struct tarruby_tar *p_tar;
 
-  Data_Get_Struct(self, struct tarruby_tar, p_tar);
+  p_tar = tarruby_get_tar(self);
 
   return TH_ISLONGLINK(p_tar->tar) ? Qtrue : Qfalse;
 }
 
 void DLLEXPORT Init_tarruby() {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  /* no C globals change after Init, and each Tar is used by one Ractor only */
+  rb_ext_ractor_safe(true);
+#endif
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) && defined(TARRUBY_THREAD_LOCAL)
+  tar_set_intrfunc(tarruby_resume);
+#endif
+
   Tar = rb_define_class("Tar", rb_cObject);
   rb_define_alloc_func(Tar, tarruby_tar_alloc);
   rb_include_module(Tar, rb_mEnumerable);
-  rb_funcall(Tar, rb_intern("private_class_method"), 1, ID2SYM(rb_intern("new")));
 
   Error = rb_define_class_under(Tar, "Error", rb_eStandardError);
 
-  rb_define_const(Tar, "VERSION", rb_str_new2(VERSION));
+  Entry = rb_define_class_under(Tar, "Entry", rb_cObject);
+  rb_undef_alloc_func(Entry);
+  rb_define_const(Entry, "CHUNK_SIZE", INT2NUM(CHUNK_SIZE));
+  rb_define_method(Entry, "read", tarruby_entry_read, -1);
+  rb_define_method(Entry, "readpartial", tarruby_entry_readpartial, -1);
+  rb_define_method(Entry, "each_chunk", tarruby_entry_each_chunk, -1);
+  rb_define_method(Entry, "eof?", tarruby_entry_is_eof, 0);
+  rb_define_method(Entry, "crc", tarruby_entry_crc, 0);
+  rb_define_method(Entry, "size", tarruby_entry_size, 0);
+  rb_define_method(Entry, "mtime", tarruby_entry_mtime, 0);
+  rb_define_method(Entry, "devmajor", tarruby_entry_devmajor, 0);
+  rb_define_method(Entry, "devminor", tarruby_entry_devminor, 0);
+  rb_define_method(Entry, "linkname", tarruby_entry_linkname, 0);
+  rb_define_method(Entry, "pathname", tarruby_entry_pathname, 0);
+  rb_define_method(Entry, "mode", tarruby_entry_mode, 0);
+  rb_define_method(Entry, "uid", tarruby_entry_uid, 0);
+  rb_define_method(Entry, "gid", tarruby_entry_gid, 0);
+  rb_define_method(Entry, "reg?", tarruby_entry_is_reg, 0);
+  rb_define_method(Entry, "lnk?", tarruby_entry_is_lnk, 0);
+  rb_define_method(Entry, "sym?", tarruby_entry_is_sym, 0);
+  rb_define_method(Entry, "chr?", tarruby_entry_is_chr, 0);
+  rb_define_method(Entry, "blk?", tarruby_entry_is_blk, 0);
+  rb_define_method(Entry, "dir?", tarruby_entry_is_dir, 0);
+  rb_define_method(Entry, "fifo?", tarruby_entry_is_fifo, 0);
+  rb_define_method(Entry, "longname?", tarruby_entry_is_longname, 0);
+  rb_define_method(Entry, "longlink?", tarruby_entry_is_longlink, 0);
+  rb_define_method(Entry, "pathname=", tarruby_entry_set_pathname, 1);
+  rb_define_method(Entry, "linkname=", tarruby_entry_set_linkname, 1);
+  rb_define_method(Entry, "mode=", tarruby_entry_set_mode, 1);
+  rb_define_method(Entry, "mtime=", tarruby_entry_set_mtime, 1);
+  rb_define_method(Entry, "uid=", tarruby_entry_set_uid, 1);
+  rb_define_method(Entry, "gid=", tarruby_entry_set_gid, 1);
+  rb_define_method(Entry, "data=", tarruby_entry_set_data, 1);
+  rb_define_method(Entry, "drop", tarruby_entry_drop, 0);
+
+  rb_define_const(Tar, "VERSION", rb_obj_freeze(rb_str_new2(VERSION)));
 
   rb_define_const(Tar, "GNU",           INT2NUM(TAR_GNU));           /* use GNU extensions */
   rb_define_const(Tar, "VERBOSE",       INT2NUM(TAR_VERBOSE));       /* output file info to stdout */
@@ -669,7 +3103,15 @@ void DLLEXPORT Init_tarruby() {
   rb_define_const(Tar, "CHECK_MAGIC",   INT2NUM(TAR_CHECK_MAGIC));   /* check magic in file header */
   rb_define_const(Tar, "CHECK_VERSION", INT2NUM(TAR_CHECK_VERSION)); /* check version in file header */
   rb_define_const(Tar, "IGNORE_CRC",    INT2NUM(TAR_IGNORE_CRC));    /* ignore CRC in file header */
-
+  rb_define_const(Tar, "PAX",           INT2NUM(TAR_PAX));           /* use POSIX pax extended headers */
+  rb_define_const(Tar, "NUMERIC_OWNER", INT2NUM(TAR_NUMERIC_OWNER)); /* don't map ids to user/group names */
+  rb_define_const(Tar, "INCREMENTAL",   INT2NUM(TAR_INCREMENTAL));   /* remove what dumpdirs don't list */
+  rb_define_const(Tar, "SPARSE",        INT2NUM(TAR_SPARSE));        /* store and extract holes as holes */
+  rb_define_const(Tar, "NOCACHE",       INT2NUM(TAR_NOCACHE));       /* keep extracted data out of cache */
+  rb_define_const(Tar, "PHYSICAL_ORDER", INT2NUM(TAR_PHYSICAL_ORDER)); /* append trees in disk order */
+  rb_define_const(Tar, "IO_URING",      INT2NUM(TAR_IO_URING));      /* batch small files with io_uring */
+
+  rb_define_method(Tar, "initialize", tarruby_initialize, -1);
   rb_define_singleton_method(Tar, "open", tarruby_s_open, -1);
 #ifdef HAVE_ZLIB_H
   rb_define_singleton_method(Tar, "gzopen", tarruby_s_gzopen, -1);
@@ -677,16 +3119,25 @@ void DLLEXPORT Init_tarruby() {
 #ifdef HAVE_BZLIB_H
   rb_define_singleton_method(Tar, "bzopen", tarruby_s_bzopen, -1);
 #endif
+  rb_define_singleton_method(Tar, "transform", tarruby_s_transform, -1);
   rb_define_method(Tar, "close", tarruby_close, 0);
   rb_define_method(Tar, "append_file", tarruby_append_file, -1);
   rb_define_method(Tar, "append_buffer", tarruby_append_buffer, 2);
+  rb_define_method(Tar, "append_buffers", tarruby_append_buffers, -1);
+  rb_define_method(Tar, "append_io", tarruby_append_io, -1);
   rb_define_method(Tar, "append_tree", tarruby_append_tree, -1);
+  rb_define_method(Tar, "append_files", tarruby_append_files, -1);
   rb_define_method(Tar, "extract_file", tarruby_extract_file, 1);
   rb_define_method(Tar, "extract_buffer", tarruby_extract_buffer, 0);
   rb_define_method(Tar, "extract_glob", tarruby_extract_glob, -1);
+  rb_define_method(Tar, "extract_globs", tarruby_extract_globs, -1);
+  rb_define_method(Tar, "extract_paths", tarruby_extract_paths, -1);
   rb_define_method(Tar, "extract_all", tarruby_extract_all, -1);
   rb_define_method(Tar, "read", tarruby_read, 0);
-  rb_define_method(Tar, "each", tarruby_each, 0);
+  rb_define_method(Tar, "each", tarruby_each, -1);
+  rb_define_method(Tar, "each_entry", tarruby_each_entry, -1);
+  rb_define_method(Tar, "entries", tarruby_entries, -1);
+  rb_define_method(Tar, "entry", tarruby_entry, 0);
   rb_define_method(Tar, "crc", tarruby_crc, 0);
   rb_define_method(Tar, "size", tarruby_size, 0);
   rb_define_method(Tar, "mtime", tarruby_mtime, 0);
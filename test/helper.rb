@@ -0,0 +1,74 @@
+require 'test/unit'
+require 'tmpdir'
+require 'fileutils'
+
+# the extension built in ext/ (ruby extconf.rb && make), or wherever TARRUBY_EXT points
+$LOAD_PATH.unshift(ENV['TARRUBY_EXT'] || File.expand_path('../../ext', __FILE__))
+require 'tarruby'
+
+module TarRubyTestHelper
+  def setup
+    @tmpdir = Dir.mktmpdir('tarruby')
+  end
+
+  def teardown
+    FileUtils.rm_rf(@tmpdir)
+  end
+
+  def path(*names)
+    File.join(@tmpdir, *names)
+  end
+
+  def write_file(name, data, mode = 0644)
+    FileUtils.mkdir_p(File.dirname(path(name)))
+    File.open(path(name), 'wb') {|f| f.write(data) }
+    File.chmod(mode, path(name))
+    path(name)
+  end
+
+  # GNU tar, to check archives against; tests that need it are omitted without it
+  def gnu_tar(*args)
+    omit('GNU tar is not installed') unless TarRubyTestHelper.gnu_tar?
+    out = IO.popen(['tar', *args], :chdir => @tmpdir, :err => [:child, :out]) {|io| io.read }
+    assert($?.success?, "tar #{args.join(' ')} failed: #{out}")
+    out
+  end
+
+  def self.gnu_tar?
+    @gnu_tar = (`tar --version 2>/dev/null` =~ /GNU tar/ ? true : false) if @gnu_tar.nil?
+    @gnu_tar
+  end
+
+  def pathnames(archive, options = 0)
+    Tar.open(archive, File::RDONLY, 0, options) {|tar| tar.map {|t| t.pathname } }
+  end
+
+  # raw members, for headers that neither Tar nor GNU tar can be made to write
+  def ustar_member(name, data, fields = {})
+    h = "\0" * 512
+    put = lambda {|off, str| h[off, str.bytesize] = str }
+    put[0, name]
+    put[100, '%07o' % (fields[:mode] || 0644)]
+    put[108, '%07o' % (fields[:uid] || 0)]
+    put[116, '%07o' % (fields[:gid] || 0)]
+    put[124, '%011o' % data.bytesize]
+    put[136, '%011o' % (fields[:mtime] || 0)]
+    put[148, ' ' * 8]
+    put[156, fields[:typeflag] || '0']
+    put[257, "ustar\0" + '00']
+    put[265, fields[:uname] || 'root']
+    put[297, fields[:gname] || 'root']
+    put[148, '%06o' % h.sum(32) + "\0 "]
+    h + data + "\0" * (-data.bytesize % 512)
+  end
+
+  def pax_member(typeflag, records)
+    data = records.map {|k, v|
+      rec = " #{k}=#{v}\n"
+      len = rec.bytesize + 1
+      len += 1 while (len.to_s + rec).bytesize > len
+      len.to_s + rec
+    }.join
+    ustar_member('PaxHeader', data, :typeflag => typeflag)
+  end
+end
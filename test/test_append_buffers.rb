@@ -0,0 +1,42 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestAppendBuffers < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def members(options = 0)
+    Tar.open(path('a.tar'), File::RDONLY, 0, options) {|tar| tar.map { [tar.pathname, tar.extract_buffer] } }
+  end
+
+  def test_forms
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_buffers({ 'a.js' => 'a', 'b.js' => 'b' * 1000 })
+      tar.append_buffers('c.js' => 'c', 'd.js' => '')
+      tar.append_buffers([['e.js', 'e'], ['dir/f.js', 'f' * 513]])
+      tar.append_buffers({})
+    end
+
+    assert_equal([['a.js', 'a'], ['b.js', 'b' * 1000], ['c.js', 'c'], ['d.js', ''], ['e.js', 'e'], ['dir/f.js', 'f' * 513]], members)
+    assert_equal("a.js\nb.js\nc.js\nd.js\ne.js\ndir/f.js\n", gnu_tar('tf', 'a.tar'))
+  end
+
+  def test_attributes
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_buffers('a' => 'a', 'b' => 'b', mode: 0600, mtime: Time.at(1_234_567_890), uid: 1234, gid: 5678)
+    end
+
+    entries = Tar.open(path('a.tar'), File::RDONLY, 0, Tar::NUMERIC_OWNER) {|tar| tar.entries }
+    assert_equal(%w(a b), entries.map {|e| e.pathname })
+    entries.each do |e|
+      assert_equal([0600, Time.at(1_234_567_890), 1234, 5678], [e.mode & 07777, e.mtime, e.uid, e.gid])
+    end
+    assert_match(%r{\A-rw------- 1234/5678 +1 }, gnu_tar('tvf', 'a.tar', '--numeric-owner'))
+  end
+
+  def test_bad_arguments
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      assert_raise(ArgumentError) { tar.append_buffers }
+      assert_raise(TypeError) { tar.append_buffers('a' => 1) }
+      assert_raise(ArgumentError) { tar.append_buffers({ 'a' => 'a' }, color: :red) }
+    end
+  end
+end
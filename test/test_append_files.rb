@@ -0,0 +1,48 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestAppendFiles < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    write_file('src/a.c', 'a')
+    write_file('src/b.c', 'b' * 2000)
+    write_file('src/c.c', 'c')
+    Dir.mkdir(path('src', 'dir'))
+    File.symlink('a.c', path('src', 'link'))
+  end
+
+  def test_manifest
+    st = File.lstat(path('src', 'c.c'))
+    File.utime(Time.at(1_100_000_000), Time.at(1_100_000_000), path('src', 'c.c'))
+
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_files([
+        path('src', 'a.c'),
+        [path('src', 'b.c'), 'x/b.c'],
+        [path('src', 'c.c'), 'x/c.c', st],
+        [path('src', 'dir/'), 'x/dir'],
+        [path('src', 'link'), 'x/link', nil],
+      ], prefetch: 2)
+    end
+
+    entries = Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) {|tar| tar.entries }
+    assert_equal([path('src', 'a.c'), 'x/b.c', 'x/c.c', 'x/dir/', 'x/link'], entries.map {|e| e.pathname })
+    assert_equal([1, 2000, 1, 0, 0], entries.map {|e| e.size })
+    # the stat given in the manifest is used, not one taken later
+    assert_equal(st.mtime.to_i, entries[2].mtime.to_i)
+    assert_true(entries[3].dir?)
+    assert_equal('a.c', entries[4].linkname)
+
+    Dir.mkdir(path('out'))
+    gnu_tar('xf', 'a.tar', '-C', 'out', 'x')
+    assert_equal('b' * 2000, File.read(path('out', 'x', 'b.c')))
+  end
+
+  def test_missing_file
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      assert_raise(Tar::Error) { tar.append_files([path('src', 'a.c'), path('src', 'missing')]) }
+      assert_raise(ArgumentError) { tar.append_files([path('src', 'a.c')], prefetch: -1) }
+    end
+  end
+end
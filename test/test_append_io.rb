@@ -0,0 +1,52 @@
+require File.expand_path('../helper', __FILE__)
+require 'stringio'
+require 'tempfile'
+
+class TestAppendIo < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_sources
+    data = Random.new(2).bytes(300_000)
+    r, w = IO.pipe
+    writer = Thread.new { w.write(data); w.close }
+
+    Tempfile.create('tarruby', @tmpdir) do |tmp|
+      tmp.write('skipped' + data[0, 1000])
+      tmp.flush
+      tmp.pos = 7
+
+      Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644) do |tar|
+        tar.append_io('pipe', r, size: data.size, mode: 0600, mtime: Time.at(1_300_000_000))
+        tar.append_io('stringio', StringIO.new(data))
+        tar.append_io('tempfile', tmp)
+        tar.append_io('string', data[0, 513])
+        tar.append_buffer('buffer', data[0, 5000])
+      end
+    end
+
+    writer.join
+    r.close
+
+    got = Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.map { [tar.pathname, tar.extract_buffer] } }
+    assert_equal([['pipe', data], ['stringio', data], ['tempfile', data[0, 1000]], ['string', data[0, 513]], ['buffer', data[0, 5000]]], got)
+
+    assert_match(/\A-rw------- .* 300000 2011-03-1\d \d\d:\d\d pipe$/, gnu_tar('tvf', 'a.tar').lines.first)
+    gnu_tar('xf', 'a.tar', 'buffer')
+    assert_equal(data[0, 5000], File.binread(path('buffer')))
+  end
+
+  def test_bad_sizes
+    r, w = IO.pipe
+
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644) do |tar|
+      assert_raise(ArgumentError) { tar.append_io('a', 'abc', size: 4) }
+      assert_raise(ArgumentError) { tar.append_io('a', r) }
+      assert_raise(ArgumentError) { tar.append_io('a', r, size: -1) }
+      w.write('short')
+      w.close
+      assert_raise(Tar::Error) { tar.append_io('a', r, size: 10) }
+    end
+  ensure
+    r.close
+  end
+end
@@ -0,0 +1,43 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestAppendRdwr < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_append_to_own_archive
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) {|tar| tar.append_buffer('a', 'a' * 700) }
+    size = File.size(path('a.tar'))
+
+    3.times do |i|
+      Tar.open(path('a.tar'), File::RDWR, 0644, Tar::GNU) {|tar| tar.append_buffer("b#{i}", 'b') }
+    end
+
+    assert_equal(size + 3 * 1024, File.size(path('a.tar')))
+    assert_equal(%w(a b0 b1 b2), pathnames(path('a.tar')))
+    assert_equal("a\nb0\nb1\nb2\n", gnu_tar('tf', 'a.tar'))
+  end
+
+  def test_append_to_gnu_archive
+    write_file('x', 'x' * 3000)
+    write_file('y', 'y')
+    gnu_tar('cf', 'a.tar', 'x')
+    assert_equal(10240, File.size(path('a.tar')))
+
+    Tar.open(path('a.tar'), File::RDWR, 0644, Tar::GNU) {|tar| tar.append_file(path('y'), 'y') }
+
+    assert_equal("x\ny\n", gnu_tar('tf', 'a.tar'))
+    Dir.mkdir(path('out'))
+    gnu_tar('xf', 'a.tar', '-C', 'out')
+    assert_equal('x' * 3000, File.read(path('out', 'x')))
+    assert_equal('y', File.read(path('out', 'y')))
+  end
+
+  def test_create_with_rdwr
+    Tar.open(path('new.tar'), File::RDWR | File::CREAT, 0644, Tar::GNU) {|tar| tar.append_buffer('a', 'a') }
+    assert_equal(%w(a), pathnames(path('new.tar')))
+  end
+
+  def test_not_an_archive
+    File.binwrite(path('bad.tar'), 'not a tar file' * 100)
+    assert_raise(Tar::Error) { Tar.open(path('bad.tar'), File::RDWR, 0644) {|tar| tar.append_buffer('a', 'a') } }
+  end
+end
@@ -0,0 +1,39 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestCodec < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_base256_owner
+    write_file('a', 'a')
+    gnu_tar('cf', 'a.tar', '--format=gnu', '--owner=3000000', '--group=2200000', '--numeric-owner', 'a')
+
+    entry = Tar.open(path('a.tar'), File::RDONLY, 0, Tar::NUMERIC_OWNER) {|tar| tar.entries.first }
+    assert_equal(3000000, entry.uid)
+    assert_equal(2200000, entry.gid)
+  end
+
+  def test_checksum
+    name = "\xE6\x97\xA5\xE6\x9C\xAC.txt".b
+    File.binwrite(path('a.tar'), ustar_member(name, 'abc') + "\0" * 1024)
+    assert_equal([name], pathnames(path('a.tar')).map {|s| s.b })
+
+    File.open(path('a.tar'), 'r+b') {|f| f.seek(1); f.write('X') }
+    assert_raise(Tar::Error) { pathnames(path('a.tar')) }
+    assert_equal(1, pathnames(path('a.tar'), Tar::IGNORE_CRC).size)
+  end
+
+  def test_end_of_archive
+    data = ustar_member('a', 'a' * 600) + ustar_member('b', '') + "\0" * 1024 + ustar_member('c', 'c')
+    File.binwrite(path('a.tar'), data)
+    assert_equal(%w(a b), pathnames(path('a.tar')))
+    assert_equal(%w(a b c), pathnames(path('a.tar'), Tar::IGNORE_EOT))
+  end
+
+  def test_octal_fields
+    File.binwrite(path('a.tar'), ustar_member('a', 'x' * 513, :mode => 04755, :mtime => 07777777777) + "\0" * 1024)
+    entry = Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.entries.first }
+    assert_equal(513, entry.size)
+    assert_equal(04755, entry.mode & 07777)
+    assert_equal(07777777777, entry.mtime.to_i)
+  end
+end
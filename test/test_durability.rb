@@ -0,0 +1,46 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestDurability < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_buffer('d/a', 'a' * 100_000)
+      tar.append_buffer('d/b', 'b')
+      tar.append_buffer('e/c', 'c')
+    end
+  end
+
+  def files(dir)
+    Dir.chdir(path(dir)) { Dir.glob('**/*', File::FNM_DOTMATCH).reject {|f| File.basename(f) == '.' }.sort }
+  end
+
+  def test_modes
+    [:none, :batch, :per_file, :atomic, nil].each do |durability|
+      dir = "out-#{durability}"
+      Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) {|tar| tar.extract_all(path(dir), durability: durability) }
+      assert_equal(%w(d d/a d/b e e/c), files(dir), durability.inspect)
+      assert_equal('a' * 100_000, File.read(path(dir, 'd', 'a')))
+    end
+  end
+
+  def test_atomic_replaces
+    write_file('out/d/a', 'old')
+    old = File.open(path('out', 'd', 'a'))
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) {|tar| tar.extract_glob('d/*', path('out'), durability: :atomic) }
+    assert_equal('old', old.read)
+    assert_equal('a' * 100_000, File.read(path('out', 'd', 'a')))
+    assert_equal(%w(d d/a d/b), files('out'))
+  ensure
+    old.close if old
+  end
+
+  def test_bad_values
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |tar|
+      assert_raise(ArgumentError) { tar.extract_all(path('out'), durability: :always) }
+      assert_raise(TypeError) { tar.extract_all(path('out'), durability: 'batch') }
+      assert_raise(ArgumentError) { tar.extract_all(path('out'), durable: :batch) }
+    end
+  end
+end
@@ -0,0 +1,44 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestEntries < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_buffer('a.txt', 'aaa')
+      tar.append_io('b.txt', 'b' * 600, mode: 0600, mtime: Time.at(1_400_000_000))
+      tar.append_buffer('c' * 150, 'c')
+    end
+  end
+
+  def test_entries
+    entries = Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) {|tar| tar.entries }
+    assert_equal(['a.txt', 'b.txt', 'c' * 150], entries.map {|e| e.pathname })
+    assert_equal([3, 600, 1], entries.map {|e| e.size })
+
+    b = entries[1]
+    assert_true(b.frozen?)
+    assert_true(b.reg?)
+    assert_equal(0600, b.mode & 07777)
+    assert_equal(Time.at(1_400_000_000), b.mtime)
+    assert_true(b.pathname.frozen?)
+    assert_same(b.pathname, b.pathname)
+    assert_same(b.mtime, b.mtime)
+    assert_equal(entries.map {|e| e.pathname + "\n" }.join, gnu_tar('tf', 'a.tar'))
+  end
+
+  def test_each_entry
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |tar|
+      enum = tar.each_entry
+      assert_kind_of(Enumerator, enum)
+      assert_equal('a.txt', enum.next.pathname)
+    end
+
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |tar|
+      got = []
+      tar.each_entry {|entry| got << [entry.pathname, entry.read] }
+      assert_equal([['a.txt', 'aaa'], ['b.txt', 'b' * 600], ['c' * 150, 'c']], got)
+    end
+  end
+end
@@ -0,0 +1,66 @@
+require File.expand_path('../helper', __FILE__)
+require 'stringio'
+
+class TestEntryRead < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    @data = Random.new(1).bytes(200_000)
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644) do |tar|
+      tar.append_buffer('big', @data)
+      tar.append_buffer('small', 'small')
+    end
+  end
+
+  def test_read
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.read
+      entry = tar.entry
+      assert_equal(@data[0, 10], entry.read(10))
+      buf = 'reused'.b
+      assert_same(buf, entry.readpartial(100, buf))
+      assert_equal(@data[10, 100], buf)
+      assert_equal(@data[110..-1], entry.read)
+      assert_true(entry.eof?)
+      assert_nil(entry.read(1))
+      assert_equal('', entry.read)
+      assert_raise(EOFError) { entry.readpartial(1) }
+
+      tar.read
+      assert_equal('small', tar.extract_buffer)
+      assert_raise_message(/no longer the current member/) { entry.read }
+    end
+  end
+
+  def test_partial_read_then_next
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.read
+      tar.entry.read(1000)
+      tar.read
+      assert_equal('small', tar.pathname)
+      assert_equal('small', tar.entry.read)
+    end
+  end
+
+  def test_each_chunk
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.read
+      chunks = tar.entry.each_chunk(65536).to_a
+      assert_equal([65536, 65536, 65536, 3392], chunks.map {|c| c.size })
+      assert_equal(@data, chunks.join)
+      assert_raise(ArgumentError) { tar.entry.each_chunk(0) {} }
+    end
+  end
+
+  def test_copy_stream
+    out = StringIO.new(''.b)
+
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.read
+      assert_equal(@data.size, IO.copy_stream(tar.entry, out))
+    end
+
+    assert_equal(@data, out.string)
+  end
+end
@@ -0,0 +1,27 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestExtractBuffer < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  SIZES = [0, 1, 511, 512, 513, 1 << 20]
+
+  def test_sizes
+    SIZES.each {|n| write_file("src/#{n}", Random.new(n).bytes(n)) }
+    Dir.mkdir(path('src', 'dir'))
+    gnu_tar('cf', 'a.tar', '-C', 'src', *SIZES.map {|n| n.to_s }, 'dir')
+
+    got = Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.map { [tar.pathname, tar.extract_buffer] } }
+    assert_equal(SIZES.map {|n| [n.to_s, Random.new(n).bytes(n)] } + [['dir/', nil]], got)
+    assert_equal(Encoding::ASCII_8BIT, got[1][1].encoding)
+  end
+
+  def test_rest_of_a_partly_read_member
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644) {|tar| tar.append_buffer('a', 'x' * 1000 + 'y' * 1000) }
+
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.read
+      tar.entry.read(1000)
+      assert_equal('y' * 1000, tar.extract_buffer)
+    end
+  end
+end
@@ -0,0 +1,40 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestExtractGlobs < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644) do |tar|
+      2000.times {|i| tar.append_buffer("d#{i % 10}/f#{i}.txt", i.to_s) }
+      tar.append_buffer('star*', 'literal')
+      tar.append_buffer('starry', 'glob')
+    end
+  end
+
+  def extracted(dir)
+    Dir.chdir(path(dir)) { Dir.glob('**/*').select {|f| File.file?(f) }.sort }
+  end
+
+  def test_extract_paths
+    paths = (0...2000).step(2).map {|i| "d#{i % 10}/f#{i}.txt" }
+
+    Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.extract_paths(paths + ['star*', 'missing'], path('out')) }
+    assert_equal((paths + ['star*']).sort, extracted('out'))
+    assert_equal('1998', File.read(path('out', 'd8/f1998.txt')))
+    assert_equal('literal', File.read(path('out', 'star*')))
+  end
+
+  def test_extract_globs
+    Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.extract_globs(['d1/f1?.txt', 'd3/*3.txt', 'star*'], path('out')) }
+    assert_equal((%w(d1/f11.txt) + (0...2000).select {|i| i % 10 == 3 && i.to_s.end_with?('3') }.map {|i| "d3/f#{i}.txt" } + %w(star* starry)).sort, extracted('out'))
+  end
+
+  def test_stops_once_every_path_is_found
+    File.open(path('a.tar'), 'r+b') {|f| f.seek(-1024, IO::SEEK_END); f.write('garbage' * 100) }
+
+    Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.extract_paths(['d0/f0.txt', 'd9/f1999.txt'], path('out')) }
+    assert_equal(%w(d0/f0.txt d9/f1999.txt), extracted('out'))
+    assert_raise(Tar::Error) { Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.extract_globs('d0/*', path('out')) } }
+  end
+end
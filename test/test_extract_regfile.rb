@@ -0,0 +1,38 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestExtractRegfile < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    @data = Random.new(3).bytes((5 << 20) + 777)
+    write_file('src/big', @data)
+    write_file('src/empty', '')
+    gnu_tar('cf', 'a.tar', '-C', 'src', 'big', 'empty')
+  end
+
+  def test_extract_all
+    [0, Tar::NOCACHE].each do |options|
+      FileUtils.rm_rf(path('out'))
+      Tar.open(path('a.tar'), File::RDONLY, 0, options) {|tar| tar.extract_all(path('out')) }
+      assert_equal(@data.size, File.size(path('out', 'big')))
+      assert_true(@data == File.binread(path('out', 'big')))
+      assert_equal(0, File.size(path('out', 'empty')))
+    end
+  end
+
+  def test_overwrite_longer_file
+    write_file('out/big', 'x' * (8 << 20))
+    Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.extract_all(path('out')) }
+    assert_equal(@data.size, File.size(path('out', 'big')))
+    assert_true(@data == File.binread(path('out', 'big')))
+  end
+
+  def test_extract_file
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.read
+      tar.extract_file(path('copy'))
+    end
+    assert_true(@data == File.binread(path('copy')))
+  end
+end
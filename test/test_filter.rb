@@ -0,0 +1,55 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestFilter < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_io('src/a.c', 'a' * 10, mtime: Time.at(1_000_000_000))
+      tar.append_io('src/b.txt', 'b' * 5000, mtime: Time.at(1_500_000_000))
+      tar.append_io('doc/c.txt', 'c' * 100, mtime: Time.at(1_600_000_000))
+      tar.append_io('doc/d.md', 'd', mtime: Time.at(1_700_000_000))
+    end
+
+    write_file('tree/x', 'x')
+    File.symlink('x', path('tree', 'y'))
+    [path('tree', 'x'), path('tree')].each {|f| File.utime(0, 0, f) }
+    File.lutime(0, 0, path('tree', 'y'))
+    Tar.open(path('a.tar'), File::RDWR, 0644, Tar::GNU) {|tar| tar.append_tree(path('tree'), 'tree') }
+  end
+
+  def each(options)
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) {|tar| tar.each(**options).map { tar.pathname } }
+  end
+
+  # as in extract_glob, wildcards don't match '/' or a leading '.'
+  def test_patterns
+    assert_equal(%w(src/b.txt doc/c.txt), each(include: '*/*.txt'))
+    assert_equal([], each(include: '*.txt'))
+    assert_equal(%w(src/a.c src/b.txt), each(include: ['src/*', 'nothing']))
+    assert_equal(%w(src/a.c doc/d.md tree/ tree/x tree/y).sort, each(exclude: '*/*.txt').sort)
+    assert_equal(%w(doc/c.txt), each(include: '*/*.txt', exclude: 'src/*'))
+  end
+
+  def test_types_size_and_time
+    assert_equal(%w(tree/), each(types: :dir))
+    assert_equal(%w(tree/y), each(types: [:sym, :lnk]))
+    assert_equal(%w(src/b.txt doc/c.txt), each(min_size: 100))
+    assert_equal(%w(doc/c.txt doc/d.md), each(newer_than: Time.at(1_500_000_000)))
+    assert_equal(%w(doc/c.txt), each(min_size: 2, newer_than: Time.at(1_500_000_000), types: :reg))
+    assert_raise(ArgumentError) { each(types: :socket) }
+  end
+
+  def test_entries_and_data
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |tar|
+      assert_equal(%w(doc/c.txt doc/d.md), tar.entries(include: 'doc/*').map {|e| e.pathname })
+    end
+
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |tar|
+      got = []
+      tar.each_entry(include: ['*/*.c', 'doc/*.md', '*.md']) {|e| got << e.read }
+      assert_equal(['a' * 10, 'd'], got)
+    end
+  end
+end
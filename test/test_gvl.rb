@@ -0,0 +1,75 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestGvl < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  # a FIFO that gets the archive only once #release is called
+  def fifo_archive
+    File.mkfifo(path('fifo'))
+    data = ustar_member('a', 'abc') + "\0" * 1024
+    gate = Queue.new
+    writer = Thread.new { File.open(path('fifo'), 'wb') {|f| gate.pop; f.write(data) } }
+    sleep 0.1 # the writer must have the FIFO open, or Tar.open would block with the GVL held
+    tar = Tar.open(path('fifo'), File::RDONLY)
+    [tar, gate, writer]
+  end
+
+  def test_other_threads_run
+    tar, gate, writer = fifo_archive
+    ticks = 0
+    ticker = Thread.new { loop { ticks += 1; sleep 0.01 } }
+    reader = Thread.new { tar.read; tar.extract_buffer }
+    sleep 0.3
+    assert_operator(ticks, :>, 5)
+    assert_equal('sleep', reader.status)
+    gate << true
+    assert_equal('abc', reader.value)
+  ensure
+    ticker.kill if ticker
+    writer.join if writer
+    tar.close if tar
+  end
+
+  def test_busy
+    tar, gate, writer = fifo_archive
+    reader = Thread.new { tar.read }
+    sleep 0.1
+    assert_raise_message(/in use/) { tar.close }
+    assert_raise_message(/in use/) { tar.pathname }
+    gate << true
+    assert_equal(true, reader.value)
+    assert_equal('a', tar.pathname)
+  ensure
+    writer.join if writer
+    tar.close if tar
+  end
+
+  def test_signal_resumes_read
+    trapped = 0
+    old = trap('USR1') { trapped += 1 }
+    tar, gate, writer = fifo_archive
+    reader = Thread.new { tar.read; tar.extract_buffer }
+    sleep 0.1
+    Process.kill('USR1', Process.pid)
+    sleep 0.1
+    gate << true
+    assert_equal('abc', reader.value)
+    assert_equal(1, trapped)
+  ensure
+    trap('USR1', old) if old
+    writer.join if writer
+    tar.close if tar
+  end
+
+  def test_thread_raise
+    tar, gate, writer = fifo_archive
+    reader = Thread.new { Thread.current.report_on_exception = false; tar.read }
+    sleep 0.1
+    reader.raise(RuntimeError, 'stop')
+    assert_raise_message('stop') { reader.join }
+  ensure
+    gate << true if gate
+    writer.join if writer
+    tar.close if tar
+  end
+end
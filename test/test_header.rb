@@ -0,0 +1,34 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestHeader < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_getters
+    write_file('src/a.txt', 'a' * 10, 0640)
+    write_file('src/b.txt', 'b' * 20, 0600)
+    Dir.mkdir(path('src', 'dir'))
+    File.symlink('a.txt', path('src', 'sym'))
+    File.utime(Time.at(1_200_000_000), Time.at(1_200_000_000), path('src', 'a.txt'))
+    gnu_tar('cf', 'a.tar', '-C', 'src', 'a.txt', 'b.txt', 'dir', 'sym')
+
+    seen = []
+
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      tar.each do
+        seen << [tar.pathname, tar.size, tar.mode & 07777, tar.reg?, tar.dir?, tar.sym?, tar.linkname]
+        assert_equal(Process.uid, tar.uid)
+        assert_equal(Process.gid, tar.gid)
+        assert_equal(Time.at(1_200_000_000), tar.mtime) if tar.pathname == 'a.txt'
+        entry = tar.entry
+        assert_equal([tar.pathname, tar.size, tar.mode, tar.mtime], [entry.pathname, entry.size, entry.mode, entry.mtime])
+      end
+    end
+
+    assert_equal([
+      ['a.txt', 10, 0640, true, false, false, ''],
+      ['b.txt', 20, 0600, true, false, false, ''],
+      ['dir/', 0, File.stat(path('src', 'dir')).mode & 07777, false, true, false, ''],
+      ['sym', 0, File.lstat(path('src', 'sym')).mode & 07777, false, false, true, 'a.txt'],
+    ], seen)
+  end
+end
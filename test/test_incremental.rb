@@ -0,0 +1,108 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestIncremental < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    write_file('tree/keep', 'keep')
+    write_file('tree/change', 'old')
+    write_file('tree/remove', 'remove')
+    write_file('tree/sub/deep', 'deep')
+  end
+
+  def change_tree
+    sleep 0.01
+    write_file('tree/change', 'new contents')
+    write_file('tree/sub/added', 'added')
+    File.unlink(path('tree', 'remove'))
+  end
+
+  def dump(level, snar)
+    Tar.open(path("level#{level}.tar"), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_tree(path('tree'), 'tree', listed_incremental: path(snar))
+    end
+  end
+
+  # GNU tar files directories under the names it was given, so these dumps use the same
+  def dump_relative(level, snar)
+    Dir.chdir(@tmpdir) do
+      Tar.open("level#{level}.tar", File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+        tar.append_tree('tree', listed_incremental: snar)
+      end
+    end
+  end
+
+  def changed_files(archive)
+    pathnames(path(archive)).reject {|f| f.end_with?('/') }.sort
+  end
+
+  def restore_with_tarruby(*archives)
+    archives.each do |a|
+      Tar.open(path(a), File::RDONLY, 0, Tar::GNU | Tar::INCREMENTAL) {|tar| tar.extract_all(path('out')) }
+    end
+  end
+
+  def restore_with_gnu_tar(*archives)
+    FileUtils.mkdir_p(path('out'))
+    archives.each {|a| gnu_tar('xf', a, '--listed-incremental=/dev/null', '-C', 'out') }
+  end
+
+  def restored
+    Dir.chdir(path('out')) { Dir.glob('**/*').select {|f| File.file?(f) }.sort.map {|f| [f, File.read(f)] } }
+  end
+
+  EXPECTED = [['tree/change', 'new contents'], ['tree/keep', 'keep'], ['tree/sub/added', 'added'], ['tree/sub/deep', 'deep']]
+
+  def test_only_changes_are_dumped
+    dump(0, 'snar')
+    assert_true(File.exist?(path('snar')))
+    assert_equal(%w(tree/change tree/keep tree/remove tree/sub/deep), changed_files('level0.tar'))
+
+    change_tree
+    dump(1, 'snar')
+    assert_equal(%w(tree/change tree/sub/added), changed_files('level1.tar'))
+  end
+
+  def test_restore_with_tarruby
+    dump(0, 'snar')
+    change_tree
+    dump(1, 'snar')
+    restore_with_tarruby('level0.tar', 'level1.tar')
+    assert_equal(EXPECTED, restored)
+  end
+
+  def test_restore_with_gnu_tar
+    dump(0, 'snar')
+    change_tree
+    dump(1, 'snar')
+    restore_with_gnu_tar('level0.tar', 'level1.tar')
+    assert_equal(EXPECTED, restored)
+  end
+
+  def test_gnu_tar_dumps
+    gnu_tar('cf', 'level0.tar', '--listed-incremental=snar', 'tree')
+    change_tree
+    gnu_tar('cf', 'level1.tar', '--listed-incremental=snar', 'tree')
+    restore_with_tarruby('level0.tar', 'level1.tar')
+    assert_equal(EXPECTED, restored)
+  end
+
+  def test_gnu_tar_snapshot
+    gnu_tar('cf', 'level0.tar', '--listed-incremental=snar', 'tree')
+    change_tree
+    dump_relative(1, 'snar')
+    assert_equal(%w(tree/change tree/sub/added), changed_files('level1.tar'))
+    restore_with_gnu_tar('level0.tar', 'level1.tar')
+    assert_equal(EXPECTED, restored)
+  end
+
+  def test_snapshot_for_gnu_tar
+    dump_relative(0, 'snar')
+    change_tree
+    gnu_tar('cf', 'level1.tar', '--listed-incremental=snar', 'tree')
+    assert_equal(%w(tree/change tree/sub/added), changed_files('level1.tar'))
+    restore_with_tarruby('level0.tar', 'level1.tar')
+    assert_equal(EXPECTED, restored)
+  end
+end
@@ -0,0 +1,60 @@
+require File.expand_path('../helper', __FILE__)
+require 'stringio'
+
+class TestIo < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def write_archive(io, open = :open)
+    Tar.send(open, io, File::WRONLY, 0644, Tar::GNU) do |tar|
+      tar.append_buffer('a.txt', 'a' * 1000)
+      tar.append_buffer('b.txt', 'b')
+    end
+  end
+
+  def read_archive(io, open = :open)
+    Tar.send(open, io, File::RDONLY) {|tar| tar.map { [tar.pathname, tar.extract_buffer] } }
+  end
+
+  def test_stringio
+    io = StringIO.new(''.b)
+    write_archive(io)
+    assert_false(io.closed?)
+    assert_equal(0, io.string.size % 512)
+    io.rewind
+    assert_equal([['a.txt', 'a' * 1000], ['b.txt', 'b']], read_archive(io))
+
+    tar = Tar.new(StringIO.new(io.string), File::RDONLY)
+    assert_equal(%w(a.txt b.txt), tar.map { tar.pathname })
+    tar.close
+  end
+
+  def test_pipe_after_gets
+    File.open(path('a.tar'), 'wb') {|f| write_archive(f) }
+    r, w = IO.pipe
+    writer = Thread.new { w.write("HEADER\n" + File.binread(path('a.tar')) + 'trailer'); w.close }
+
+    assert_equal("HEADER\n", r.gets)
+    assert_equal([['a.txt', 'a' * 1000], ['b.txt', 'b']], read_archive(r))
+    writer.join
+  ensure
+    r.close if r
+  end
+
+  def test_file_to_gnu_tar
+    File.open(path('a.tar'), 'wb') {|f| write_archive(f) }
+    assert_equal("a.txt\nb.txt\n", gnu_tar('tf', 'a.tar'))
+  end
+
+  def test_gzip_and_bzip2
+    [[:gzopen, 'z'], [:bzopen, 'j']].each do |open, flag|
+      next unless Tar.respond_to?(open)
+      io = StringIO.new(''.b)
+      write_archive(io, open)
+      File.binwrite(path('a.tar.z'), io.string)
+      assert_equal("a.txt\nb.txt\n", gnu_tar("t#{flag}f", 'a.tar.z'))
+
+      gnu_tar("c#{flag}f", 'b.tar.z', 'a.tar.z')
+      File.open(path('b.tar.z'), 'rb') {|f| assert_equal([['a.tar.z', io.string]], read_archive(f, open)) }
+    end
+  end
+end
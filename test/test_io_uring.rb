@@ -0,0 +1,51 @@
+require File.expand_path('../helper', __FILE__)
+require 'digest/md5'
+
+# io_uring is used where the kernel has it; elsewhere the same calls fall back to plain syscalls
+class TestIoUring < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    300.times do |i|
+      name = "tree/d#{i % 5}/f#{i}"
+      write_file(name, "#{i}\n" * (i % 50), i.odd? ? 0600 : 0644)
+    end
+    write_file('tree/big', Random.new(4).bytes(3 << 20))
+  end
+
+  def tree(dir)
+    Dir.chdir(path(dir)) { Dir.glob('tree/**/*').select {|f| File.file?(f) }.sort.map {|f| [f, Digest::MD5.file(f).hexdigest] } }
+  end
+
+  def test_extract
+    File.symlink('f0', path('tree', 'd0', 'sym'))
+    # a hard link to a file whose write may still be queued
+    File.link(path('tree', 'd1', 'f1'), path('tree', 'd1', 'hard'))
+    gnu_tar('cf', 'a.tar', 'tree')
+
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU | Tar::IO_URING) {|tar| tar.extract_all(path('out')) }
+
+    assert_equal(tree('.'), tree('out'))
+    assert_equal('f0', File.readlink(path('out', 'tree', 'd0', 'sym')))
+    assert_equal(File.stat(path('out', 'tree', 'd1', 'f1')).ino, File.stat(path('out', 'tree', 'd1', 'hard')).ino)
+    assert_equal(0600, File.stat(path('out', 'tree', 'd1', 'f1')).mode & 07777)
+    assert_equal(0644, File.stat(path('out', 'tree', 'd2', 'f2')).mode & 07777)
+  end
+
+  def test_extract_with_durability
+    gnu_tar('cf', 'a.tar', 'tree')
+
+    [:per_file, :atomic].each do |durability|
+      Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU | Tar::IO_URING) {|tar| tar.extract_all(path(durability.to_s), durability: durability) }
+      assert_equal(tree('.'), tree(durability.to_s), durability.inspect)
+    end
+  end
+
+  def test_append_tree
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU | Tar::IO_URING) {|tar| tar.append_tree(path('tree'), 'tree') }
+    Dir.mkdir(path('out'))
+    gnu_tar('xf', 'a.tar', '-C', 'out')
+    assert_equal(tree('.'), tree('out'))
+  end
+end
@@ -0,0 +1,42 @@
+require File.expand_path('../helper', __FILE__)
+require 'etc'
+
+class TestOwner < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_names_map_to_ids
+    File.open(path('a.tar'), 'wb') do |f|
+      3.times {|i| f << ustar_member("root#{i}", '', :uid => 4242, :gid => 4243, :uname => 'root', :gname => Etc.getgrgid(0).name) }
+      f << ustar_member('nobody', '', :uid => 4242, :gid => 4243, :uname => 'no-such-user', :gname => 'no-such-group')
+      f << "\0" * 1024
+    end
+
+    entries = Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.entries }
+    assert_equal([[0, 0]] * 3 + [[4242, 4243]], entries.map {|e| [e.uid, e.gid] })
+
+    entries = Tar.open(path('a.tar'), File::RDONLY, 0, Tar::NUMERIC_OWNER) {|tar| tar.entries }
+    assert_equal([[4242, 4243]] * 4, entries.map {|e| [e.uid, e.gid] })
+  end
+
+  def test_names_written
+    write_file('a', 'a')
+
+    [0, Tar::NUMERIC_OWNER].each do |options|
+      Tar.open(path('a.tar'), File::CREAT | File::WRONLY | File::TRUNC, 0644, options) do |tar|
+        tar.append_file(path('a'), 'a')
+      end
+
+      header = File.binread(path('a.tar'), 512)
+      uname, gname = header[265, 32].delete("\0"), header[297, 32].delete("\0")
+
+      if options == 0
+        assert_equal(Etc.getpwuid(Process.uid).name, uname)
+        assert_equal(Etc.getgrgid(Process.gid).name, gname)
+      else
+        assert_equal(['', ''], [uname, gname])
+      end
+
+      assert_match(%r{ #{Process.uid}/#{Process.gid} }, gnu_tar('tvf', 'a.tar', '--numeric-owner'))
+    end
+  end
+end
@@ -0,0 +1,56 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestPax < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  LONG = 'd' * 120 + '/' + 'f' * 150 + '.txt'
+
+  def test_long_name_round_trip
+    write_file('src/' + LONG, 'long')
+
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::PAX) do |tar|
+      tar.append_file(path('src', LONG), LONG)
+    end
+
+    assert_equal([LONG], pathnames(path('a.tar')))
+    assert_equal(LONG + "\n", gnu_tar('tf', 'a.tar'))
+    assert_equal('x', File.binread(path('a.tar'), 1, 156))
+  end
+
+  def test_read_gnu_pax
+    write_file('src/' + LONG, 'x' * 1000)
+    File.symlink('l' * 200, path('src', 'link'))
+    File.utime(Time.at(1_000_000_000, 123456789, :nsec), Time.at(1_000_000_000, 123456789, :nsec), path('src/' + LONG))
+    gnu_tar('cf', 'a.tar', '--format=posix', '-C', 'src', LONG, 'link')
+
+    Tar.open(path('a.tar'), File::RDONLY) do |tar|
+      entries = tar.entries
+      assert_equal([LONG, 'link'], entries.map {|e| e.pathname })
+      assert_equal(1000, entries[0].size)
+      assert_equal(123456789, entries[0].mtime.nsec)
+      assert_equal('l' * 200, entries[1].linkname)
+    end
+
+    Tar.open(path('a.tar'), File::RDONLY) {|tar| tar.extract_all(path('dst')) }
+    assert_equal('x' * 1000, File.binread(path('dst', LONG)))
+  end
+
+  def test_global_and_local_headers
+    File.open(path('g.tar'), 'wb') do |f|
+      f << pax_member('g', 'uid' => 100, 'gname' => 'global')
+      f << ustar_member('a', 'a')
+      f << pax_member('x', 'uid' => 200)
+      f << ustar_member('b', 'b')
+      f << pax_member('g', 'gid' => 300)
+      f << ustar_member('c', 'c')
+      f << pax_member('g', 'uid' => '')
+      f << ustar_member('d', 'd', :uid => 7)
+      f << "\0" * 1024
+    end
+
+    entries = Tar.open(path('g.tar'), File::RDONLY, 0, Tar::NUMERIC_OWNER) {|tar| tar.entries }
+    assert_equal(%w(a b c d), entries.map {|e| e.pathname })
+    assert_equal([100, 200, 100, 7], entries.map {|e| e.uid })
+    assert_equal([0, 0, 300, 300], entries.map {|e| e.gid })
+  end
+end
@@ -0,0 +1,37 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestPhysicalOrder < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def setup
+    super
+    @files = {}
+    200.times do |i|
+      name = "tree/d#{i % 7}/f#{i}"
+      @files[name] = "#{i}" * (i * 37 % 3000)
+      write_file(name, @files[name])
+    end
+  end
+
+  def members(archive)
+    Tar.open(path(archive), File::RDONLY, 0, Tar::GNU) {|tar| tar.each(types: :reg).map { [tar.pathname, tar.extract_buffer] } }
+  end
+
+  def test_append_tree
+    [nil, 0, 16].each do |prefetch|
+      Tar.open(path('a.tar'), File::CREAT | File::WRONLY | File::TRUNC, 0644, Tar::GNU | Tar::PHYSICAL_ORDER) do |tar|
+        tar.append_tree(path('tree'), 'tree', prefetch: prefetch)
+      end
+
+      assert_equal(@files.sort, members('a.tar').sort, "prefetch: #{prefetch.inspect}")
+      assert_equal(1 + 7, pathnames(path('a.tar'), Tar::GNU).count {|f| f.end_with?('/') })
+      assert_equal(@files.size, gnu_tar('tf', 'a.tar').lines.count {|l| !l.end_with?("/\n") })
+    end
+  end
+
+  def test_negative_prefetch
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU | Tar::PHYSICAL_ORDER) do |tar|
+      assert_raise(ArgumentError) { tar.append_tree(path('tree'), 'tree', prefetch: -1) }
+    end
+  end
+end
@@ -0,0 +1,30 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestRactor < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_archives_in_ractors
+    omit('Ractor is not available') unless defined?(Ractor)
+    verbose, $VERBOSE = $VERBOSE, nil # "Ractor is experimental"
+
+    ractors = 4.times.map do |i|
+      Ractor.new(path("#{i}.tar"), i) do |archive, n|
+        Tar.open(archive, File::CREAT | File::WRONLY, 0644, Tar::GNU) do |tar|
+          100.times {|j| tar.append_buffer("#{n}/#{j}.txt", "#{n}-#{j}") }
+        end
+
+        Tar.open(archive, File::RDONLY, 0644, Tar::GNU) do |tar|
+          tar.map { [tar.pathname, tar.extract_buffer, tar.uid] }
+        end
+      end
+    end
+
+    ractors.each_with_index do |r, i|
+      members = r.take
+      assert_equal(100, members.size)
+      assert_equal(["#{i}/99.txt", "#{i}-99", Process.uid], members.last)
+    end
+  ensure
+    $VERBOSE = verbose
+  end
+end
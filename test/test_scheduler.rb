@@ -0,0 +1,101 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestScheduler < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  # just enough of a Fiber scheduler to interleave fibers waiting on pipes and sleeps
+  class Scheduler
+    def initialize
+      @readable = {}
+      @writable = {}
+      @sleeping = {}
+    end
+
+    def fiber(&block)
+      fiber = Fiber.new(:blocking => false, &block)
+      fiber.resume
+      fiber
+    end
+
+    def io_wait(io, events, timeout)
+      @readable[Fiber.current] = io if events & IO::READABLE != 0
+      @writable[Fiber.current] = io if events & IO::WRITABLE != 0
+      Fiber.yield
+      events
+    end
+
+    def kernel_sleep(duration = nil)
+      @sleeping[Fiber.current] = now + (duration || 0)
+      Fiber.yield
+      true
+    end
+
+    def block(blocker, timeout = nil)
+      raise NotImplementedError
+    end
+
+    def unblock(blocker, fiber)
+      raise NotImplementedError
+    end
+
+    def close
+      until @readable.empty? && @writable.empty? && @sleeping.empty?
+        r, w = IO.select(@readable.values, @writable.values, nil, 0.01)
+        ready = @readable.select {|_, io| r && r.include?(io) }.keys +
+                @writable.select {|_, io| w && w.include?(io) }.keys +
+                @sleeping.select {|_, t| t <= now }.keys
+        ready.each {|f| @readable.delete(f); @writable.delete(f); @sleeping.delete(f); f.resume }
+      end
+    end
+
+    def now
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+  end
+
+  def test_read_yields_to_other_fibers
+    data = ustar_member('a', 'a' * 3000) + ustar_member('b', 'b' * 10) + "\0" * 1024
+    events = []
+
+    thread = Thread.new do
+      Fiber.set_scheduler(Scheduler.new)
+      r, w = IO.pipe
+
+      Fiber.schedule do
+        Tar.new(r, File::RDONLY).each {|tar| events << [tar.pathname, tar.extract_buffer.size] }
+      end
+
+      Fiber.schedule do
+        data.scan(/.{1,700}/m) {|s| events << :chunk; w.write(s); sleep 0.01 }
+        w.close
+      end
+    end
+
+    assert_not_nil(thread.join(10), 'the fibers did not finish')
+    assert_equal([['a', 3000], ['b', 10]], events - [:chunk])
+    assert_operator(events.index(['a', 3000]), :>, 1)
+    assert_operator(events.index(['a', 3000]), :<, events.rindex(:chunk))
+  end
+
+  def test_write_yields_to_other_fibers
+    got = nil
+
+    thread = Thread.new do
+      Fiber.set_scheduler(Scheduler.new)
+      r, w = IO.pipe
+
+      Fiber.schedule do
+        tar = Tar.new(w, File::WRONLY)
+        tar.append_buffer('big', 'x' * 200_000)
+        tar.close
+        w.close
+      end
+
+      Fiber.schedule { got = r.read }
+    end
+
+    assert_not_nil(thread.join(10), 'the fibers did not finish')
+    File.binwrite(path('a.tar'), got)
+    assert_equal(['big'], pathnames(path('a.tar')))
+  end
+end
@@ -0,0 +1,75 @@
+require File.expand_path('../helper', __FILE__)
+require 'digest/md5'
+
+class TestSparse < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  SIZE = 20 << 20
+
+  def setup
+    super
+    File.open(path('image'), 'wb') do |f|
+      f.write('head' * 1024)
+      f.seek(10 << 20)
+      f.write('middle' * 2000)
+      f.truncate(SIZE)
+    end
+    omit('the file system has no holes') if File.stat(path('image')).blocks * 512 >= SIZE
+  end
+
+  def image
+    Digest::MD5.file(path('image')).hexdigest
+  end
+
+  def contents(file)
+    Digest::MD5.file(file).hexdigest
+  end
+
+  def assert_sparse(file)
+    assert_equal(SIZE, File.size(file))
+    assert_operator(File.stat(file).blocks * 512, :<, SIZE / 4)
+  end
+
+  def create
+    Tar.open(path('a.tar'), File::CREAT | File::WRONLY, 0644, Tar::GNU | Tar::SPARSE) do |tar|
+      tar.append_file(path('image'), 'image')
+    end
+    assert_operator(File.size(path('a.tar')), :<, SIZE / 4)
+  end
+
+  def test_round_trip
+    create
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU | Tar::SPARSE) {|tar| tar.extract_all(path('out')) }
+    assert_equal(image, contents(path('out', 'image')))
+    assert_sparse(path('out', 'image'))
+  end
+
+  def test_gnu_tar_extracts
+    create
+    Dir.mkdir(path('out'))
+    gnu_tar('xf', 'a.tar', '-C', 'out')
+    assert_equal(image, contents(path('out', 'image')))
+    assert_sparse(path('out', 'image'))
+  end
+
+  def test_gnu_tar_creates
+    %w(0.1 1.0).each do |version|
+      gnu_tar('cSf', "#{version}.tar", '--format=pax', "--sparse-version=#{version}", 'image')
+      FileUtils.rm_rf(path('out'))
+      Tar.open(path("#{version}.tar"), File::RDONLY, 0, Tar::GNU | Tar::SPARSE) {|tar| tar.extract_all(path('out')) }
+      assert_equal(image, contents(path('out', 'image')), "sparse #{version}")
+      assert_sparse(path('out', 'image'))
+    end
+
+    gnu_tar('cSf', 'old.tar', '--format=gnu', 'image')
+    entries = Tar.open(path('old.tar'), File::RDONLY, 0, Tar::GNU | Tar::SPARSE) {|tar| tar.map { [tar.pathname, tar.size] } }
+    assert_equal([['image', SIZE]], entries)
+  end
+
+  def test_zero_blocks_of_a_plain_archive
+    gnu_tar('cf', 'plain.tar', 'image')
+    Tar.open(path('plain.tar'), File::RDONLY, 0, Tar::GNU | Tar::SPARSE) {|tar| tar.extract_all(path('out')) }
+    assert_equal(image, contents(path('out', 'image')))
+    assert_sparse(path('out', 'image'))
+  end
+end
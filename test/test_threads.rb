@@ -0,0 +1,27 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestThreads < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  def test_separate_handles
+    8.times {|i| write_file("src#{i}/d/#{'n' * 120}/f.txt", "file #{i}") }
+
+    threads = 8.times.map do |i|
+      Thread.new do
+        50.times do |k|
+          archive = path("#{i}.tar")
+          Tar.open(archive, File::CREAT | File::WRONLY | File::TRUNC, 0644, Tar::GNU) do |tar|
+            tar.append_tree(path("src#{i}"), "s#{i}")
+          end
+          Tar.open(archive, File::RDONLY, 0, Tar::GNU) {|tar| tar.extract_all(path("dst#{i}-#{k % 2}")) }
+        end
+        Tar.open(path("#{i}.tar"), File::RDONLY, 0, Tar::GNU) {|tar| tar.entries.map {|e| [e.pathname, e.uid] } }
+      end
+    end
+
+    threads.each_with_index do |t, i|
+      assert_include(t.value, ["s#{i}/d/#{'n' * 120}/f.txt", Process.uid])
+      assert_equal("file #{i}", File.read(path("dst#{i}-1", "s#{i}/d/#{'n' * 120}/f.txt")))
+    end
+  end
+end
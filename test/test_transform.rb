@@ -0,0 +1,65 @@
+require File.expand_path('../helper', __FILE__)
+
+class TestTransform < Test::Unit::TestCase
+  include TarRubyTestHelper
+
+  LONG = 'l' * 200
+
+  def setup
+    super
+    write_file('src/VERSION', '1.0')
+    write_file('src/main.c', 'int main;' * 100)
+    write_file('src/main.o', "\x7fELF")
+    write_file("src/#{LONG}", 'long')
+    File.link(path('src', 'main.c'), path('src', 'hard.c'))
+    gnu_tar('cf', 'a.tar', '--format=gnu', '-C', 'src', 'VERSION', 'main.c', 'main.o', LONG, 'hard.c')
+  end
+
+  def test_rewrite
+    Tar.transform(path('a.tar'), path('b.tar'), Tar::GNU) do |entry|
+      if entry.pathname =~ /\.o\z/
+        entry.drop
+      elsif entry.pathname == 'VERSION'
+        entry.data = entry.read.succ
+        entry.mode = 0600
+        entry.mtime = Time.at(1_111_111_111)
+      else
+        entry.pathname = 'foo-1.0/' + entry.pathname
+        entry.linkname = 'foo-1.0/' + entry.linkname if entry.lnk?
+      end
+    end
+
+    assert_equal("VERSION\nfoo-1.0/main.c\nfoo-1.0/#{LONG}\nfoo-1.0/hard.c\n", gnu_tar('tf', 'b.tar'))
+    assert_match(/\A-rw------- .* 2005-03-1\d \d\d:\d\d VERSION$/, gnu_tar('tvf', 'b.tar'))
+
+    Dir.mkdir(path('out'))
+    gnu_tar('xf', 'b.tar', '-C', 'out')
+    assert_equal('1.1', File.read(path('out', 'VERSION')))
+    assert_equal('int main;' * 100, File.read(path('out', 'foo-1.0', 'hard.c')))
+    assert_equal(File.stat(path('out', 'foo-1.0', 'main.c')).ino, File.stat(path('out', 'foo-1.0', 'hard.c')).ino)
+    assert_equal('long', File.read(path('out', 'foo-1.0', LONG)))
+  end
+
+  def test_untouched_copy
+    Tar.transform(path('a.tar'), path('b.tar'), Tar::GNU) {|entry| }
+    assert_equal(gnu_tar('tvf', 'a.tar'), gnu_tar('tvf', 'b.tar'))
+  end
+
+  def test_compressed_handles
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |src|
+      Tar.gzopen(path('b.tar.gz'), File::CREAT | File::WRONLY, 0644, Tar::GNU) do |dst|
+        Tar.transform(src, dst) {|entry| entry.uid = 0; entry.gid = 0 }
+      end
+    end
+
+    assert_equal("VERSION\nmain.c\nmain.o\n#{LONG}\nhard.c\n", gnu_tar('tzf', 'b.tar.gz'))
+    assert_match(%r{\A\S+ 0/0 }, gnu_tar('tvzf', 'b.tar.gz', '--numeric-owner'))
+  end
+
+  def test_entries_elsewhere_are_frozen
+    Tar.open(path('a.tar'), File::RDONLY, 0, Tar::GNU) do |tar|
+      tar.read
+      assert_raise(FrozenError) { tar.entry.pathname = 'x' }
+    end
+  end
+end